@@ -0,0 +1,803 @@
+// Micro-benchmarks for libimage2pixel kernels.
+//
+//   bench_pixelate [--sizes 1,16] [--blocks 2,8,32] [--formats argb32,rgb888]
+//                  [--threads 1,0] [--warmup 2] [--reps 7] [--counters]
+//                  [--json out.json]
+//
+// Every case runs `warmup` untimed iterations followed by `reps` timed ones
+// and reports the median and p95. Speedup is relative to each kernel's named
+// baseline (usually the original single-threaded loop) on the same size,
+// block, format and thread count.
+// With --counters, hardware counters are summed over the timed runs of every
+// case and reported as IPC and cycles/misses per pixel. Heap allocations of
+// 1 MiB or more made during the timed runs are always counted ("allocs").
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <new>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#include <string>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "image.h"
+#include "jpeg_writer.h"
+#include "oklab.h"
+#include "parallel.h"
+#include "perf_counters.h"
+#include "pixelate.h"
+#include "planar.h"
+#include "render.h"
+#include "resample.h"
+#include "synth.h"
+
+#ifndef IMAGE2PIXEL_VERSION
+#define IMAGE2PIXEL_VERSION "unknown"
+#endif
+
+// Global allocation hooks: count every heap allocation big enough to be an
+// image buffer, wherever it comes from (kernels, the pool, the library).
+namespace {
+
+const size_t kLargeAllocation = size_t(1) << 20;
+std::atomic<uint64_t> largeAllocations{0};
+
+void *countedAllocation(size_t size, size_t alignment) {
+    if (size >= kLargeAllocation) largeAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+#if defined(_WIN32)
+    void *p = _aligned_malloc(size, std::max(alignment, alignof(std::max_align_t)));
+#else
+    void *p = alignment > alignof(std::max_align_t)
+                  ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                  : std::malloc(size);
+#endif
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void countedFree(void *p) {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+} // namespace
+
+void *operator new(size_t size) { return countedAllocation(size, 0); }
+void *operator new[](size_t size) { return countedAllocation(size, 0); }
+void *operator new(size_t size, std::align_val_t alignment) { return countedAllocation(size, size_t(alignment)); }
+void *operator new[](size_t size, std::align_val_t alignment) { return countedAllocation(size, size_t(alignment)); }
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete[](void *p) noexcept { countedFree(p); }
+void operator delete(void *p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { countedFree(p); }
+void operator delete(void *p, size_t) noexcept { countedFree(p); }
+void operator delete[](void *p, size_t) noexcept { countedFree(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { countedFree(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { countedFree(p); }
+
+namespace {
+
+struct Config {
+    std::vector<double> megapixels = {1, 16};
+    std::vector<int> blockSizes = {2, 4, 8, 16, 32, 100};
+    std::vector<i2p::PixelFormat> formats = {i2p::PixelFormat::Argb32};
+    i2p::SynthPattern pattern = i2p::SynthPattern::Noise;
+    uint64_t seed = 1;
+    std::vector<int> threads = {1, 0};
+    int warmup = 2;
+    int reps = 7;
+    bool baseline = true;
+    bool counters = false;
+    std::string jsonPath;
+};
+
+struct Result {
+    std::string kernel;
+    double megapixels;
+    int width;
+    int height;
+    int blockSize;
+    i2p::PixelFormat format;
+    int threads;
+    double medianMs;
+    double p95Ms;
+    double minMs;
+    double nsPerPixel;
+    double gbPerSecond;
+    double speedup;     // 0 when there is no baseline for the case
+    double allocations; // large heap allocations per timed run
+    bench::CounterValues counters;  // per timed run, when --counters is given
+};
+
+// A kernel under test. `setup` runs once, untimed, before the timed `run`
+// calls; speedup is reported against the kernel named `baseline` on the same
+// case. When `checked` is set, the destination must match the baseline
+// kernel's output byte for byte after the timed runs.
+struct Kernel {
+    using Body = std::function<void(const i2p::ConstImageView &, const i2p::ImageView &, const i2p::PixelateParams &)>;
+
+    std::string name;
+    std::string baseline;
+    bool threaded;
+    Body run;
+    Body setup;
+    bool checked = false;
+};
+
+template <typename T, typename Parse>
+std::vector<T> parseList(const std::string &text, Parse parse) {
+    std::vector<T> values;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        std::string item = text.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (!item.empty()) values.push_back(parse(item));
+        if (comma == std::string::npos) break;
+        start = comma + 1;
+    }
+    return values;
+}
+
+// The original PixelatorWindow::pixelate loop without QColor: copy the
+// source, then average and fill one block at a time with per-pixel bounds
+// checks, on one thread. Kept as the fixed point for speedup numbers.
+void baselinePixelate(const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &params) {
+    const int bpp = i2p::bytesPerPixel(src.format);
+    const int blockSize = params.grid.blockSize;
+    for (int y = 0; y < src.height; ++y) {
+        std::memcpy(dst.row(y), src.row(y), static_cast<size_t>(src.width) * bpp);
+    }
+    if (blockSize <= 1) return;
+
+    for (int y = 0; y < src.height; y += blockSize) {
+        for (int x = 0; x < src.width; x += blockSize) {
+            long sum[4] = {0, 0, 0, 0};
+            int count = 0;
+            for (int by = 0; by < blockSize; ++by) {
+                if (y + by >= src.height) break;
+                for (int bx = 0; bx < blockSize; ++bx) {
+                    if (x + bx >= src.width) break;
+                    const uint8_t *p = src.row(y + by) + (x + bx) * bpp;
+                    for (int c = 0; c < bpp; ++c) sum[c] += p[c];
+                    count++;
+                }
+            }
+            if (count == 0) continue;
+            uint8_t avg[4];
+            for (int c = 0; c < bpp; ++c) avg[c] = static_cast<uint8_t>(sum[c] / count);
+            for (int by = 0; by < blockSize; ++by) {
+                if (y + by >= src.height) break;
+                for (int bx = 0; bx < blockSize; ++bx) {
+                    if (x + bx >= src.width) break;
+                    std::memcpy(dst.row(y + by) + (x + bx) * bpp, avg, bpp);
+                }
+            }
+        }
+    }
+}
+
+// pixelate() before the fill was split into row expansion and replication:
+// every pixel of a block is written individually. Kept to measure the fill.
+template <int Channels>
+void pixelFillRows(const i2p::ConstImageView &src, const i2p::ImageView &dst, int blockSize, int firstBlockRow,
+                   int lastBlockRow) {
+    for (int blockRow = firstBlockRow; blockRow < lastBlockRow; ++blockRow) {
+        const int y0 = blockRow * blockSize;
+        const int y1 = std::min(y0 + blockSize, src.height);
+        for (int x0 = 0; x0 < src.width; x0 += blockSize) {
+            const int x1 = std::min(x0 + blockSize, src.width);
+            uint32_t sum[Channels] = {};
+            for (int by = y0; by < y1; ++by) {
+                const uint8_t *p = src.row(by) + x0 * Channels;
+                for (int bx = x0; bx < x1; ++bx, p += Channels) {
+                    for (int c = 0; c < Channels; ++c) sum[c] += p[c];
+                }
+            }
+            const uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+            uint8_t avg[Channels];
+            for (int c = 0; c < Channels; ++c) avg[c] = static_cast<uint8_t>(sum[c] / count);
+            for (int by = y0; by < y1; ++by) {
+                uint8_t *p = dst.row(by) + x0 * Channels;
+                for (int bx = x0; bx < x1; ++bx, p += Channels) std::memcpy(p, avg, Channels);
+            }
+        }
+    }
+}
+
+void pixelFillPixelate(const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &params) {
+    const int blockSize = params.grid.blockSize;
+    if (blockSize <= 1) {
+        i2p::pixelate(src, dst, params);
+        return;
+    }
+    const int blockRows = (src.height + blockSize - 1) / blockSize;
+    i2p::parallelFor(0, blockRows, params.threads, [&](int first, int last) {
+        switch (i2p::bytesPerPixel(src.format)) {
+            case 1: pixelFillRows<1>(src, dst, blockSize, first, last); break;
+            case 3: pixelFillRows<3>(src, dst, blockSize, first, last); break;
+            default: pixelFillRows<4>(src, dst, blockSize, first, last); break;
+        }
+    });
+}
+
+bool sameImage(const i2p::ConstImageView &a, const i2p::ConstImageView &b) {
+    const size_t rowBytes = static_cast<size_t>(a.width) * i2p::bytesPerPixel(a.format);
+    for (int y = 0; y < a.height; ++y) {
+        if (std::memcmp(a.row(y), b.row(y), rowBytes) != 0) return false;
+    }
+    return true;
+}
+
+void encodeDestination(const i2p::ImageView &dst, const i2p::GridGeometry &grid) {
+    static std::vector<uint8_t> encoded;
+    i2p::JpegOptions options;
+    options.grid = grid;
+    i2p::encodeJpeg(dst, options, encoded);
+}
+
+std::vector<Kernel> kernels() {
+    auto pixelateInto = [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+        i2p::pixelate(src, dst, p);
+    };
+    // What a GUI update does: take a render buffer from the pool, pixelate
+    // into it and hand back the previous render, which the view held until
+    // now. Once two buffers are in the pool this must not allocate.
+    auto pooledUpdate = [](const i2p::ConstImageView &src, const i2p::ImageView &, const i2p::PixelateParams &p) {
+        static i2p::BufferPool pool;
+        static void *shown = nullptr;
+        i2p::ImageView target = pool.acquire(src.width, src.height, src.format);
+        i2p::pixelate(src, target, p);
+        pool.release(shown);
+        shown = target.data;
+    };
+
+    std::vector<Kernel> list;
+    list.push_back({"baseline", "", false, baselinePixelate, nullptr});
+    list.push_back({"pixel-fill", "baseline", true, pixelFillPixelate, nullptr, true});
+    // pixelate() restricted to one of its kernels. Each step is reported
+    // against the previous one: hardware division, then reciprocal tables
+    // ("generic"), then the block-size specialisations ("pixelate").
+    auto withKernel = [](i2p::ReduceKernel kernel) {
+        return [kernel](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+            i2p::PixelateParams forced = p;
+            forced.kernel = kernel;
+            i2p::pixelate(src, dst, forced);
+        };
+    };
+    list.push_back({"division", "baseline", true, withKernel(i2p::ReduceKernel::Division), nullptr, true});
+    list.push_back({"generic", "division", true, withKernel(i2p::ReduceKernel::Generic), nullptr, true});
+    list.push_back({"separable", "generic", true, withKernel(i2p::ReduceKernel::Separable), nullptr, true});
+    list.push_back({"pixelate", "generic", true, pixelateInto, nullptr, true});
+    list.push_back({"update", "baseline", true, pooledUpdate, nullptr});
+    // Blocks averaged in Oklab; the speedup column is its cost relative to
+    // the sRGB mean.
+    list.push_back({"oklab", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::PixelateParams params = p;
+                        params.sampling = i2p::BlockSampling::Oklab;
+                        i2p::pixelate(src, dst, params);
+                    },
+                    nullptr});
+    // Each block's most frequent colour from a coarse histogram, against the
+    // mean it replaces.
+    list.push_back({"dominant", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::PixelateParams params = p;
+                        params.sampling = i2p::BlockSampling::Dominant;
+                        i2p::pixelate(src, dst, params);
+                    },
+                    nullptr});
+    // Per-channel rank statistics: sorting networks up to 8x8 blocks,
+    // 256-bin counting above.
+    list.push_back({"median", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::PixelateParams params = p;
+                        params.sampling = i2p::BlockSampling::Median;
+                        i2p::pixelate(src, dst, params);
+                    },
+                    nullptr});
+    list.push_back({"trimmed-mean", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::PixelateParams params = p;
+                        params.sampling = i2p::BlockSampling::TrimmedMean;
+                        i2p::pixelate(src, dst, params);
+                    },
+                    nullptr});
+    // Mosaic shapes at the block size as cell width, through the precomputed
+    // run maps; against square blocks of the same width.
+    for (i2p::BlockShape shape : {i2p::BlockShape::Hexagon, i2p::BlockShape::Triangle, i2p::BlockShape::Dot}) {
+        list.push_back({i2p::blockShapeName(shape), "pixelate", true,
+                        [shape](const i2p::ConstImageView &src, const i2p::ImageView &dst,
+                                const i2p::PixelateParams &p) {
+                            i2p::PixelateParams params = p;
+                            params.shape = shape;
+                            i2p::pixelate(src, dst, params);
+                        },
+                        nullptr});
+    }
+    // The block grid turned by 30 degrees. The pixel-to-cell mapping is built
+    // on the first (warm-up) run and reused from then on.
+    list.push_back({"rotated", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::PixelateParams params = p;
+                        params.angle = 30.0;
+                        i2p::pixelate(src, dst, params);
+                    },
+                    nullptr});
+    // Target-resolution grid with cells half a pixel wider than the block,
+    // so every cell edge cuts through pixels; against the integer grid.
+    list.push_back({"target-grid", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        const int cell = 2 * p.grid.blockSize + 1;
+                        i2p::pixelateToGrid(src, dst, std::max(src.width * 2 / cell, 1),
+                                            std::max(src.height * 2 / cell, 1), p.threads);
+                    },
+                    nullptr});
+    // Quadtree blocks with the block size as the smallest leaf; output
+    // differs from the uniform grid, so it is timed but not checked.
+    list.push_back({"adaptive", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::RenderParams params;
+                        params.mode = i2p::PixelateMode::Adaptive;
+                        params.pixelate = p;
+                        i2p::render(src, dst, params);
+                    },
+                    nullptr});
+    // Pixelation followed by a 16-colour k-means palette fitted to the block
+    // colours and mapped back onto the image.
+    list.push_back({"quantize", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::RenderParams params;
+                        params.pixelate = p;
+                        params.colors = 16;
+                        i2p::render(src, dst, params);
+                    },
+                    nullptr});
+    // Mapping to a fixed 16-colour palette through its lookup cube, which is
+    // built once outside the timed runs.
+    static i2p::PaletteLut pico8;
+    auto buildPico8 = [](const i2p::ConstImageView &, const i2p::ImageView &, const i2p::PixelateParams &) {
+        if (pico8.empty()) {
+            i2p::Palette palette;
+            i2p::builtinPalette("pico8", palette);
+            pico8.build(palette);
+        }
+    };
+    list.push_back({"palette-lut", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::RenderParams params;
+                        params.pixelate = p;
+                        params.palette = &pico8;
+                        i2p::render(src, dst, params);
+                    },
+                    buildPico8});
+    list.push_back({"bayer", "palette-lut", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::RenderParams params;
+                        params.pixelate = p;
+                        params.palette = &pico8;
+                        params.dither = i2p::DitherMethod::Bayer4;
+                        i2p::render(src, dst, params);
+                    },
+                    buildPico8});
+    // Floyd-Steinberg over the blocks; with --threads the rows run as a
+    // wavefront, so this shows how the serial dependency scales.
+    list.push_back({"diffusion", "palette-lut", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        i2p::RenderParams params;
+                        params.pixelate = p;
+                        params.palette = &pico8;
+                        params.dither = i2p::DitherMethod::FloydSteinberg;
+                        i2p::render(src, dst, params);
+                    },
+                    buildPico8});
+
+    // Planar working format: the full round trip (split, average each plane,
+    // merge), the plane averaging alone as one stage of a longer planar
+    // chain, and the split/merge cost on its own.
+    static bench::PlanarImage planes;
+    list.push_back({"planar", "pixelate", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        bench::deinterleave(src, planes, bench::SampleDepth::U8, p.threads);
+                        bench::pixelatePlanar(planes, p);
+                        bench::interleave(planes, dst, p.threads);
+                    },
+                    nullptr, true});
+    list.push_back({"planar-stage", "pixelate", true,
+                    [](const i2p::ConstImageView &, const i2p::ImageView &, const i2p::PixelateParams &p) {
+                        bench::pixelatePlanar(planes, p);
+                    },
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &, const i2p::PixelateParams &p) {
+                        bench::deinterleave(src, planes, bench::SampleDepth::U8, p.threads);
+                    }});
+    list.push_back({"planar-split", "", true,
+                    [](const i2p::ConstImageView &src, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        bench::deinterleave(src, planes, bench::SampleDepth::U8, p.threads);
+                        bench::interleave(planes, dst, p.threads);
+                    },
+                    nullptr});
+    // Encoding the pixelated image with and without the grid: the difference
+    // is the DCT work saved on flat 8x8 units.
+    list.push_back({"jpeg", "", false,
+                    [](const i2p::ConstImageView &, const i2p::ImageView &dst, const i2p::PixelateParams &) {
+                        encodeDestination(dst, i2p::GridGeometry());
+                    },
+                    pixelateInto});
+    list.push_back({"jpeg-mcu", "jpeg", false,
+                    [](const i2p::ConstImageView &, const i2p::ImageView &dst, const i2p::PixelateParams &p) {
+                        encodeDestination(dst, p.grid);
+                    },
+                    pixelateInto});
+    return list;
+}
+
+// The fast Oklab conversions against double-precision math, on a lattice
+// of sRGB colours: the largest L, a or b error, and how many colours fail
+// to come back exactly through the fast round trip.
+constexpr double kOklabErrorBound = 1e-4;
+
+bool checkOklab() {
+    double worst = 0;
+    int samples = 0, roundTripMisses = 0;
+    for (int r = 0; r < 256; r += 3) {
+        for (int g = 0; g < 256; g += 3) {
+            for (int b = 0; b < 256; b += 3) {
+                const i2p::Color color{static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b)};
+                const i2p::Oklab fast = i2p::toOklab(color);
+                const i2p::Oklab exact = i2p::toOklabExact(color);
+                worst = std::max(worst, static_cast<double>(std::fabs(fast.L - exact.L)));
+                worst = std::max(worst, static_cast<double>(std::fabs(fast.a - exact.a)));
+                worst = std::max(worst, static_cast<double>(std::fabs(fast.b - exact.b)));
+                if (!(i2p::fromOklab(fast) == color)) ++roundTripMisses;
+                ++samples;
+            }
+        }
+    }
+    const bool ok = worst <= kOklabErrorBound && roundTripMisses == 0;
+    std::printf("oklab: max error %.2e (bound %.0e), %d of %d colours off after a round trip%s\n\n", worst,
+                kOklabErrorBound, roundTripMisses, samples, ok ? "" : "  FAILED");
+    return ok;
+}
+
+double percentile(std::vector<double> sorted, double fraction) {
+    // Nearest-rank percentile on an ascending list.
+    size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Times `reps` runs after `warmup` untimed ones and counts the large
+// allocations they make. When `perf` is open, the counter deltas over the
+// timed runs are averaged into `counters`.
+std::vector<double> timeRuns(const Config &config, const std::function<void()> &body,
+                             const bench::PerfCounters *perf, bench::CounterValues &counters, double &allocations) {
+    for (int i = 0; i < config.warmup; ++i) body();
+    std::vector<double> times;
+    times.reserve(config.reps);
+    const uint64_t allocationsBefore = largeAllocations.load();
+    const bench::CounterValues before = perf ? perf->read() : bench::CounterValues();
+    for (int i = 0; i < config.reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    allocations = static_cast<double>(largeAllocations.load() - allocationsBefore) / config.reps;
+    if (perf) {
+        counters = perf->read() - before;
+        for (double &value : counters.values) {
+            if (value >= 0) value /= config.reps;
+        }
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+Result makeResult(const std::string &kernel, double megapixels, const i2p::ConstImageView &src, int blockSize,
+                  int threads, const std::vector<double> &times) {
+    Result r;
+    r.kernel = kernel;
+    r.megapixels = megapixels;
+    r.width = src.width;
+    r.height = src.height;
+    r.blockSize = blockSize;
+    r.format = src.format;
+    r.threads = threads;
+    r.medianMs = percentile(times, 0.5);
+    r.p95Ms = percentile(times, 0.95);
+    r.minMs = times.front();
+    const double pixels = static_cast<double>(src.width) * src.height;
+    r.nsPerPixel = r.medianMs * 1e6 / pixels;
+    // One read of the source plus one write of the destination.
+    const double bytes = 2.0 * pixels * i2p::bytesPerPixel(src.format);
+    r.gbPerSecond = bytes / (r.medianMs * 1e6);
+    r.speedup = 0;
+    return r;
+}
+
+void printCounterTable(const std::vector<Result> &results) {
+    using bench::Counter;
+    auto perPixel = [](const Result &r, Counter counter, char *text, size_t size) {
+        if (!r.counters.has(counter)) {
+            std::snprintf(text, size, "-");
+            return;
+        }
+        std::snprintf(text, size, "%.4f", r.counters[counter] / (static_cast<double>(r.width) * r.height));
+    };
+
+    std::printf("\n%-16s %8s %6s %-8s %7s %6s %10s %10s %10s %10s\n",
+                "kernel", "MP", "block", "format", "threads", "IPC", "cyc/px", "L1d/px", "LLC/px", "br-miss/px");
+    for (const Result &r : results) {
+        char ipc[32] = "-";
+        if (r.counters.has(Counter::Cycles) && r.counters.has(Counter::Instructions) && r.counters[Counter::Cycles] > 0)
+            std::snprintf(ipc, sizeof(ipc), "%.2f", r.counters[Counter::Instructions] / r.counters[Counter::Cycles]);
+        char cycles[32], l1d[32], llc[32], branches[32];
+        perPixel(r, Counter::Cycles, cycles, sizeof(cycles));
+        perPixel(r, Counter::L1dMisses, l1d, sizeof(l1d));
+        perPixel(r, Counter::LlcMisses, llc, sizeof(llc));
+        perPixel(r, Counter::BranchMisses, branches, sizeof(branches));
+        std::printf("%-16s %8.1f %6d %-8s %7d %6s %10s %10s %10s %10s\n",
+                    r.kernel.c_str(), r.megapixels, r.blockSize, i2p::pixelFormatName(r.format), r.threads,
+                    ipc, cycles, l1d, llc, branches);
+    }
+}
+
+void printTable(const std::vector<Result> &results) {
+    std::printf("%-16s %8s %6s %-8s %7s %10s %10s %8s %8s %8s %7s\n",
+                "kernel", "MP", "block", "format", "threads", "median ms", "p95 ms", "ns/px", "GB/s", "speedup",
+                "allocs");
+    for (const Result &r : results) {
+        char speedup[32] = "-";
+        if (r.speedup > 0) std::snprintf(speedup, sizeof(speedup), "%.2fx", r.speedup);
+        std::printf("%-16s %8.1f %6d %-8s %7d %10.3f %10.3f %8.3f %8.2f %8s %7.2f\n",
+                    r.kernel.c_str(), r.megapixels, r.blockSize, i2p::pixelFormatName(r.format), r.threads,
+                    r.medianMs, r.p95Ms, r.nsPerPixel, r.gbPerSecond, speedup, r.allocations);
+    }
+}
+
+bool writeJson(const std::string &path, const Config &config, const std::vector<Result> &results) {
+    FILE *file = path == "-" ? stdout : std::fopen(path.c_str(), "w");
+    if (!file) return false;
+
+    std::fprintf(file, "{\n  \"version\": \"%s\",\n  \"hardware_threads\": %d,\n"
+                       "  \"pattern\": \"%s\",\n  \"seed\": %llu,\n"
+                       "  \"warmup\": %d,\n  \"reps\": %d,\n  \"results\": [\n",
+                 IMAGE2PIXEL_VERSION, i2p::hardwareThreads(), i2p::synthPatternName(config.pattern),
+                 static_cast<unsigned long long>(config.seed), config.warmup, config.reps);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        std::fprintf(file,
+                     "    {\"kernel\": \"%s\", \"megapixels\": %.3f, \"width\": %d, \"height\": %d, "
+                     "\"block_size\": %d, \"format\": \"%s\", \"threads\": %d, \"median_ms\": %.4f, "
+                     "\"p95_ms\": %.4f, \"min_ms\": %.4f, \"ns_per_pixel\": %.4f, \"gb_per_s\": %.4f, "
+                     "\"speedup\": %.4f, \"large_allocations_per_run\": %.4f",
+                     r.kernel.c_str(), r.megapixels, r.width, r.height, r.blockSize, i2p::pixelFormatName(r.format),
+                     r.threads, r.medianMs, r.p95Ms, r.minMs, r.nsPerPixel, r.gbPerSecond, r.speedup, r.allocations);
+        if (config.counters) {
+            // Raw counts per timed run; null when the counter is unavailable.
+            std::fprintf(file, ", \"counters\": {");
+            for (int c = 0; c < static_cast<int>(bench::Counter::Count); ++c) {
+                const bench::Counter counter = static_cast<bench::Counter>(c);
+                std::fprintf(file, c ? ", \"%s\": " : "\"%s\": ", bench::counterName(counter));
+                if (r.counters.has(counter)) std::fprintf(file, "%.0f", r.counters[counter]);
+                else std::fprintf(file, "null");
+            }
+            std::fprintf(file, "}");
+        }
+        std::fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    return path == "-" || std::fclose(file) == 0;
+}
+
+void usage(const char *program) {
+    std::printf("Usage: %s [options]\n"
+                "  --sizes <list>     image sizes in megapixels (default 1,16)\n"
+                "  --blocks <list>    block sizes, 1-100 (default 2,4,8,16,32,100)\n"
+                "  --formats <list>   argb32, rgba8888, rgb888, gray8 (default argb32)\n"
+                "  --threads <list>   thread counts, 0 = all (default 1,0)\n"
+                "  --warmup <n>       untimed iterations per case (default 2)\n"
+                "  --reps <n>         timed iterations per case (default 7)\n"
+                "  --pattern <name>   generated input: noise, gradient, flat, alpha, texture (default noise)\n"
+                "  --seed <n>         generator seed (default 1)\n"
+                "  --full             1,16,64,200 MP, blocks 1-100, every format\n"
+                "  --no-baseline      skip the baseline kernel\n"
+                "  --counters         read hardware counters (Linux perf_event_open)\n"
+                "  --json <file>      also write results as JSON ('-' for stdout)\n",
+                program);
+}
+
+bool parseArgs(int argc, char **argv, Config &config) {
+    auto toInt = [](const std::string &s) { return std::atoi(s.c_str()); };
+    auto toDouble = [](const std::string &s) { return std::atof(s.c_str()); };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            config.megapixels = parseList<double>(argv[++i], toDouble);
+        } else if (arg == "--blocks" && hasValue) {
+            config.blockSizes = parseList<int>(argv[++i], toInt);
+        } else if (arg == "--formats" && hasValue) {
+            config.formats.clear();
+            for (const std::string &name : parseList<std::string>(argv[++i], [](const std::string &s) { return s; })) {
+                i2p::PixelFormat format;
+                if (!i2p::parsePixelFormat(name.c_str(), format)) {
+                    std::fprintf(stderr, "unknown format: %s\n", name.c_str());
+                    return false;
+                }
+                config.formats.push_back(format);
+            }
+        } else if (arg == "--threads" && hasValue) {
+            config.threads = parseList<int>(argv[++i], toInt);
+        } else if (arg == "--warmup" && hasValue) {
+            config.warmup = std::max(0, toInt(argv[++i]));
+        } else if (arg == "--reps" && hasValue) {
+            config.reps = std::max(1, toInt(argv[++i]));
+        } else if (arg == "--pattern" && hasValue) {
+            if (!i2p::parseSynthPattern(argv[++i], config.pattern)) {
+                std::fprintf(stderr, "unknown pattern: %s\n", argv[i]);
+                return false;
+            }
+        } else if (arg == "--seed" && hasValue) {
+            config.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--full") {
+            config.megapixels = {1, 16, 64, 200};
+            config.blockSizes = {1, 2, 3, 4, 8, 10, 16, 32, 64, 100};
+            config.formats = {i2p::PixelFormat::Argb32, i2p::PixelFormat::Rgba8888,
+                              i2p::PixelFormat::Rgb888, i2p::PixelFormat::Gray8};
+        } else if (arg == "--no-baseline") {
+            config.baseline = false;
+        } else if (arg == "--counters") {
+            config.counters = true;
+        } else if (arg == "--json" && hasValue) {
+            config.jsonPath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+    }
+    for (int blockSize : config.blockSizes) {
+        if (blockSize < 1 || blockSize > 100) {
+            std::fprintf(stderr, "block sizes must be between 1 and 100\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Config config;
+    if (!parseArgs(argc, argv, config)) return 2;
+
+    // Opened before anything starts the thread pool so the workers inherit
+    // the counters.
+    bench::PerfCounters perf;
+    if (config.counters) {
+        std::string error;
+        if (!perf.open(error)) {
+            std::fprintf(stderr, "hardware counters unavailable: %s; reporting timings only\n", error.c_str());
+        }
+    }
+    const bench::PerfCounters *counters = perf.isOpen() ? &perf : nullptr;
+
+    const std::vector<Kernel> kernelList = kernels();
+    std::vector<Result> results;
+    int mismatches = checkOklab() ? 0 : 1;
+
+    for (double megapixels : config.megapixels) {
+        const double pixels = megapixels * 1e6;
+        const int width = std::max(1, static_cast<int>(std::sqrt(pixels * 4.0 / 3.0)));
+        const int height = std::max(1, static_cast<int>(pixels / width));
+
+        for (i2p::PixelFormat format : config.formats) {
+            const ptrdiff_t stride = static_cast<ptrdiff_t>(width) * i2p::bytesPerPixel(format);
+            std::vector<uint8_t> source(static_cast<size_t>(stride) * height);
+            std::vector<uint8_t> target(source.size());
+            std::vector<uint8_t> expected(source.size());
+
+            i2p::SynthParams synth;
+            synth.pattern = config.pattern;
+            synth.seed = config.seed;
+            synth.width = width;
+            synth.height = height;
+            synth.format = format;
+            i2p::ImageView input;
+            input.data = source.data();
+            input.width = width;
+            input.height = height;
+            input.stride = stride;
+            input.format = format;
+            i2p::parallelFor(0, height, 0, [&](int lo, int hi) {
+                i2p::ImageView rows = input;
+                rows.data = input.row(lo);
+                rows.height = hi - lo;
+                i2p::synthesizeRows(synth, lo, rows);
+            });
+
+            const i2p::ConstImageView src(input);
+            i2p::ImageView dst;
+            dst.data = target.data();
+            dst.width = width;
+            dst.height = height;
+            dst.stride = stride;
+            dst.format = format;
+
+            for (int blockSize : config.blockSizes) {
+                i2p::PixelateParams params;
+                params.grid.blockSize = blockSize;
+                std::map<std::string, double> medians;
+
+                i2p::ImageView reference = dst;
+                reference.data = expected.data();
+                baselinePixelate(src, reference, params);
+
+                for (const Kernel &kernel : kernelList) {
+                    if (kernel.name == "baseline" && !config.baseline) continue;
+
+                    std::vector<int> threadCounts = {1};
+                    if (kernel.threaded) {
+                        threadCounts.clear();
+                        for (int threads : config.threads) threadCounts.push_back(i2p::resolveThreadCount(threads));
+                        std::sort(threadCounts.begin(), threadCounts.end());
+                        threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+                    }
+
+                    for (int threads : threadCounts) {
+                        params.threads = threads;
+                        if (kernel.setup) kernel.setup(src, dst, params);
+                        bench::CounterValues values;
+                        double allocations = 0;
+                        std::vector<double> times =
+                            timeRuns(config, [&] { kernel.run(src, dst, params); }, counters, values, allocations);
+                        Result r = makeResult(kernel.name, megapixels, src, blockSize, threads, times);
+                        r.counters = values;
+                        r.allocations = allocations;
+
+                        // Compare against the baseline kernel at the same
+                        // thread count, or its single-threaded run.
+                        medians[kernel.name + "/" + std::to_string(threads)] = r.medianMs;
+                        const std::string sameThreads = kernel.baseline + "/" + std::to_string(threads);
+                        const std::string singleThread = kernel.baseline + "/1";
+                        if (kernel.baseline.empty()) {
+                            r.speedup = 1.0;
+                        } else if (medians.count(sameThreads)) {
+                            r.speedup = medians[sameThreads] / r.medianMs;
+                        } else if (medians.count(singleThread)) {
+                            r.speedup = medians[singleThread] / r.medianMs;
+                        }
+                        results.push_back(r);
+
+                        if (kernel.checked && !sameImage(dst, reference)) {
+                            std::fprintf(stderr, "MISMATCH: %s differs from baseline (%.1f MP, block %d, %s, %d threads)\n",
+                                         kernel.name.c_str(), megapixels, blockSize, i2p::pixelFormatName(format),
+                                         threads);
+                            ++mismatches;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printTable(results);
+    if (counters) printCounterTable(results);
+    if (!config.jsonPath.empty() && !writeJson(config.jsonPath, config, results)) {
+        std::fprintf(stderr, "cannot write %s\n", config.jsonPath.c_str());
+        return 1;
+    }
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bench {
+
+const char *counterName(Counter counter) {
+    switch (counter) {
+        case Counter::Cycles: return "cycles";
+        case Counter::Instructions: return "instructions";
+        case Counter::L1dMisses: return "l1d_misses";
+        case Counter::LlcMisses: return "llc_misses";
+        case Counter::BranchMisses: return "branch_misses";
+        default: return "?";
+    }
+}
+
+CounterValues::CounterValues() {
+    for (double &value : values) value = -1;
+}
+
+CounterValues CounterValues::operator-(const CounterValues &other) const {
+    CounterValues delta;
+    for (int i = 0; i < static_cast<int>(Counter::Count); ++i) {
+        if (values[i] >= 0 && other.values[i] >= 0) delta.values[i] = values[i] - other.values[i];
+    }
+    return delta;
+}
+
+PerfCounters::PerfCounters() {
+    for (int &fd : fds) fd = -1;
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+#endif
+}
+
+bool PerfCounters::isOpen() const {
+    for (int fd : fds) {
+        if (fd >= 0) return true;
+    }
+    return false;
+}
+
+#if defined(__linux__)
+
+namespace {
+
+void describe(Counter counter, perf_event_attr &attr) {
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    switch (counter) {
+        case Counter::Cycles:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case Counter::Instructions:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case Counter::L1dMisses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case Counter::LlcMisses:
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case Counter::BranchMisses:
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        default:
+            break;
+    }
+    // Counters are read individually rather than as a group: inherited
+    // counters only sum the child threads on a plain read.
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+}
+
+} // namespace
+
+bool PerfCounters::open(std::string &error) {
+    int firstErrno = 0;
+    for (int i = 0; i < static_cast<int>(Counter::Count); ++i) {
+        perf_event_attr attr;
+        describe(static_cast<Counter>(i), attr);
+        fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fds[i] < 0 && firstErrno == 0) firstErrno = errno;
+    }
+    if (isOpen()) return true;
+
+    error = std::string("perf_event_open: ") + std::strerror(firstErrno);
+    if (firstErrno == EACCES || firstErrno == EPERM)
+        error += " (see /proc/sys/kernel/perf_event_paranoid)";
+    return false;
+}
+
+CounterValues PerfCounters::read() const {
+    CounterValues result;
+    for (int i = 0; i < static_cast<int>(Counter::Count); ++i) {
+        if (fds[i] < 0) continue;
+        uint64_t data[3];  // value, time enabled, time running
+        if (::read(fds[i], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) continue;
+        if (data[2] == 0) continue;  // never scheduled onto the PMU
+        // Scale up when the counter was multiplexed with others.
+        result.values[i] = static_cast<double>(data[0]) * static_cast<double>(data[1]) / static_cast<double>(data[2]);
+    }
+    return result;
+}
+
+#else
+
+bool PerfCounters::open(std::string &error) {
+    error = "hardware counters are only supported on Linux";
+    return false;
+}
+
+CounterValues PerfCounters::read() const {
+    return CounterValues();
+}
+
+#endif
+
+} // namespace bench
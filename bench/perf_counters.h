@@ -0,0 +1,60 @@
+// Hardware performance counters for the benchmark harness.
+//
+// On Linux the counters come from perf_event_open(2), opened once for the
+// whole process with `inherit` set so that threads started afterwards (the
+// parallelFor pool) are counted as well. Elsewhere, or when the kernel
+// refuses access (perf_event_paranoid, containers, missing PMU), every
+// counter reports as unavailable and the benchmark prints timings only.
+
+#ifndef IMAGE2PIXEL_BENCH_PERF_COUNTERS_H
+#define IMAGE2PIXEL_BENCH_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+namespace bench {
+
+enum class Counter {
+    Cycles,
+    Instructions,
+    L1dMisses,
+    LlcMisses,
+    BranchMisses,
+    Count
+};
+
+const char *counterName(Counter counter);
+
+struct CounterValues {
+    // Per counter: scaled event count, or a negative value when unavailable.
+    double values[static_cast<int>(Counter::Count)];
+
+    CounterValues();
+    double operator[](Counter counter) const { return values[static_cast<int>(counter)]; }
+    bool has(Counter counter) const { return (*this)[counter] >= 0; }
+    CounterValues operator-(const CounterValues &other) const;
+};
+
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // Opens the counters. Must run before the thread pool starts so the
+    // workers inherit them. Returns false, with a reason, when none of the
+    // counters could be opened.
+    bool open(std::string &error);
+    bool isOpen() const;
+
+    // Current totals; subtract two reads to measure a region.
+    CounterValues read() const;
+
+private:
+    int fds[static_cast<int>(Counter::Count)];
+};
+
+} // namespace bench
+
+#endif // IMAGE2PIXEL_BENCH_PERF_COUNTERS_H
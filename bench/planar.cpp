@@ -0,0 +1,316 @@
+#include "planar.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define I2P_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace bench {
+
+using i2p::ConstImageView;
+using i2p::GridGeometry;
+using i2p::ImageView;
+using i2p::PixelFormat;
+using i2p::PixelateParams;
+
+namespace {
+
+const size_t kRowAlignment = 16;
+
+// Nearest 8-bit value of a U16 sample: round(v / 257).
+inline uint8_t narrow16(uint16_t v) {
+    const uint32_t t = v + 128u;
+    return static_cast<uint8_t>((t - (t >> 8)) >> 8);
+}
+
+#if I2P_HAVE_SSE2
+
+// 16 four-channel pixels (64 bytes) into four 16-byte planes, by three
+// rounds of byte unpacking and a final 64-bit unpack.
+inline void deinterleave4x16(const uint8_t *in, __m128i &p0, __m128i &p1, __m128i &p2, __m128i &p3) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16));
+    const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 32));
+    const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 48));
+
+    const __m128i t0 = _mm_unpacklo_epi8(a, b);
+    const __m128i t1 = _mm_unpackhi_epi8(a, b);
+    const __m128i t2 = _mm_unpacklo_epi8(c, d);
+    const __m128i t3 = _mm_unpackhi_epi8(c, d);
+    const __m128i u0 = _mm_unpacklo_epi8(t0, t1);
+    const __m128i u1 = _mm_unpackhi_epi8(t0, t1);
+    const __m128i u2 = _mm_unpacklo_epi8(t2, t3);
+    const __m128i u3 = _mm_unpackhi_epi8(t2, t3);
+    const __m128i v0 = _mm_unpacklo_epi8(u0, u1);   // channel 0 and 1 of pixels 0-7
+    const __m128i v1 = _mm_unpackhi_epi8(u0, u1);   // channel 2 and 3 of pixels 0-7
+    const __m128i v2 = _mm_unpacklo_epi8(u2, u3);   // channel 0 and 1 of pixels 8-15
+    const __m128i v3 = _mm_unpackhi_epi8(u2, u3);   // channel 2 and 3 of pixels 8-15
+
+    p0 = _mm_unpacklo_epi64(v0, v2);
+    p1 = _mm_unpackhi_epi64(v0, v2);
+    p2 = _mm_unpacklo_epi64(v1, v3);
+    p3 = _mm_unpackhi_epi64(v1, v3);
+}
+
+// Inverse of deinterleave4x16.
+inline void interleave4x16(__m128i p0, __m128i p1, __m128i p2, __m128i p3, uint8_t *out) {
+    const __m128i lo01 = _mm_unpacklo_epi8(p0, p1);
+    const __m128i hi01 = _mm_unpackhi_epi8(p0, p1);
+    const __m128i lo23 = _mm_unpacklo_epi8(p2, p3);
+    const __m128i hi23 = _mm_unpackhi_epi8(p2, p3);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi16(lo01, lo23));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi16(lo01, lo23));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 32), _mm_unpacklo_epi16(hi01, hi23));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 48), _mm_unpackhi_epi16(hi01, hi23));
+}
+
+// v * 257 for the low and high eight bytes of a plane vector.
+inline void widen16(__m128i p, uint16_t *out) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(p, p));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 8), _mm_unpackhi_epi8(p, p));
+}
+
+// narrow16 on sixteen samples. The saturating add only clips values whose
+// result is 255 either way.
+inline __m128i narrow16x16(const uint16_t *in) {
+    const __m128i bias = _mm_set1_epi16(128);
+    __m128i lo = _mm_adds_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), bias);
+    __m128i hi = _mm_adds_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 8)), bias);
+    lo = _mm_srli_epi16(_mm_sub_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_sub_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    return _mm_packus_epi16(lo, hi);
+}
+
+#endif
+
+void deinterleaveRow(const uint8_t *in, int width, int channels, PlanarImage &dst, int y) {
+    const ptrdiff_t offset = y * dst.stride();
+    int x = 0;
+    if (dst.depth() == SampleDepth::U8) {
+        uint8_t *planes[4] = {};
+        for (int c = 0; c < channels; ++c) planes[c] = dst.plane8(c) + offset;
+#if I2P_HAVE_SSE2
+        if (channels == 4) {
+            for (; x + 16 <= width; x += 16) {
+                __m128i p0, p1, p2, p3;
+                deinterleave4x16(in + x * 4, p0, p1, p2, p3);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[0] + x), p0);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[1] + x), p1);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[2] + x), p2);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(planes[3] + x), p3);
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) planes[c][x] = in[x * channels + c];
+        }
+    } else {
+        uint16_t *planes[4] = {};
+        for (int c = 0; c < channels; ++c) planes[c] = dst.plane16(c) + offset;
+#if I2P_HAVE_SSE2
+        if (channels == 4) {
+            for (; x + 16 <= width; x += 16) {
+                __m128i p0, p1, p2, p3;
+                deinterleave4x16(in + x * 4, p0, p1, p2, p3);
+                widen16(p0, planes[0] + x);
+                widen16(p1, planes[1] + x);
+                widen16(p2, planes[2] + x);
+                widen16(p3, planes[3] + x);
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) planes[c][x] = static_cast<uint16_t>(in[x * channels + c] * 257);
+        }
+    }
+}
+
+void interleaveRow(const PlanarImage &src, int y, int channels, uint8_t *out) {
+    const ptrdiff_t offset = y * src.stride();
+    const int width = src.width();
+    int x = 0;
+    if (src.depth() == SampleDepth::U8) {
+        const uint8_t *planes[4] = {};
+        for (int c = 0; c < channels; ++c) planes[c] = src.plane8(c) + offset;
+#if I2P_HAVE_SSE2
+        if (channels == 4) {
+            for (; x + 16 <= width; x += 16) {
+                interleave4x16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(planes[0] + x)),
+                               _mm_loadu_si128(reinterpret_cast<const __m128i *>(planes[1] + x)),
+                               _mm_loadu_si128(reinterpret_cast<const __m128i *>(planes[2] + x)),
+                               _mm_loadu_si128(reinterpret_cast<const __m128i *>(planes[3] + x)), out + x * 4);
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) out[x * channels + c] = planes[c][x];
+        }
+    } else {
+        const uint16_t *planes[4] = {};
+        for (int c = 0; c < channels; ++c) planes[c] = src.plane16(c) + offset;
+#if I2P_HAVE_SSE2
+        if (channels == 4) {
+            for (; x + 16 <= width; x += 16) {
+                interleave4x16(narrow16x16(planes[0] + x), narrow16x16(planes[1] + x), narrow16x16(planes[2] + x),
+                               narrow16x16(planes[3] + x), out + x * 4);
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            for (int c = 0; c < channels; ++c) out[x * channels + c] = narrow16(planes[c][x]);
+        }
+    }
+}
+
+// Same grid convention as pixelate(): the first line at or before 0.
+inline int gridStart(int phase, int blockSize) {
+    int offset = phase % blockSize;
+    return offset ? offset - blockSize : 0;
+}
+
+// Block averaging for one U16 plane, separable like the 8-bit kernel, with
+// truncating division.
+void pixelatePlane16(uint16_t *plane, ptrdiff_t stride, int width, int height, const GridGeometry &grid,
+                     int firstBlockRow, int lastBlockRow) {
+    const int blockSize = grid.blockSize;
+    const int startX = gridStart(grid.phaseX, blockSize);
+    const int startY = gridStart(grid.phaseY, blockSize);
+    const int blockColumns = (width - startX + blockSize - 1) / blockSize;
+    thread_local std::vector<uint64_t> sums;
+    thread_local std::vector<uint16_t> means;
+
+    for (int blockRow = firstBlockRow; blockRow < lastBlockRow; ++blockRow) {
+        const int y0 = std::max(startY + blockRow * blockSize, 0);
+        const int y1 = std::min(startY + (blockRow + 1) * blockSize, height);
+        sums.assign(static_cast<size_t>(blockColumns), 0);
+        means.resize(static_cast<size_t>(blockColumns));
+
+        for (int y = y0; y < y1; ++y) {
+            const uint16_t *p = plane + y * stride;
+            uint64_t *sum = sums.data();
+            for (int x = startX; x < width; x += blockSize, ++sum) {
+                uint64_t rowSum = 0;
+                for (int bx = std::max(x, 0); bx < std::min(x + blockSize, width); ++bx) rowSum += p[bx];
+                *sum += rowSum;
+            }
+        }
+
+        for (int block = 0, x = startX; x < width; ++block, x += blockSize) {
+            const uint64_t count = static_cast<uint64_t>(std::min(x + blockSize, width) - std::max(x, 0)) * (y1 - y0);
+            means[block] = static_cast<uint16_t>(sums[block] / count);
+        }
+
+        uint16_t *first = plane + y0 * stride;
+        for (int block = 0, x = startX; x < width; ++block, x += blockSize) {
+            std::fill(first + std::max(x, 0), first + std::min(x + blockSize, width), means[block]);
+        }
+        for (int y = y0 + 1; y < y1; ++y) std::memcpy(plane + y * stride, first, width * sizeof(uint16_t));
+    }
+}
+
+} // namespace
+
+bool PlanarImage::reset(int width, int height, int planes, SampleDepth depth) {
+    if (width <= 0 || height <= 0 || planes <= 0 || planes > 4) return false;
+    const size_t sampleBytes = depth == SampleDepth::U16 ? 2 : 1;
+    const size_t rowBytes = (width * sampleBytes + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+    const size_t bytes = rowBytes * height;
+    const size_t needed = bytes * planes + kRowAlignment;
+    if (storage.size() < needed) storage.resize(needed);
+
+    imageWidth = width;
+    imageHeight = height;
+    planeCount = planes;
+    sampleDepth = depth;
+    rowStride = static_cast<ptrdiff_t>(rowBytes / sampleBytes);
+    planeBytes = bytes;
+    const uintptr_t base = reinterpret_cast<uintptr_t>(storage.data());
+    alignOffset = (kRowAlignment - base % kRowAlignment) % kRowAlignment;
+    return true;
+}
+
+uint8_t *PlanarImage::plane8(int plane) {
+    return storage.data() + alignOffset + plane * planeBytes;
+}
+
+const uint8_t *PlanarImage::plane8(int plane) const {
+    return storage.data() + alignOffset + plane * planeBytes;
+}
+
+uint16_t *PlanarImage::plane16(int plane) {
+    return reinterpret_cast<uint16_t *>(plane8(plane));
+}
+
+const uint16_t *PlanarImage::plane16(int plane) const {
+    return reinterpret_cast<const uint16_t *>(plane8(plane));
+}
+
+ImageView PlanarImage::planeView(int plane) {
+    ImageView view;
+    view.data = plane8(plane);
+    view.width = imageWidth;
+    view.height = imageHeight;
+    view.stride = rowStride;
+    view.format = PixelFormat::Gray8;
+    return view;
+}
+
+bool deinterleave(const ConstImageView &src, PlanarImage &dst, SampleDepth depth, int threads) {
+    if (!isValid(src)) return false;
+    const int channels = i2p::bytesPerPixel(src.format);
+    if (!dst.reset(src.width, src.height, channels, depth)) return false;
+
+    I2P_TRACE_SPAN("planar.deinterleave");
+    i2p::parallelFor(0, src.height, threads, [&](int first, int last) {
+        for (int y = first; y < last; ++y) deinterleaveRow(src.row(y), src.width, channels, dst, y);
+    });
+    return true;
+}
+
+bool interleave(const PlanarImage &src, const ImageView &dst, int threads) {
+    if (!isValid(dst) || src.width() != dst.width || src.height() != dst.height ||
+        src.planes() != i2p::bytesPerPixel(dst.format)) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("planar.interleave");
+    i2p::parallelFor(0, dst.height, threads, [&](int first, int last) {
+        for (int y = first; y < last; ++y) interleaveRow(src, y, src.planes(), dst.row(y));
+    });
+    return true;
+}
+
+bool pixelatePlanar(PlanarImage &image, const PixelateParams &params) {
+    if (image.planes() == 0) return false;
+
+    I2P_TRACE_SPAN("planar.pixelate");
+    if (image.depth() == SampleDepth::U8) {
+        for (int plane = 0; plane < image.planes(); ++plane) {
+            const ImageView view = image.planeView(plane);
+            if (!i2p::pixelate(view, view, params)) return false;
+        }
+        return true;
+    }
+
+    GridGeometry grid = params.grid;
+    if (grid.blockSize <= 1) return true;
+    grid.phaseX = std::max(grid.phaseX, 0);
+    grid.phaseY = std::max(grid.phaseY, 0);
+    const int startY = gridStart(grid.phaseY, grid.blockSize);
+    const int blockRows = (image.height() - startY + grid.blockSize - 1) / grid.blockSize;
+    for (int plane = 0; plane < image.planes(); ++plane) {
+        uint16_t *samples = image.plane16(plane);
+        i2p::parallelFor(0, blockRows, params.threads, [&](int first, int last) {
+            pixelatePlane16(samples, image.stride(), image.width(), image.height(), grid, first, last);
+        });
+    }
+    return true;
+}
+
+} // namespace bench
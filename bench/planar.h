@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+#include "pixelate.h"
+
+namespace bench {
+
+enum class SampleDepth {
+    U8,     // 0-255, as in the interleaved formats
+    U16     // 0-65535, an 8-bit value v is stored as v * 257
+};
+
+// Structure-of-arrays working image: one plane per channel, in the byte
+// order of the interleaved format (ARGB32 words are B, G, R, A in memory).
+// Vector code on planes needs no shuffles; the conversions below are the
+// only places that touch interleaved pixels. No effect in the library runs
+// on planes, so this lives in the bench to measure whether one would gain.
+class PlanarImage {
+public:
+    // Reallocates only when the new layout needs more storage.
+    bool reset(int width, int height, int planes, SampleDepth depth);
+
+    int width() const { return imageWidth; }
+    int height() const { return imageHeight; }
+    int planes() const { return planeCount; }
+    SampleDepth depth() const { return sampleDepth; }
+    // Distance between rows in samples (not bytes); rows are 16-byte aligned.
+    ptrdiff_t stride() const { return rowStride; }
+
+    uint8_t *plane8(int plane);
+    const uint8_t *plane8(int plane) const;
+    uint16_t *plane16(int plane);
+    const uint16_t *plane16(int plane) const;
+
+    // A U8 plane as a Gray8 image, so Gray8 kernels can run on it.
+    i2p::ImageView planeView(int plane);
+
+private:
+    std::vector<uint8_t> storage;
+    int imageWidth = 0;
+    int imageHeight = 0;
+    int planeCount = 0;
+    SampleDepth sampleDepth = SampleDepth::U8;
+    ptrdiff_t rowStride = 0;
+    size_t planeBytes = 0;
+    size_t alignOffset = 0;
+};
+
+// Splits `src` into planes of the given depth (SSE2 for 4-channel formats).
+bool deinterleave(const i2p::ConstImageView &src, PlanarImage &dst, SampleDepth depth, int threads = 0);
+
+// Writes the planes back into `dst`, which must match in size and channel
+// count. U16 samples are rounded to the nearest 8-bit value.
+bool interleave(const PlanarImage &src, const i2p::ImageView &dst, int threads = 0);
+
+// pixelate() applied to every plane in place.
+bool pixelatePlanar(PlanarImage &image, const i2p::PixelateParams &params);
+
+} // namespace bench
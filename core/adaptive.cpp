@@ -0,0 +1,184 @@
+#include "adaptive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+inline int gridStart(int phase, int blockSize) {
+    int offset = phase % blockSize;
+    return offset ? offset - blockSize : 0;
+}
+
+// Summed-area tables over one root tile: per-channel sums, and the squares
+// summed over all channels (the split test only needs their total). Any
+// sub-rectangle then takes four lookups. With tiles of at most 128x128 both
+// fit in 32 bits: 4 * 255^2 * 128^2 < 2^32.
+template <int Channels>
+class TileIntegrals {
+public:
+    void build(const ConstImageView &src, int x0, int y0, int w, int h) {
+        stride = w + 1;
+        sums.resize(static_cast<size_t>(stride) * (h + 1) * Channels);
+        squares.resize(static_cast<size_t>(stride) * (h + 1));
+        // Only the top row and left column need clearing; the rest is
+        // overwritten below.
+        std::fill_n(sums.begin(), stride * Channels, 0);
+        std::fill_n(squares.begin(), stride, 0);
+        for (int y = 1; y <= h; ++y) {
+            std::fill_n(&sums[static_cast<size_t>(y) * stride * Channels], Channels, 0);
+            squares[static_cast<size_t>(y) * stride] = 0;
+        }
+
+        for (int y = 0; y < h; ++y) {
+            const uint8_t *p = src.row(y0 + y) + x0 * Channels;
+            const uint32_t *sumAbove = &sums[(static_cast<size_t>(y) * stride + 1) * Channels];
+            const uint32_t *squaresAbove = &squares[static_cast<size_t>(y) * stride + 1];
+            uint32_t *sum = &sums[(static_cast<size_t>(y + 1) * stride + 1) * Channels];
+            uint32_t *square = &squares[static_cast<size_t>(y + 1) * stride + 1];
+            uint32_t rowSum[Channels] = {};
+            uint32_t rowSquares = 0;
+            for (int x = 0; x < w; ++x, p += Channels) {
+                for (int c = 0; c < Channels; ++c) {
+                    const uint32_t v = p[c];
+                    rowSum[c] += v;
+                    rowSquares += v * v;
+                }
+                for (int c = 0; c < Channels; ++c) sum[x * Channels + c] = sumAbove[x * Channels + c] + rowSum[c];
+                square[x] = squaresAbove[x] + rowSquares;
+            }
+        }
+    }
+
+    // Totals over the tile-local rectangle [x0, x1) x [y0, y1).
+    uint32_t query(int x0, int y0, int x1, int y1, uint32_t *sum) const {
+        const size_t a = static_cast<size_t>(y0) * stride + x0;
+        const size_t b = static_cast<size_t>(y0) * stride + x1;
+        const size_t c = static_cast<size_t>(y1) * stride + x0;
+        const size_t d = static_cast<size_t>(y1) * stride + x1;
+        for (int ch = 0; ch < Channels; ++ch) {
+            sum[ch] = sums[d * Channels + ch] - sums[b * Channels + ch] - sums[c * Channels + ch] +
+                      sums[a * Channels + ch];
+        }
+        return squares[d] - squares[b] - squares[c] + squares[a];
+    }
+
+private:
+    std::vector<uint32_t> sums;
+    std::vector<uint32_t> squares;
+    int stride = 0;
+};
+
+template <int Channels>
+struct QuadtreeTile {
+    const TileIntegrals<Channels> &integrals;
+    const ImageView &dst;
+    int originX;
+    int originY;
+    int minBlockSize;
+    double limit;       // maxDeviation^2 * Channels
+    long long leaves = 0;
+
+    void split(int x0, int y0, int x1, int y1) {
+        const int w = x1 - x0;
+        const int h = y1 - y0;
+        uint32_t sum[Channels];
+        const uint32_t squares = integrals.query(x0, y0, x1, y1, sum);
+
+        // An axis is halved only while both halves keep at least
+        // minBlockSize; only tiles clipped by the image edge go smaller.
+        const bool splitX = w >= 2 * minBlockSize;
+        const bool splitY = h >= 2 * minBlockSize;
+        if (splitX || splitY) {
+            // n^2 * variance summed over channels, compared without dividing.
+            const uint64_t n = static_cast<uint64_t>(w) * h;
+            uint64_t meanSquares = 0;
+            for (int c = 0; c < Channels; ++c) meanSquares += static_cast<uint64_t>(sum[c]) * sum[c];
+            const double spread = static_cast<double>(n * squares - meanSquares);
+            if (spread > limit * static_cast<double>(n) * static_cast<double>(n)) {
+                const int midX = splitX ? x0 + (w + 1) / 2 : x1;
+                const int midY = splitY ? y0 + (h + 1) / 2 : y1;
+                split(x0, y0, midX, midY);
+                if (midX < x1) split(midX, y0, x1, midY);
+                if (midY < y1) split(x0, midY, midX, y1);
+                if (midX < x1 && midY < y1) split(midX, midY, x1, y1);
+                return;
+            }
+        }
+
+        const uint32_t count = static_cast<uint32_t>(w * h);
+        uint8_t mean[Channels];
+        for (int c = 0; c < Channels; ++c) mean[c] = static_cast<uint8_t>(sum[c] / count);
+        uint8_t *first = dst.row(originY + y0) + (originX + x0) * Channels;
+        for (int x = 0; x < w; ++x) std::memcpy(first + x * Channels, mean, Channels);
+        for (int y = y0 + 1; y < y1; ++y)
+            std::memcpy(dst.row(originY + y) + (originX + x0) * Channels, first, static_cast<size_t>(w) * Channels);
+        ++leaves;
+    }
+};
+
+template <int Channels>
+long long pixelateTileRows(const ConstImageView &src, const ImageView &dst, const AdaptiveParams &params,
+                           int tileSize, int firstTileRow, int lastTileRow) {
+    const int startX = gridStart(std::max(params.phaseX, 0), tileSize);
+    const int startY = gridStart(std::max(params.phaseY, 0), tileSize);
+    const double limit = static_cast<double>(params.maxDeviation) * params.maxDeviation * Channels;
+    thread_local TileIntegrals<Channels> integrals;
+    long long leaves = 0;
+
+    for (int tileRow = firstTileRow; tileRow < lastTileRow; ++tileRow) {
+        const int y0 = std::max(startY + tileRow * tileSize, 0);
+        const int y1 = std::min(startY + (tileRow + 1) * tileSize, src.height);
+        for (int x = startX; x < src.width; x += tileSize) {
+            const int x0 = std::max(x, 0);
+            const int x1 = std::min(x + tileSize, src.width);
+            // The whole tile is summed before any of it is written, so
+            // in-place calls stay correct.
+            integrals.build(src, x0, y0, x1 - x0, y1 - y0);
+            QuadtreeTile<Channels> tile{integrals, dst, x0, y0, std::max(params.minBlockSize, 1), limit};
+            tile.split(0, 0, x1 - x0, y1 - y0);
+            leaves += tile.leaves;
+        }
+    }
+    return leaves;
+}
+
+} // namespace
+
+bool pixelateAdaptive(const ConstImageView &src, const ImageView &dst, const AdaptiveParams &params,
+                      long long *blockCount) {
+    if (!isValid(src) || !isValid(dst) || src.width != dst.width || src.height != dst.height ||
+        src.format != dst.format) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("pixelate.adaptive");
+    // Tiles smaller than minBlockSize would cut leaves below it.
+    const int tileSize =
+        std::min(std::max({params.maxBlockSize, params.minBlockSize, 1}), kMaxAdaptiveBlockSize);
+    const int startY = gridStart(std::max(params.phaseY, 0), tileSize);
+    const int tileRows = (src.height - startY + tileSize - 1) / tileSize;
+    std::atomic<long long> leaves{0};
+
+    parallelFor(0, tileRows, params.threads, [&](int first, int last) {
+        long long count;
+        switch (bytesPerPixel(src.format)) {
+            case 1: count = pixelateTileRows<1>(src, dst, params, tileSize, first, last); break;
+            case 3: count = pixelateTileRows<3>(src, dst, params, tileSize, first, last); break;
+            default: count = pixelateTileRows<4>(src, dst, params, tileSize, first, last); break;
+        }
+        leaves += count;
+    });
+
+    if (blockCount) *blockCount = leaves;
+    return true;
+}
+
+} // namespace i2p
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+// Quadtree pixelation: the image is tiled with maxBlockSize squares (placed
+// by the grid phase), and each square is split into quarters until its
+// colour deviation is at most maxDeviation or halving it would leave blocks
+// smaller than minBlockSize (only tiles cut by the image edge go smaller).
+// Detailed areas keep small blocks while flat areas become large ones.
+struct AdaptiveParams {
+    int minBlockSize = 4;
+    int maxBlockSize = 64;      // raised to minBlockSize if smaller, at most kMaxAdaptiveBlockSize
+    int maxDeviation = 10;      // RMS deviation from the block mean, in 8-bit levels, averaged over channels
+    int phaseX = 0;
+    int phaseY = 0;
+    int threads = 0;
+};
+
+// Largest root block; keeps the per-tile integral images in 32 bits.
+constexpr int kMaxAdaptiveBlockSize = 128;
+
+// Replaces every quadtree leaf by its truncated per-channel mean. Same view
+// rules as pixelate(); `blockCount`, if given, receives the number of leaves.
+I2P_API bool pixelateAdaptive(const ConstImageView &src, const ImageView &dst, const AdaptiveParams &params,
+                              long long *blockCount = nullptr);
+
+} // namespace i2p
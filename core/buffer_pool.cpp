@@ -0,0 +1,112 @@
+#include "buffer_pool.h"
+
+#include <new>
+
+namespace i2p {
+
+namespace {
+
+const std::align_val_t kAlignment{64};
+
+size_t imageBytes(int width, int height, PixelFormat format) {
+    return static_cast<size_t>(width) * bytesPerPixel(format) * static_cast<size_t>(height);
+}
+
+} // namespace
+
+BufferPool::~BufferPool() {
+    // Buffers still in use leak rather than dangle; the process-wide pool is
+    // never destroyed before its users anyway.
+    for (const Entry &entry : entries) {
+        if (!entry.inUse) ::operator delete(entry.data, kAlignment);
+    }
+}
+
+BufferPool &BufferPool::instance() {
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+}
+
+ImageView BufferPool::acquire(int width, int height, PixelFormat format) {
+    ImageView view;
+    view.width = width;
+    view.height = height;
+    view.stride = static_cast<ptrdiff_t>(width) * bytesPerPixel(format);
+    view.format = format;
+    if (width <= 0 || height <= 0) return view;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ++clock;
+    for (Entry &entry : entries) {
+        if (!entry.inUse && entry.width == width && entry.height == height && entry.format == format) {
+            entry.inUse = true;
+            entry.lastUse = clock;
+            view.data = entry.data;
+            return view;
+        }
+    }
+
+    uint8_t *data = static_cast<uint8_t *>(::operator new(imageBytes(width, height, format), kAlignment, std::nothrow));
+    if (!data) return view;
+    ++allocationCount;
+    entries.push_back({data, width, height, format, true, clock});
+    view.data = data;
+    return view;
+}
+
+void BufferPool::release(void *data) {
+    if (!data) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t idle = 0;
+    for (Entry &entry : entries) {
+        if (entry.data == data) entry.inUse = false;
+        if (!entry.inUse) ++idle;
+    }
+
+    while (idle > maxIdle) {
+        size_t oldest = entries.size();
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!entries[i].inUse && (oldest == entries.size() || entries[i].lastUse < entries[oldest].lastUse))
+                oldest = i;
+        }
+        freeEntry(oldest);
+        --idle;
+    }
+}
+
+void BufferPool::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = entries.size(); i-- > 0;) {
+        if (!entries[i].inUse) freeEntry(i);
+    }
+}
+
+void BufferPool::freeEntry(size_t index) {
+    ::operator delete(entries[index].data, kAlignment);
+    entries.erase(entries.begin() + static_cast<ptrdiff_t>(index));
+}
+
+size_t BufferPool::idleBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const Entry &entry : entries) {
+        if (!entry.inUse) bytes += imageBytes(entry.width, entry.height, entry.format);
+    }
+    return bytes;
+}
+
+size_t BufferPool::inUseBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const Entry &entry : entries) {
+        if (entry.inUse) bytes += imageBytes(entry.width, entry.height, entry.format);
+    }
+    return bytes;
+}
+
+uint64_t BufferPool::allocations() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocationCount;
+}
+
+} // namespace i2p
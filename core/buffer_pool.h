@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "export.h"
+#include "image.h"
+
+namespace i2p {
+
+// Recycles whole-image buffers by size and format so that re-rendering the
+// same image with new parameters does not allocate. Buffers are 64-byte
+// aligned with tightly packed rows. Released buffers stay idle in the pool
+// until a matching acquire, or until more than maxIdle are idle, in which
+// case the oldest idle one is freed.
+class I2P_API BufferPool {
+public:
+    explicit BufferPool(size_t maxIdle = 4) : maxIdle(maxIdle) {}
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+    ~BufferPool();
+
+    // Process-wide pool used by the GUI for rendered images.
+    static BufferPool &instance();
+
+    // Returns an uninitialised image, or a view with data == nullptr if the
+    // allocation fails. Hand the data pointer back with release().
+    ImageView acquire(int width, int height, PixelFormat format);
+    void release(void *data);
+
+    // Frees every idle buffer.
+    void trim();
+
+    size_t idleBytes() const;
+    size_t inUseBytes() const;
+    // Number of buffers allocated (not recycled) since the pool was created.
+    uint64_t allocations() const;
+
+private:
+    struct Entry {
+        uint8_t *data;
+        int width;
+        int height;
+        PixelFormat format;
+        bool inUse;
+        uint64_t lastUse;
+    };
+
+    void freeEntry(size_t index);
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+    size_t maxIdle;
+    uint64_t allocationCount = 0;
+    uint64_t clock = 0;
+};
+
+} // namespace i2p
@@ -0,0 +1,191 @@
+#include "image2pixel.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "jpeg_writer.h"
+#include "palette.h"
+#include "pixelate.h"
+#include "render.h"
+
+#ifndef IMAGE2PIXEL_VERSION
+#define IMAGE2PIXEL_VERSION "unknown"
+#endif
+
+namespace {
+
+bool toView(const i2p_image *image, i2p::ImageView &view) {
+    if (!image || image->format < I2P_FORMAT_ARGB32 || image->format > I2P_FORMAT_GRAY8) return false;
+    view.data = static_cast<uint8_t *>(image->data);
+    view.width = image->width;
+    view.height = image->height;
+    view.stride = image->stride;
+    view.format = static_cast<i2p::PixelFormat>(image->format);
+    return i2p::isValid(view);
+}
+
+// Reads only the fields the caller's version of i2p_params actually has.
+i2p::PixelateParams toParams(const i2p_params *params) {
+    i2p_params defaults;
+    i2p_params_init(&defaults);
+    if (params) {
+        size_t size = params->struct_size < sizeof(i2p_params) ? params->struct_size : sizeof(i2p_params);
+        std::memcpy(&defaults, params, size);
+    }
+
+    i2p::PixelateParams result;
+    result.grid.blockSize = defaults.block_size;
+    result.grid.phaseX = defaults.phase_x;
+    result.grid.phaseY = defaults.phase_y;
+    result.threads = defaults.threads;
+    result.sampling = static_cast<i2p::BlockSampling>(defaults.sampling);
+    result.shape = static_cast<i2p::BlockShape>(defaults.shape);
+    result.angle = defaults.angle;
+    return result;
+}
+
+bool isValidParams(const i2p::PixelateParams &p) {
+    if (p.grid.blockSize < 1 || p.grid.blockSize > 100) return false;
+    const int sampling = static_cast<int>(p.sampling);
+    if (sampling < I2P_SAMPLING_MEAN || sampling > I2P_SAMPLING_TRIMMED_MEAN) return false;
+    const int shape = static_cast<int>(p.shape);
+    if (shape < I2P_SHAPE_SQUARE || shape > I2P_SHAPE_DOT) return false;
+    return std::isfinite(p.angle);
+}
+
+// Same versioning as toParams; the ranges match the core CLI's options.
+bool toRenderParams(const i2p_render_params *render, i2p::RenderParams &result, i2p::Palette &palette,
+                    i2p::ColorMetric &metric) {
+    i2p_render_params defaults;
+    i2p_render_params_init(&defaults);
+    if (render) {
+        size_t size = render->struct_size < sizeof(i2p_render_params) ? render->struct_size
+                                                                       : sizeof(i2p_render_params);
+        std::memcpy(&defaults, render, size);
+    }
+
+    if (defaults.mode < I2P_MODE_GRID || defaults.mode > I2P_MODE_TARGET) return false;
+    if (defaults.max_block_size < 2 || defaults.max_block_size > i2p::kMaxAdaptiveBlockSize) return false;
+    if (defaults.tolerance < 0 || defaults.tolerance > 255) return false;
+    if (defaults.mode == I2P_MODE_TARGET && (defaults.grid_columns < 1 || defaults.grid_rows < 1)) return false;
+    if (defaults.colors < 0 || defaults.colors > i2p::kMaxPaletteSize) return false;
+    if (defaults.quantize < I2P_QUANTIZE_MEDIAN_CUT || defaults.quantize > I2P_QUANTIZE_KMEANS) return false;
+    if (defaults.palette_metric < I2P_METRIC_RGB || defaults.palette_metric > I2P_METRIC_WEIGHTED) return false;
+    if (defaults.dither < I2P_DITHER_NONE || defaults.dither > I2P_DITHER_ATKINSON) return false;
+    if (defaults.palette) {
+        if (defaults.palette_size < 1 || defaults.palette_size > i2p::kMaxPaletteSize || defaults.colors) return false;
+        for (int i = 0; i < defaults.palette_size; ++i) {
+            const uint8_t *rgb = defaults.palette + 3 * i;
+            palette.push_back({rgb[0], rgb[1], rgb[2]});
+        }
+    }
+    // Dithering only acts while mapping to a palette, and not on quadtree blocks.
+    if (defaults.dither != I2P_DITHER_NONE) {
+        if ((palette.empty() && !defaults.colors) || defaults.mode == I2P_MODE_ADAPTIVE) return false;
+    }
+
+    result.mode = static_cast<i2p::PixelateMode>(defaults.mode);
+    result.maxBlockSize = defaults.max_block_size;
+    result.maxDeviation = defaults.tolerance;
+    result.gridColumns = defaults.grid_columns;
+    result.gridRows = defaults.grid_rows;
+    result.colors = defaults.colors;
+    result.quantize = defaults.quantize == I2P_QUANTIZE_KMEANS ? i2p::QuantizeMethod::KMeans
+                                                               : i2p::QuantizeMethod::MedianCut;
+    result.dither = static_cast<i2p::DitherMethod>(defaults.dither);
+    metric = defaults.palette_metric == I2P_METRIC_WEIGHTED ? i2p::ColorMetric::Weighted : i2p::ColorMetric::Rgb;
+    return true;
+}
+
+} // namespace
+
+extern "C" {
+
+const char *i2p_version(void) {
+    return IMAGE2PIXEL_VERSION;
+}
+
+void i2p_params_init(i2p_params *params) {
+    if (!params) return;
+    std::memset(params, 0, sizeof(*params));
+    params->struct_size = sizeof(i2p_params);
+    params->block_size = 10;
+}
+
+void i2p_render_params_init(i2p_render_params *params) {
+    if (!params) return;
+    std::memset(params, 0, sizeof(*params));
+    params->struct_size = sizeof(i2p_render_params);
+    params->max_block_size = 64;
+    params->tolerance = 10;
+    params->quantize = I2P_QUANTIZE_KMEANS;
+}
+
+i2p_status i2p_pixelate(const i2p_image *src, const i2p_image *dst, const i2p_params *params) {
+    i2p::ImageView srcView, dstView;
+    if (!toView(src, srcView) || !toView(dst, dstView)) return I2P_ERROR_INVALID_ARGUMENT;
+
+    i2p::PixelateParams p = toParams(params);
+    if (!isValidParams(p)) return I2P_ERROR_INVALID_ARGUMENT;
+    return i2p::pixelate(srcView, dstView, p) ? I2P_OK : I2P_ERROR_INVALID_ARGUMENT;
+}
+
+i2p_status i2p_render(const i2p_image *src, const i2p_image *dst, const i2p_params *params,
+                      const i2p_render_params *render) {
+    i2p::ImageView srcView, dstView;
+    if (!toView(src, srcView) || !toView(dst, dstView)) return I2P_ERROR_INVALID_ARGUMENT;
+
+    try {
+        i2p::RenderParams r;
+        i2p::Palette palette;
+        i2p::ColorMetric metric = i2p::ColorMetric::Rgb;
+        r.pixelate = toParams(params);
+        if (!isValidParams(r.pixelate) || !toRenderParams(render, r, palette, metric)) {
+            return I2P_ERROR_INVALID_ARGUMENT;
+        }
+        i2p::PaletteLut lut;
+        if (!palette.empty()) {
+            if (!lut.build(palette, metric, r.pixelate.threads)) return I2P_ERROR_INVALID_ARGUMENT;
+            r.palette = &lut;
+        }
+        return i2p::render(srcView, dstView, r) ? I2P_OK : I2P_ERROR_INVALID_ARGUMENT;
+    } catch (const std::bad_alloc &) {
+        return I2P_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+i2p_status i2p_encode_jpeg(const i2p_image *image, int32_t quality, const i2p_params *grid,
+                           uint8_t **out, size_t *out_size) {
+    i2p::ImageView view;
+    if (!toView(image, view) || !out || !out_size) return I2P_ERROR_INVALID_ARGUMENT;
+
+    i2p::JpegOptions options;
+    options.quality = quality;
+    // DC-only blocks follow upright square cells only.
+    if (grid) {
+        const i2p::PixelateParams p = toParams(grid);
+        if (p.shape == i2p::BlockShape::Square && p.angle == 0.0) options.grid = p.grid;
+    }
+
+    std::vector<uint8_t> encoded;
+    try {
+        if (!i2p::encodeJpeg(view, options, encoded)) return I2P_ERROR_INVALID_ARGUMENT;
+    } catch (const std::bad_alloc &) {
+        return I2P_ERROR_OUT_OF_MEMORY;
+    }
+
+    *out = static_cast<uint8_t *>(std::malloc(encoded.size()));
+    if (!*out) return I2P_ERROR_OUT_OF_MEMORY;
+    std::memcpy(*out, encoded.data(), encoded.size());
+    *out_size = encoded.size();
+    return I2P_OK;
+}
+
+void i2p_free(void *pointer) {
+    std::free(pointer);
+}
+
+} // extern "C"
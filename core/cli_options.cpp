@@ -0,0 +1,348 @@
+#include "cli_options.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "jpeg_writer.h"
+
+namespace i2p {
+
+namespace {
+
+bool parseSize(const char *text, int &width, int &height) {
+    char *end = nullptr;
+    long w = std::strtol(text, &end, 10);
+    if (end == text || (*end != 'x' && *end != 'X')) return false;
+    const char *rest = end + 1;
+    long h = std::strtol(rest, &end, 10);
+    if (end == rest || *end != '\0' || w < 1 || h < 1 || w > 1000000 || h > 1000000) return false;
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+    return true;
+}
+
+bool parseInt(const char *text, int minValue, int maxValue, int &value) {
+    char *end = nullptr;
+    long parsed = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < minValue || parsed > maxValue) return false;
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+} // namespace
+
+bool isHeadlessInvocation(int argc, char **argv) {
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (!std::strcmp(arg, "-i") || !std::strcmp(arg, "--input") || !std::strcmp(arg, "--generate") ||
+            !std::strcmp(arg, "-h") || !std::strcmp(arg, "--help") ||
+            !std::strcmp(arg, "-v") || !std::strcmp(arg, "--version")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseCliOptions(int argc, char **argv, CliOptions &options, std::string &error) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+        auto needValue = [&]() {
+            if (!value) {
+                error = "missing value for " + arg;
+                return false;
+            }
+            ++i;
+            return true;
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            options.showHelp = true;
+        } else if (arg == "-v" || arg == "--version") {
+            options.showVersion = true;
+        } else if (arg == "-i" || arg == "--input") {
+            if (!needValue()) return false;
+            options.input = value;
+        } else if (arg == "-o" || arg == "--output") {
+            if (!needValue()) return false;
+            options.output = value;
+        } else if (arg == "-b" || arg == "--block-size") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 1, 100, options.blockSize)) {
+                error = "block size must be between 1 and 100";
+                return false;
+            }
+        } else if (arg == "--phase") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 0, 99, options.phase)) {
+                error = "phase must be between 0 and 99";
+                return false;
+            }
+        } else if (arg == "--align-mcu") {
+            options.alignMcu = true;
+        } else if (arg == "--sampling") {
+            if (!needValue()) return false;
+            if (!parseBlockSampling(value, options.sampling)) {
+                error = "sampling must be mean, oklab, dominant, median or trimmed-mean";
+                return false;
+            }
+        } else if (arg == "--shape") {
+            if (!needValue()) return false;
+            if (!parseBlockShape(value, options.shape)) {
+                error = "shape must be square, hexagon, triangle or dot";
+                return false;
+            }
+        } else if (arg == "--angle") {
+            if (!needValue()) return false;
+            if (!parseInt(value, -180, 180, options.angle)) {
+                error = "angle must be between -180 and 180";
+                return false;
+            }
+        } else if (arg == "--adaptive") {
+            options.adaptive = true;
+        } else if (arg == "--grid") {
+            if (!needValue()) return false;
+            if (!parseSize(value, options.gridColumns, options.gridRows)) {
+                error = "grid must look like 64x64";
+                return false;
+            }
+        } else if (arg == "--max-block") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 2, kMaxAdaptiveBlockSize, options.maxBlockSize)) {
+                error = "max block must be between 2 and " + std::to_string(kMaxAdaptiveBlockSize);
+                return false;
+            }
+        } else if (arg == "--tolerance") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 0, 255, options.tolerance)) {
+                error = "tolerance must be between 0 and 255";
+                return false;
+            }
+        } else if (arg == "--colors") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 0, kMaxPaletteSize, options.colors)) {
+                error = "colors must be between 0 and " + std::to_string(kMaxPaletteSize);
+                return false;
+            }
+        } else if (arg == "--quantize") {
+            if (!needValue()) return false;
+            if (!std::strcmp(value, "median-cut")) {
+                options.quantize = QuantizeMethod::MedianCut;
+            } else if (!std::strcmp(value, "kmeans")) {
+                options.quantize = QuantizeMethod::KMeans;
+            } else {
+                error = "quantize must be median-cut or kmeans";
+                return false;
+            }
+        } else if (arg == "--palette") {
+            if (!needValue()) return false;
+            options.palette = value;
+        } else if (arg == "--palette-metric") {
+            if (!needValue()) return false;
+            if (!std::strcmp(value, "rgb")) {
+                options.paletteMetric = ColorMetric::Rgb;
+            } else if (!std::strcmp(value, "weighted")) {
+                options.paletteMetric = ColorMetric::Weighted;
+            } else {
+                error = "palette metric must be rgb or weighted";
+                return false;
+            }
+        } else if (arg == "--dither") {
+            if (!needValue()) return false;
+            if (!parseDitherMethod(value, options.dither)) {
+                error = "dither must be none, bayer2, bayer4, bayer8, floyd-steinberg or atkinson";
+                return false;
+            }
+        } else if (arg == "-q" || arg == "--quality") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 1, 100, options.quality)) {
+                error = "quality must be between 1 and 100";
+                return false;
+            }
+        } else if (arg == "--generate") {
+            if (!needValue()) return false;
+            if (!parseSynthPattern(value, options.synth.pattern)) {
+                error = "unknown pattern: " + std::string(value);
+                return false;
+            }
+            options.generate = true;
+        } else if (arg == "--size") {
+            if (!needValue()) return false;
+            if (!parseSize(value, options.synth.width, options.synth.height)) {
+                error = "size must look like 1920x1080";
+                return false;
+            }
+        } else if (arg == "--seed") {
+            if (!needValue()) return false;
+            char *end = nullptr;
+            options.synth.seed = std::strtoull(value, &end, 10);
+            if (end == value || *end != '\0') {
+                error = "seed must be a non-negative integer";
+                return false;
+            }
+        } else if (arg == "--pixel-format") {
+            if (!needValue()) return false;
+            if (!parsePixelFormat(value, options.synth.format)) {
+                error = "pixel format must be argb32, rgba8888, rgb888 or gray8";
+                return false;
+            }
+        } else if (arg == "--trace") {
+            if (!needValue()) return false;
+            options.traceFile = value;
+        } else if (arg == "-t" || arg == "--threads") {
+            if (!needValue()) return false;
+            if (!parseInt(value, 0, 1024, options.threads)) {
+                error = "threads must be between 0 and 1024";
+                return false;
+            }
+        } else {
+            error = "unknown option: " + arg;
+            return false;
+        }
+    }
+
+    if (options.showHelp || options.showVersion) return true;
+    if (options.generate == !options.input.empty()) {
+        error = "exactly one of --input and --generate is required";
+        return false;
+    }
+    if (options.generate && options.synth.width == 0) {
+        error = "--generate needs --size";
+        return false;
+    }
+    if (options.adaptive && options.gridColumns) {
+        error = "--grid and --adaptive cannot be combined";
+        return false;
+    }
+    if (options.adaptive && options.blockSize > options.maxBlockSize) {
+        error = "--adaptive needs a block size no larger than --max-block";
+        return false;
+    }
+    if (options.shape != BlockShape::Square && (options.adaptive || options.gridColumns)) {
+        error = "--shape only works with uniform blocks, not --adaptive or --grid";
+        return false;
+    }
+    if (!options.palette.empty() && options.colors) {
+        error = "--palette and --colors cannot be combined";
+        return false;
+    }
+    if (options.dither != DitherMethod::None && options.palette.empty() && !options.colors) {
+        error = "--dither needs --colors or --palette";
+        return false;
+    }
+    if (options.adaptive && options.dither != DitherMethod::None) {
+        error = "--dither cannot be combined with --adaptive";
+        return false;
+    }
+    if (options.angle && (options.adaptive || options.gridColumns || options.shape != BlockShape::Square)) {
+        error = "--angle only turns square blocks, not --adaptive, --grid or --shape";
+        return false;
+    }
+    if (options.output.empty()) {
+        error = "--output is required";
+        return false;
+    }
+    return true;
+}
+
+std::string cliUsage(const std::string &program) {
+    return "Usage: " + program + " -i <input> -o <output> [options]\n"
+           "       " + program + " --generate <pattern> --size <WxH> -o <output> [options]\n"
+           "\n"
+           "  -i, --input <file>       image to pixelate (png, jpg, bmp)\n"
+           "  -o, --output <file>      where to write the result; format follows the extension\n"
+           "                           (png, jpg, bmp, or streamed pgm, ppm, pam, raw)\n"
+           "      --generate <pattern> synthesize the input: noise, gradient, flat, alpha, texture\n"
+           "      --size <WxH>         size of the generated image\n"
+           "      --seed <n>           generator seed (default 1)\n"
+           "      --pixel-format <f>   generated layout for pam/raw: argb32, rgba8888, rgb888, gray8\n"
+           "  -b, --block-size <n>     pixel size, 1-100 (default 10)\n"
+           "      --phase <n>          grid offset in pixels (default 0)\n"
+           "      --align-mcu          snap the grid to JPEG 8x8 blocks and write DC-only flat blocks\n"
+           "      --sampling <m>       block colour: mean (default), oklab (mean in a perceptual space),\n"
+           "                           dominant (most frequent colour), median or trimmed-mean\n"
+           "                           (both ignore outlying pixels)\n"
+           "      --shape <s>          cell shape: square (default), hexagon, triangle or dot; -b is\n"
+           "                           the cell width, other shapes always take the mean\n"
+           "      --angle <deg>        turn the block grid by -180 to 180 degrees, clockwise;\n"
+           "                           turned blocks always take the mean\n"
+           "      --adaptive           quadtree blocks: split where detail needs it, -b is the\n"
+           "                           smallest block\n"
+           "      --grid <WxH>         pixelate to exactly W x H cells instead of -b; cells may be\n"
+           "                           fractional pixels wide and average their exact area\n"
+           "      --max-block <n>      largest adaptive block, 2-128 (default 64)\n"
+           "      --tolerance <n>      colour deviation an adaptive block may keep, 0-255 (default 10)\n"
+           "      --colors <n>         reduce to a palette of n colours fitted to the blocks, 0 = off\n"
+           "      --quantize <m>       palette method: kmeans (default) or median-cut\n"
+           "      --palette <p>        map blocks to a fixed palette: pico8, gameboy, or a .gpl/.hex file;\n"
+           "                           not with --colors\n"
+           "      --palette-metric <m> colour distance for --palette: rgb (default) or weighted\n"
+           "      --dither <d>         with --colors/--palette: none, bayer2, bayer4, bayer8,\n"
+           "                           floyd-steinberg, atkinson; not with --adaptive\n"
+           "  -q, --quality <n>        JPEG quality, 1-100 (default 75)\n"
+           "  -t, --threads <n>        worker threads, 0 = all (default 0)\n"
+           "      --trace <file>       write a Chrome/Perfetto trace of the run (JSON)\n"
+           "  -h, --help               show this help\n"
+           "  -v, --version            show version\n";
+}
+
+int effectivePhase(const CliOptions &options) {
+    if (options.blockSize <= 1) return 0;
+    return options.alignMcu ? alignPhaseToMcu(options.blockSize, options.phase)
+                            : options.phase % options.blockSize;
+}
+
+bool usesUprightGrid(const CliOptions &options) {
+    return !options.adaptive && !options.gridColumns && options.shape == BlockShape::Square && !options.angle;
+}
+
+PixelateParams toPixelateParams(const CliOptions &options) {
+    PixelateParams params;
+    params.grid.blockSize = options.blockSize;
+    params.grid.phaseX = params.grid.phaseY = effectivePhase(options);
+    params.threads = options.threads;
+    params.sampling = options.sampling;
+    params.shape = options.shape;
+    params.angle = options.angle;
+    return params;
+}
+
+bool toRenderParams(const CliOptions &options, PaletteLut &lut, RenderParams &params, std::string &error) {
+    params = RenderParams();
+    params.mode = options.gridColumns ? PixelateMode::Target
+                  : options.adaptive  ? PixelateMode::Adaptive
+                                      : PixelateMode::Grid;
+    params.pixelate = toPixelateParams(options);
+    params.maxBlockSize = options.maxBlockSize;
+    params.maxDeviation = options.tolerance;
+    params.gridColumns = options.gridColumns;
+    params.gridRows = options.gridRows;
+    params.colors = options.colors;
+    params.quantize = options.quantize;
+    params.dither = options.dither;
+    if (!options.palette.empty()) {
+        Palette palette;
+        if (!resolvePalette(options.palette, palette, error)) return false;
+        lut.build(palette, options.paletteMetric, options.threads);
+        params.palette = &lut;
+    }
+    return true;
+}
+
+bool hasExtension(const std::string &path, const char *extension) {
+    std::string::size_type dot = path.find_last_of('.');
+    if (dot == std::string::npos) return false;
+    std::string suffix = path.substr(dot + 1);
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return suffix == extension;
+}
+
+bool isJpegPath(const std::string &path) {
+    return hasExtension(path, "jpg") || hasExtension(path, "jpeg");
+}
+
+} // namespace i2p
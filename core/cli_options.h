@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+
+#include "export.h"
+#include "pixelate.h"
+#include "render.h"
+#include "synth.h"
+
+namespace i2p {
+
+// Command-line options shared by the Qt application's headless mode and the
+// Qt-free image2pixel-core-cli, so both accept exactly the same flags.
+struct CliOptions {
+    std::string input;
+    bool generate = false;              // --generate: synthesize instead of --input
+    SynthParams synth;
+    std::string output;
+    int blockSize = 10;
+    int phase = 0;
+    bool alignMcu = false;
+    BlockSampling sampling = BlockSampling::Mean;
+    BlockShape shape = BlockShape::Square;
+    int angle = 0;          // --angle: grid rotation in degrees
+    bool adaptive = false;  // --adaptive: quadtree blocks, blockSize is the smallest
+    int maxBlockSize = 64;
+    int tolerance = 10;     // RMS colour deviation allowed inside an adaptive block
+    int gridColumns = 0;    // --grid: output grid in cells instead of a block size, 0 = off
+    int gridRows = 0;
+    int colors = 0;         // --colors: palette size, 0 = no quantization
+    QuantizeMethod quantize = QuantizeMethod::KMeans;
+    std::string palette;    // --palette: built-in name or .gpl/.hex file
+    ColorMetric paletteMetric = ColorMetric::Rgb;
+    DitherMethod dither = DitherMethod::None;
+    int quality = 75;
+    int threads = 0;        // 0 = all hardware threads
+    std::string traceFile;  // --trace: Chrome trace JSON written on exit
+    bool showHelp = false;
+    bool showVersion = false;
+};
+
+// True when argv asks for headless operation rather than the GUI.
+I2P_API bool isHeadlessInvocation(int argc, char **argv);
+
+// Parses argv into options. On failure returns false and sets error.
+I2P_API bool parseCliOptions(int argc, char **argv, CliOptions &options, std::string &error);
+
+I2P_API std::string cliUsage(const std::string &program);
+
+// Grid phase after applying --align-mcu.
+I2P_API int effectivePhase(const CliOptions &options);
+
+// True when the output follows the uniform grid of upright squares, which
+// is what --align-mcu needs to write DC-only JPEG blocks.
+I2P_API bool usesUprightGrid(const CliOptions &options);
+
+// Block size, effective phase, sampling, shape, angle and thread count as
+// pixelation parameters.
+I2P_API PixelateParams toPixelateParams(const CliOptions &options);
+
+// Everything render() needs, including the adaptive and target-grid settings. A --palette
+// is resolved into `lut`, which params.palette then points at; returns false
+// with an error when the palette cannot be loaded.
+I2P_API bool toRenderParams(const CliOptions &options, PaletteLut &lut, RenderParams &params, std::string &error);
+
+// Case-insensitive extension check; extension is given without the dot.
+I2P_API bool hasExtension(const std::string &path, const char *extension);
+
+// True for .jpg/.jpeg output paths.
+I2P_API bool isJpegPath(const std::string &path);
+
+} // namespace i2p
@@ -0,0 +1,305 @@
+#include "dither.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define I2P_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+inline int gridStart(int phase, int blockSize) {
+    int offset = phase % blockSize;
+    return offset ? offset - blockSize : 0;
+}
+
+int matrixSize(DitherMethod method) {
+    switch (method) {
+        case DitherMethod::Bayer2: return 2;
+        case DitherMethod::Bayer4: return 4;
+        case DitherMethod::Bayer8: return 8;
+        default: return 0;
+    }
+}
+
+// Block grid of an image: cell (column, row) covers pixels [x0, x1) x [y0, y1).
+struct BlockGrid {
+    int startX;
+    int startY;
+    int blockSize;
+    int columns;
+    int rows;
+    int width;
+    int height;
+
+    BlockGrid(const ConstImageView &image, const GridGeometry &grid)
+        : blockSize(std::max(grid.blockSize, 1)), width(image.width), height(image.height) {
+        startX = gridStart(std::max(grid.phaseX, 0), blockSize);
+        startY = gridStart(std::max(grid.phaseY, 0), blockSize);
+        columns = (width - startX + blockSize - 1) / blockSize;
+        rows = (height - startY + blockSize - 1) / blockSize;
+    }
+
+    int x0(int column) const { return std::max(startX + column * blockSize, 0); }
+    int x1(int column) const { return std::min(startX + (column + 1) * blockSize, width); }
+    int y0(int row) const { return std::max(startY + row * blockSize, 0); }
+    int y1(int row) const { return std::min(startY + (row + 1) * blockSize, height); }
+};
+
+// Where a diffusion kernel sends the error of one block, in units of
+// 1 / 2^shift. `below` covers columns -1, 0, +1 of the next row; Atkinson
+// also sends some two rows down and two blocks right.
+struct DiffusionKernel {
+    int shift;
+    int right;
+    int rightTwo;
+    int below[3];
+    int belowTwo;
+    int rowsDown;
+};
+
+constexpr DiffusionKernel kFloydSteinberg = {4, 7, 0, {3, 5, 1}, 0, 1};
+constexpr DiffusionKernel kAtkinson = {3, 1, 1, {1, 1, 1}, 1, 2};
+
+// Block rows wait for the row above to finish the column after theirs, so
+// every error a block receives has arrived before it is read.
+constexpr int kWavefrontLag = 2;
+
+inline int clampByte(int value) {
+    return std::min(std::max(value, 0), 255);
+}
+
+inline int roundShift(int value, int shift) {
+    return (value + (1 << (shift - 1))) >> shift;
+}
+
+// Matcher is PaletteMatcher or PaletteLut.
+template <typename Matcher>
+void diffuseErrors(const ImageView &image, const GridGeometry &geometry, const DiffusionKernel &kernel,
+                   const Matcher &matcher, int threads) {
+    const BlockGrid grid(image, geometry);
+    const int bpp = bytesPerPixel(image.format);
+    const Palette &palette = matcher.palette();
+
+    // Rows finish in order and each participant works on one row at a time,
+    // so at most `participants` rows are unfinished; a ring of error rows a
+    // little larger than that is never overwritten while still needed.
+    // Errors stored for a row come only from the rows above; a row's own
+    // rightward errors stay in locals, so no two rows write the same slot.
+    const int participants = std::min(resolveThreadCount(threads), grid.rows);
+    const int ring = participants + kernel.rowsDown + 2;
+    const int pitch = (grid.columns + 4) * 3;  // two padding blocks each side
+    std::vector<int32_t> errors(static_cast<size_t>(ring) * pitch, 0);
+    std::vector<std::atomic<int>> progress(grid.rows);
+    for (std::atomic<int> &done : progress) done.store(0, std::memory_order_relaxed);
+    std::atomic<int> nextRow{0};
+
+    auto errorRow = [&](int row) { return &errors[static_cast<size_t>(row % ring) * pitch + 6]; };
+
+    parallelFor(0, participants, threads, [&](int, int) {
+        for (;;) {
+            // Rows are claimed in order, so the row above is always held by
+            // a participant that is running (or done): waiting cannot deadlock.
+            const int row = nextRow.fetch_add(1);
+            if (row >= grid.rows) break;
+            I2P_TRACE_SPAN("dither.diffuse.row");
+
+            int32_t *current = errorRow(row);
+            int32_t *below = errorRow(row + 1);
+            int32_t *belowTwo = errorRow(row + 2);
+            // Nobody else writes this slot until this row has made progress.
+            std::fill_n(errorRow(row + kernel.rowsDown) - 6, pitch, 0);
+
+            int32_t carry[3] = {}, carryTwo[3] = {};
+            const int y0 = grid.y0(row);
+            const int y1 = grid.y1(row);
+            for (int column = 0; column < grid.columns; ++column) {
+                if (row > 0) {
+                    const int needed = std::min(column + kWavefrontLag, grid.columns);
+                    while (progress[row - 1].load(std::memory_order_acquire) < needed) std::this_thread::yield();
+                }
+
+                const int x0 = grid.x0(column);
+                const int x1 = grid.x1(column);
+                const Color color = readColor(image.row(y0) + x0 * bpp, image.format);
+                const int channel[3] = {color.r, color.g, color.b};
+                int value[3];
+                for (int c = 0; c < 3; ++c) {
+                    const int received = current[3 * column + c] + carry[c];
+                    value[c] = clampByte(channel[c] + roundShift(received, kernel.shift));
+                }
+                const Color target{static_cast<uint8_t>(value[0]), static_cast<uint8_t>(value[1]),
+                                   static_cast<uint8_t>(value[2])};
+                const Color chosen = palette[matcher.nearest(target)];
+                const int mapped[3] = {chosen.r, chosen.g, chosen.b};
+
+                for (int c = 0; c < 3; ++c) {
+                    const int error = value[c] - mapped[c];
+                    carry[c] = carryTwo[c] + error * kernel.right;
+                    carryTwo[c] = error * kernel.rightTwo;
+                    below[3 * (column - 1) + c] += error * kernel.below[0];
+                    below[3 * column + c] += error * kernel.below[1];
+                    below[3 * (column + 1) + c] += error * kernel.below[2];
+                    if (kernel.belowTwo) belowTwo[3 * column + c] += error * kernel.belowTwo;
+                }
+
+                for (int y = y0; y < y1; ++y) {
+                    uint8_t *p = image.row(y) + x0 * bpp;
+                    for (int x = x0; x < x1; ++x, p += bpp) writeColor(p, image.format, chosen);
+                }
+                progress[row].store(column + 1, std::memory_order_release);
+            }
+        }
+    });
+}
+
+const DiffusionKernel *diffusionKernel(DitherMethod method) {
+    switch (method) {
+        case DitherMethod::FloydSteinberg: return &kFloydSteinberg;
+        case DitherMethod::Atkinson: return &kAtkinson;
+        default: return nullptr;
+    }
+}
+
+// Bayer matrix entry, from M(2n) = 4 M(n) + [0 2; 3 1]: the finest bit of
+// the position picks the most significant base-4 digit.
+int bayerValue(int size, int x, int y) {
+    int value = 0;
+    for (int bit = 1; bit < size; bit *= 2) {
+        const int qx = (x & bit) ? 1 : 0;
+        const int qy = (y & bit) ? 1 : 0;
+        value = value * 4 + 2 * (qx ^ qy) + qy;
+    }
+    return value;
+}
+
+// Adds a signed per-byte offset, stored as separate increments and
+// decrements so both steps saturate at 0 and 255.
+void addOffsets(uint8_t *row, const uint8_t *plus, const uint8_t *minus, size_t bytes) {
+    size_t i = 0;
+#if I2P_HAVE_SSE2
+    // One block row's thresholds cover the register, so a whole image row
+    // is processed 16 bytes per step regardless of the block size.
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        value = _mm_adds_epu8(value, _mm_loadu_si128(reinterpret_cast<const __m128i *>(plus + i)));
+        value = _mm_subs_epu8(value, _mm_loadu_si128(reinterpret_cast<const __m128i *>(minus + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + i), value);
+    }
+#endif
+    for (; i < bytes; ++i) {
+        const int value = row[i] + plus[i] - minus[i];
+        row[i] = static_cast<uint8_t>(std::min(std::max(value, 0), 255));
+    }
+}
+
+} // namespace
+
+const char *ditherMethodName(DitherMethod method) {
+    switch (method) {
+        case DitherMethod::None:   return "none";
+        case DitherMethod::Bayer2: return "bayer2";
+        case DitherMethod::Bayer4: return "bayer4";
+        case DitherMethod::Bayer8: return "bayer8";
+        case DitherMethod::FloydSteinberg: return "floyd-steinberg";
+        case DitherMethod::Atkinson: return "atkinson";
+    }
+    return "?";
+}
+
+bool parseDitherMethod(const char *name, DitherMethod &method) {
+    for (DitherMethod m : {DitherMethod::None, DitherMethod::Bayer2, DitherMethod::Bayer4, DitherMethod::Bayer8,
+                           DitherMethod::FloydSteinberg, DitherMethod::Atkinson}) {
+        if (!std::strcmp(name, ditherMethodName(m))) {
+            method = m;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool isErrorDiffusion(DitherMethod method) {
+    return diffusionKernel(method) != nullptr;
+}
+
+int ditherSpread(int paletteSize) {
+    if (paletteSize <= 1) return 0;
+    const double levels = std::cbrt(static_cast<double>(paletteSize));
+    return levels <= 2.0 ? 255 : static_cast<int>(std::lround(255.0 / (levels - 1.0)));
+}
+
+bool applyOrderedDither(const ImageView &image, const GridGeometry &grid, DitherMethod method, int spread,
+                        int threads) {
+    if (!isValid(image)) return false;
+    const int size = matrixSize(method);
+    if (size == 0 || spread <= 0) return true;
+
+    I2P_TRACE_SPAN("dither.ordered");
+    const int blockSize = std::max(grid.blockSize, 1);
+    const int startX = gridStart(std::max(grid.phaseX, 0), blockSize);
+    const int startY = gridStart(std::max(grid.phaseY, 0), blockSize);
+    const int bpp = bytesPerPixel(image.format);
+    const bool hasAlpha = bpp == 4;
+    const size_t rowBytes = static_cast<size_t>(image.width) * bpp;
+
+    // One offset row per matrix row: the thresholds of consecutive block
+    // columns, repeated over each block's pixels and colour channels.
+    std::vector<uint8_t> plus(rowBytes * size), minus(rowBytes * size);
+    const int levels = size * size;
+    for (int my = 0; my < size; ++my) {
+        for (int x = 0; x < image.width; ++x) {
+            const int column = (x - startX) / blockSize;
+            // Centred threshold in (-1/2, 1/2), scaled to the spread.
+            const double threshold = (bayerValue(size, column % size, my) + 0.5) / levels - 0.5;
+            const int offset = static_cast<int>(std::lround(threshold * spread));
+            for (int c = 0; c < bpp; ++c) {
+                const bool alpha = hasAlpha && c == 3;
+                const size_t i = my * rowBytes + static_cast<size_t>(x) * bpp + c;
+                plus[i] = static_cast<uint8_t>(alpha ? 0 : std::min(std::max(offset, 0), 127));
+                minus[i] = static_cast<uint8_t>(alpha ? 0 : std::min(std::max(-offset, 0), 127));
+            }
+        }
+    }
+
+    parallelFor(0, image.height, threads, [&](int first, int last) {
+        for (int y = first; y < last; ++y) {
+            const size_t my = static_cast<size_t>((y - startY) / blockSize % size);
+            addOffsets(image.row(y), &plus[my * rowBytes], &minus[my * rowBytes], rowBytes);
+        }
+    });
+    return true;
+}
+
+bool applyErrorDiffusion(const ImageView &image, const GridGeometry &grid, DitherMethod method,
+                         const Palette &palette, int threads) {
+    const DiffusionKernel *kernel = diffusionKernel(method);
+    if (!isValid(image) || !kernel || palette.empty() || palette.size() > static_cast<size_t>(kMaxPaletteSize))
+        return false;
+
+    I2P_TRACE_SPAN("dither.diffuse");
+    diffuseErrors(image, grid, *kernel, PaletteMatcher(palette), threads);
+    return true;
+}
+
+bool applyErrorDiffusion(const ImageView &image, const GridGeometry &grid, DitherMethod method,
+                         const PaletteLut &lut, int threads) {
+    const DiffusionKernel *kernel = diffusionKernel(method);
+    if (!isValid(image) || !kernel || lut.empty()) return false;
+
+    I2P_TRACE_SPAN("dither.diffuse");
+    diffuseErrors(image, grid, *kernel, lut, threads);
+    return true;
+}
+
+} // namespace i2p
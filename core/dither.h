@@ -0,0 +1,47 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+#include "palette.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+enum class DitherMethod {
+    None,
+    Bayer2,         // ordered, 2x2 threshold matrix
+    Bayer4,         // ordered, 4x4
+    Bayer8,         // ordered, 8x8
+    FloydSteinberg, // error diffusion: 7/16 right, 3/16, 5/16, 1/16 below
+    Atkinson        // error diffusion: 1/8 to each of six neighbours, 2/8 dropped
+};
+
+I2P_API bool isErrorDiffusion(DitherMethod method);
+
+I2P_API const char *ditherMethodName(DitherMethod method);
+I2P_API bool parseDitherMethod(const char *name, DitherMethod &method);
+
+// Offset range suited to a palette of the given size: the typical gap
+// between neighbouring palette colours, assuming they are spread over the
+// RGB cube.
+I2P_API int ditherSpread(int paletteSize);
+
+// Ordered dithering at block resolution: every block of the grid gets one
+// threshold from the Bayer matrix (tiled over block columns and rows),
+// scaled to +-spread / 2 and added to its colour channels, ready for
+// remapToPalette(). Blocks stay flat and alpha is left alone.
+I2P_API bool applyOrderedDither(const ImageView &image, const GridGeometry &grid, DitherMethod method, int spread,
+                                int threads = 0);
+
+// Error diffusion at block resolution, which also maps to the palette:
+// blocks are visited in scanline order, each takes the nearest palette
+// colour to its colour plus the error it received, and passes its own error
+// on in whole 1/16ths (Floyd-Steinberg) or 1/8ths (Atkinson). Block rows run
+// on several threads as a diagonal wavefront, each row two blocks behind
+// the one above; integer errors keep the result identical to a serial pass.
+I2P_API bool applyErrorDiffusion(const ImageView &image, const GridGeometry &grid, DitherMethod method,
+                                 const Palette &palette, int threads = 0);
+I2P_API bool applyErrorDiffusion(const ImageView &image, const GridGeometry &grid, DitherMethod method,
+                                 const PaletteLut &lut, int threads = 0);
+
+} // namespace i2p
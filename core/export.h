@@ -0,0 +1,17 @@
+#pragma once
+
+// Symbol visibility for libimage2pixel. I2P_SHARED is set for consumers of a
+// shared build, I2P_BUILDING while compiling the library itself.
+#if defined(I2P_SHARED)
+#  if defined(_WIN32)
+#    if defined(I2P_BUILDING)
+#      define I2P_API __declspec(dllexport)
+#    else
+#      define I2P_API __declspec(dllimport)
+#    endif
+#  else
+#    define I2P_API __attribute__((visibility("default")))
+#  endif
+#else
+#  define I2P_API
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+#include "export.h"
+
+namespace i2p {
+
+// Byte layout of a pixel. Averaging treats every channel alike, so the order
+// only matters to stages that need to know which byte is red.
+enum class PixelFormat {
+    Argb32,     // native-endian 0xAARRGGBB words (QImage::Format_ARGB32)
+    Rgba8888,   // bytes R, G, B, A (stb_image with 4 components)
+    Rgb888,     // bytes R, G, B
+    Gray8       // one luminance byte
+};
+
+inline int bytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::Rgb888: return 3;
+        case PixelFormat::Gray8:  return 1;
+        default:                  return 4;
+    }
+}
+
+inline const char *pixelFormatName(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::Argb32:   return "argb32";
+        case PixelFormat::Rgba8888: return "rgba8888";
+        case PixelFormat::Rgb888:   return "rgb888";
+        case PixelFormat::Gray8:    return "gray8";
+    }
+    return "?";
+}
+
+inline bool parsePixelFormat(const char *name, PixelFormat &format) {
+    for (PixelFormat f : {PixelFormat::Argb32, PixelFormat::Rgba8888, PixelFormat::Rgb888, PixelFormat::Gray8}) {
+        if (!std::strcmp(name, pixelFormatName(f))) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Non-owning view of a strided image buffer. Rows may be padded; the stride
+// is the distance in bytes between the starts of consecutive rows.
+struct ImageView {
+    uint8_t *data = nullptr;
+    int width = 0;
+    int height = 0;
+    ptrdiff_t stride = 0;
+    PixelFormat format = PixelFormat::Argb32;
+
+    uint8_t *row(int y) const { return data + y * stride; }
+};
+
+struct ConstImageView {
+    const uint8_t *data = nullptr;
+    int width = 0;
+    int height = 0;
+    ptrdiff_t stride = 0;
+    PixelFormat format = PixelFormat::Argb32;
+
+    ConstImageView() = default;
+    ConstImageView(const uint8_t *data, int width, int height, ptrdiff_t stride, PixelFormat format)
+        : data(data), width(width), height(height), stride(stride), format(format) {}
+    ConstImageView(const ImageView &view)
+        : data(view.data), width(view.width), height(view.height), stride(view.stride), format(view.format) {}
+
+    const uint8_t *row(int y) const { return data + y * stride; }
+};
+
+// True when the view points at memory large enough for its geometry.
+inline bool isValid(const ConstImageView &view) {
+    return view.data && view.width > 0 && view.height > 0 &&
+           view.stride >= static_cast<ptrdiff_t>(view.width) * bytesPerPixel(view.format);
+}
+
+} // namespace i2p
@@ -0,0 +1,138 @@
+/* C interface to libimage2pixel.
+ *
+ * Every function works on caller-owned, strided buffers, so other processes
+ * and languages in the pipeline can pixelate in place with no copies. Only
+ * i2p_encode_jpeg allocates, and its output is released with i2p_free.
+ */
+#ifndef IMAGE2PIXEL_H
+#define IMAGE2PIXEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum i2p_pixel_format {
+    I2P_FORMAT_ARGB32 = 0,      /* native-endian 0xAARRGGBB words */
+    I2P_FORMAT_RGBA8888 = 1,    /* bytes R, G, B, A */
+    I2P_FORMAT_RGB888 = 2,      /* bytes R, G, B */
+    I2P_FORMAT_GRAY8 = 3        /* one byte */
+} i2p_pixel_format;
+
+typedef enum i2p_status {
+    I2P_OK = 0,
+    I2P_ERROR_INVALID_ARGUMENT = 1,
+    I2P_ERROR_OUT_OF_MEMORY = 2
+} i2p_status;
+
+typedef enum i2p_sampling {
+    I2P_SAMPLING_MEAN = 0,         /* per-channel mean of the sRGB values */
+    I2P_SAMPLING_OKLAB = 1,        /* mean in the Oklab perceptual space */
+    I2P_SAMPLING_DOMINANT = 2,     /* mean of the most frequent colour */
+    I2P_SAMPLING_MEDIAN = 3,       /* per-channel median */
+    I2P_SAMPLING_TRIMMED_MEAN = 4  /* per-channel mean of the middle half */
+} i2p_sampling;
+
+typedef enum i2p_shape {
+    I2P_SHAPE_SQUARE = 0,
+    I2P_SHAPE_HEXAGON = 1,      /* pointy-top, alternate rows offset by half a cell */
+    I2P_SHAPE_TRIANGLE = 2,     /* alternating up and down triangles */
+    I2P_SHAPE_DOT = 3           /* a disc per block on black; block_size is the cell width */
+} i2p_shape;
+
+typedef enum i2p_mode {
+    I2P_MODE_GRID = 0,          /* uniform blocks, as i2p_pixelate */
+    I2P_MODE_ADAPTIVE = 1,      /* quadtree blocks; block_size is the smallest */
+    I2P_MODE_TARGET = 2         /* exactly grid_columns x grid_rows fractional cells */
+} i2p_mode;
+
+typedef enum i2p_quantize {
+    I2P_QUANTIZE_MEDIAN_CUT = 0,
+    I2P_QUANTIZE_KMEANS = 1     /* median cut refined by k-means */
+} i2p_quantize;
+
+typedef enum i2p_color_metric {
+    I2P_METRIC_RGB = 0,
+    I2P_METRIC_WEIGHTED = 1     /* 2:4:3 weighted RGB distance */
+} i2p_color_metric;
+
+typedef enum i2p_dither {
+    I2P_DITHER_NONE = 0,
+    I2P_DITHER_BAYER2 = 1,
+    I2P_DITHER_BAYER4 = 2,
+    I2P_DITHER_BAYER8 = 3,
+    I2P_DITHER_FLOYD_STEINBERG = 4,
+    I2P_DITHER_ATKINSON = 5
+} i2p_dither;
+
+typedef struct i2p_image {
+    void *data;
+    int32_t width;
+    int32_t height;
+    ptrdiff_t stride;           /* bytes between row starts */
+    i2p_pixel_format format;
+} i2p_image;
+
+/* Always initialise with i2p_params_init: struct_size lets newer libraries
+ * accept parameter blocks from older callers. */
+typedef struct i2p_params {
+    uint32_t struct_size;
+    int32_t block_size;         /* 1..100 */
+    int32_t phase_x;            /* grid offset in pixels */
+    int32_t phase_y;
+    int32_t threads;            /* 0 = all hardware threads */
+    int32_t sampling;           /* i2p_sampling */
+    int32_t shape;              /* i2p_shape; other shapes always take the mean */
+    double angle;               /* grid rotation in degrees, clockwise; square cells only */
+} i2p_params;
+
+/* Everything beyond the block grid, for i2p_render. Always initialise with
+ * i2p_render_params_init; struct_size versions it like i2p_params. */
+typedef struct i2p_render_params {
+    uint32_t struct_size;
+    int32_t mode;               /* i2p_mode */
+    int32_t max_block_size;     /* adaptive: largest block, 2..128 */
+    int32_t tolerance;          /* adaptive: colour deviation a block may keep, 0..255 */
+    int32_t grid_columns;       /* target: cells across and down, at least 1 */
+    int32_t grid_rows;
+    int32_t colors;             /* reduce to this many colours fitted to the blocks, 0 = off, up to 256 */
+    int32_t quantize;           /* i2p_quantize */
+    const uint8_t *palette;     /* fixed palette as R, G, B byte triples, or NULL; not with colors */
+    int32_t palette_size;       /* entries in palette, 1..256 */
+    int32_t palette_metric;     /* i2p_color_metric */
+    int32_t dither;             /* i2p_dither; needs colors or a palette, not in adaptive mode */
+} i2p_render_params;
+
+I2P_API const char *i2p_version(void);
+
+I2P_API void i2p_params_init(i2p_params *params);
+
+I2P_API void i2p_render_params_init(i2p_render_params *params);
+
+/* Pixelates src into dst. Both must share size and format; dst may equal src. */
+I2P_API i2p_status i2p_pixelate(const i2p_image *src, const i2p_image *dst, const i2p_params *params);
+
+/* i2p_pixelate followed by the chosen mode, palette and dithering stages, as
+ * the bundled tools run them. render may be NULL for a plain grid. A fixed
+ * palette's lookup table is rebuilt on every call. */
+I2P_API i2p_status i2p_render(const i2p_image *src, const i2p_image *dst, const i2p_params *params,
+                              const i2p_render_params *render);
+
+/* Encodes image as baseline JPEG. With upright square cells of block_size > 1,
+ * 8x8 units that fall inside one grid cell are written as DC-only blocks. grid
+ * may be NULL.
+ * On success *out points to *out_size bytes owned by the caller. */
+I2P_API i2p_status i2p_encode_jpeg(const i2p_image *image, int32_t quality, const i2p_params *grid,
+                                   uint8_t **out, size_t *out_size);
+
+I2P_API void i2p_free(void *pointer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IMAGE2PIXEL_H */
@@ -0,0 +1,450 @@
+#include "jpeg_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+const uint8_t kZigZag[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// ITU T.81 Annex K tables, natural (row-major) order.
+const uint8_t kLumaQuant[64] = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+const uint8_t kChromaQuant[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+const uint8_t kDcLumaBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+const uint8_t kDcChromaBits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+const uint8_t kDcValues[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+const uint8_t kAcLumaBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+const uint8_t kAcLumaValues[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+const uint8_t kAcChromaBits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+const uint8_t kAcChromaValues[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+struct HuffmanTable {
+    uint16_t code[256] = {};
+    uint8_t size[256] = {};
+
+    HuffmanTable(const uint8_t *bits, const uint8_t *values) {
+        int k = 0;
+        uint16_t next = 0;
+        for (int len = 1; len <= 16; ++len) {
+            for (int i = 0; i < bits[len - 1]; ++i, ++k) {
+                code[values[k]] = next++;
+                size[values[k]] = static_cast<uint8_t>(len);
+            }
+            next <<= 1;
+        }
+    }
+};
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t> &out) : out(out) {}
+
+    void put(uint32_t bits, int count) {
+        buffer = (buffer << count) | (bits & ((1u << count) - 1));
+        filled += count;
+        while (filled >= 8) {
+            uint8_t byte = static_cast<uint8_t>(buffer >> (filled - 8));
+            out.push_back(byte);
+            if (byte == 0xFF) out.push_back(0x00); // byte stuffing
+            filled -= 8;
+        }
+    }
+
+    void flush() {
+        if (filled > 0) put(0x7F, 8 - filled); // pad with 1-bits
+    }
+
+private:
+    std::vector<uint8_t> &out;
+    uint32_t buffer = 0;
+    int filled = 0;
+};
+
+struct Component {
+    const uint8_t *quant;         // zigzag order, already scaled for quality
+    const float *reciprocal;      // zigzag order, 1 / (quant * DCT output scale), see forwardDct()
+    const HuffmanTable *dc;
+    const HuffmanTable *ac;
+    int previousDc = 0;
+};
+
+void scaleQuantTable(const uint8_t *base, int quality, uint8_t *zigzagOut) {
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int i = 0; i < 64; ++i) {
+        int q = (base[kZigZag[i]] * scale + 50) / 100;
+        zigzagOut[i] = static_cast<uint8_t>(std::clamp(q, 1, 255));
+    }
+}
+
+void putMarker(std::vector<uint8_t> &out, uint8_t marker) {
+    out.push_back(0xFF);
+    out.push_back(marker);
+}
+
+void putWord(std::vector<uint8_t> &out, int value) {
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value & 0xFF));
+}
+
+void putHuffmanSegment(std::vector<uint8_t> &out, int tableClassAndId,
+                       const uint8_t *bits, const uint8_t *values, int valueCount) {
+    putMarker(out, 0xC4);
+    putWord(out, 2 + 1 + 16 + valueCount);
+    out.push_back(static_cast<uint8_t>(tableClassAndId));
+    out.insert(out.end(), bits, bits + 16);
+    out.insert(out.end(), values, values + valueCount);
+}
+
+int bitLength(int value) {
+    int magnitude = value < 0 ? -value : value;
+    int length = 0;
+    while (magnitude) {
+        ++length;
+        magnitude >>= 1;
+    }
+    return length;
+}
+
+void encodeValue(BitWriter &writer, int value, int length) {
+    // Negative values are sent as the one's complement of their magnitude.
+    writer.put(static_cast<uint32_t>(value < 0 ? value - 1 : value), length);
+}
+
+// Emits one quantized block (zigzag order). A block whose AC terms are all
+// zero costs a DC code plus a single EOB.
+void encodeBlock(BitWriter &writer, Component &component, const int *coefficients) {
+    int diff = coefficients[0] - component.previousDc;
+    component.previousDc = coefficients[0];
+
+    int length = bitLength(diff);
+    writer.put(component.dc->code[length], component.dc->size[length]);
+    if (length) encodeValue(writer, diff, length);
+
+    int lastNonZero = 63;
+    while (lastNonZero > 0 && coefficients[lastNonZero] == 0) --lastNonZero;
+
+    int run = 0;
+    for (int i = 1; i <= lastNonZero; ++i) {
+        if (coefficients[i] == 0) {
+            ++run;
+            continue;
+        }
+        while (run >= 16) {
+            writer.put(component.ac->code[0xF0], component.ac->size[0xF0]);
+            run -= 16;
+        }
+        length = bitLength(coefficients[i]);
+        int symbol = (run << 4) | length;
+        writer.put(component.ac->code[symbol], component.ac->size[symbol]);
+        encodeValue(writer, coefficients[i], length);
+        run = 0;
+    }
+    if (lastNonZero < 63) writer.put(component.ac->code[0x00], component.ac->size[0x00]);
+}
+
+int quantize(float coefficient, int q) {
+    float v = coefficient / static_cast<float>(q);
+    return static_cast<int>(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+// Rounds half away from zero like quantize(), without a branch on the sign.
+inline int quantizeScaled(float coefficient, float reciprocal) {
+    const float v = coefficient * reciprocal;
+    return static_cast<int>(v + std::copysign(0.5f, v));
+}
+
+// forwardDct() leaves coefficient (u, v) multiplied by
+// 8 * kAanScale[u] * kAanScale[v]; the quantiser divides that out along with
+// the quantisation step, so the transform needs no multiply per output.
+void scaleReciprocals(const uint8_t *zigzagQuant, float *zigzagOut) {
+    const double pi = 3.14159265358979323846;
+    double aanScale[8];
+    aanScale[0] = 1.0;
+    for (int k = 1; k < 8; ++k) aanScale[k] = std::cos(k * pi / 16.0) * std::sqrt(2.0);
+    for (int i = 0; i < 64; ++i) {
+        const int u = kZigZag[i] % 8;
+        const int v = kZigZag[i] / 8;
+        zigzagOut[i] = static_cast<float>(1.0 / (zigzagQuant[i] * aanScale[u] * aanScale[v] * 8.0));
+    }
+}
+
+// One 8-point pass of the Arai-Agui-Nakajima DCT: 5 multiplies and 29 adds,
+// outputs scaled as described above.
+inline void dct8(float *d, int step) {
+    const float tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+    const float tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+    const float tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+    const float tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+    // Even part.
+    const float tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+    const float tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+    d[0] = tmp10 + tmp11;
+    d[4 * step] = tmp10 - tmp11;
+    const float z1 = (tmp12 + tmp13) * 0.707106781f;
+    d[2 * step] = tmp13 + z1;
+    d[6 * step] = tmp13 - z1;
+
+    // Odd part.
+    const float odd10 = tmp4 + tmp5, odd11 = tmp5 + tmp6, odd12 = tmp6 + tmp7;
+    const float z5 = (odd10 - odd12) * 0.382683433f;
+    const float z2 = 0.541196100f * odd10 + z5;
+    const float z4 = 1.306562965f * odd12 + z5;
+    const float z3 = odd11 * 0.707106781f;
+    const float z11 = tmp7 + z3, z13 = tmp7 - z3;
+    d[5 * step] = z13 + z2;
+    d[3 * step] = z13 - z2;
+    d[step] = z11 + z4;
+    d[7 * step] = z11 - z4;
+}
+
+// Separable forward DCT in place, natural order: rows, then columns.
+void forwardDct(float *block) {
+    for (int y = 0; y < 8; ++y) dct8(block + y * 8, 1);
+    for (int x = 0; x < 8; ++x) dct8(block + x, 8);
+}
+
+inline void toYCbCr(const uint8_t *pixel, PixelFormat format, float &y, float &cb, float &cr) {
+    float r, g, b;
+    switch (format) {
+        case PixelFormat::Argb32: {
+            uint32_t argb;
+            std::memcpy(&argb, pixel, 4);
+            r = static_cast<float>((argb >> 16) & 0xFF);
+            g = static_cast<float>((argb >> 8) & 0xFF);
+            b = static_cast<float>(argb & 0xFF);
+            break;
+        }
+        case PixelFormat::Gray8:
+            r = g = b = pixel[0];
+            break;
+        default:
+            r = pixel[0];
+            g = pixel[1];
+            b = pixel[2];
+            break;
+    }
+    y = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+    cb = -0.168736f * r - 0.331264f * g + 0.5f * b;
+    cr = 0.5f * r - 0.418688f * g - 0.081312f * b;
+}
+
+inline int floorDiv(int a, int b) {
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+inline const uint8_t *pixelAt(const ConstImageView &image, int x, int y) {
+    return image.row(y) + x * bytesPerPixel(image.format);
+}
+
+// Converts the 8x8 unit at (x0, y0) into Y, Cb and Cr samples, repeating
+// the last column and row past the image edge. The format is a template
+// argument so the conversion's switch folds away.
+template <PixelFormat Format>
+void loadUnitAs(const ConstImageView &image, int x0, int y0, float (*samples)[64]) {
+    const int channels = bytesPerPixel(Format);
+    int offsets[8];
+    for (int bx = 0; bx < 8; ++bx) offsets[bx] = std::min(x0 + bx, image.width - 1) * channels;
+    for (int by = 0; by < 8; ++by) {
+        const uint8_t *row = image.row(std::min(y0 + by, image.height - 1));
+        for (int bx = 0; bx < 8; ++bx) {
+            const int i = by * 8 + bx;
+            toYCbCr(row + offsets[bx], Format, samples[0][i], samples[1][i], samples[2][i]);
+        }
+    }
+}
+
+void loadUnit(const ConstImageView &image, int x0, int y0, float (*samples)[64]) {
+    switch (image.format) {
+        case PixelFormat::Argb32: loadUnitAs<PixelFormat::Argb32>(image, x0, y0, samples); break;
+        case PixelFormat::Rgba8888: loadUnitAs<PixelFormat::Rgba8888>(image, x0, y0, samples); break;
+        case PixelFormat::Rgb888: loadUnitAs<PixelFormat::Rgb888>(image, x0, y0, samples); break;
+        case PixelFormat::Gray8: loadUnitAs<PixelFormat::Gray8>(image, x0, y0, samples); break;
+    }
+}
+
+} // namespace
+
+int alignPhaseToMcu(int blockSize, int phase) {
+    if (blockSize <= 1) return 0;
+    phase %= blockSize;
+    if (blockSize % 8 == 0) return phase - phase % 8;
+    if (8 % blockSize == 0) return 0;
+    return phase;
+}
+
+bool canAlignToMcu(int blockSize) {
+    return blockSize > 1 && (blockSize % 8 == 0 || 8 % blockSize == 0);
+}
+
+bool encodeJpeg(const ConstImageView &image, const JpegOptions &options, std::vector<uint8_t> &out) {
+    if (!isValid(image) || image.width > 65535 || image.height > 65535) return false;
+    I2P_TRACE_SPAN("jpeg.encode");
+    const int width = image.width;
+    const int height = image.height;
+
+    int quality = std::clamp(options.quality, 1, 100);
+    uint8_t lumaQuant[64], chromaQuant[64];
+    scaleQuantTable(kLumaQuant, quality, lumaQuant);
+    scaleQuantTable(kChromaQuant, quality, chromaQuant);
+    float lumaReciprocal[64], chromaReciprocal[64];
+    scaleReciprocals(lumaQuant, lumaReciprocal);
+    scaleReciprocals(chromaQuant, chromaReciprocal);
+
+    out.clear();
+    out.reserve(static_cast<size_t>(width) * height / 4 + 1024);
+
+    // SOI + JFIF APP0
+    putMarker(out, 0xD8);
+    putMarker(out, 0xE0);
+    putWord(out, 16);
+    const uint8_t jfif[] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    out.insert(out.end(), jfif, jfif + sizeof(jfif));
+
+    // DQT
+    putMarker(out, 0xDB);
+    putWord(out, 2 + 2 * 65);
+    out.push_back(0);
+    out.insert(out.end(), lumaQuant, lumaQuant + 64);
+    out.push_back(1);
+    out.insert(out.end(), chromaQuant, chromaQuant + 64);
+
+    // SOF0: 8-bit, three components, no subsampling
+    putMarker(out, 0xC0);
+    putWord(out, 8 + 3 * 3);
+    out.push_back(8);
+    putWord(out, height);
+    putWord(out, width);
+    out.push_back(3);
+    const uint8_t components[] = {1, 0x11, 0, 2, 0x11, 1, 3, 0x11, 1};
+    out.insert(out.end(), components, components + sizeof(components));
+
+    // DHT
+    putHuffmanSegment(out, 0x00, kDcLumaBits, kDcValues, 12);
+    putHuffmanSegment(out, 0x10, kAcLumaBits, kAcLumaValues, 162);
+    putHuffmanSegment(out, 0x01, kDcChromaBits, kDcValues, 12);
+    putHuffmanSegment(out, 0x11, kAcChromaBits, kAcChromaValues, 162);
+
+    // SOS
+    putMarker(out, 0xDA);
+    putWord(out, 6 + 2 * 3);
+    out.push_back(3);
+    const uint8_t scan[] = {1, 0x00, 2, 0x11, 3, 0x11};
+    out.insert(out.end(), scan, scan + sizeof(scan));
+    out.push_back(0);
+    out.push_back(63);
+    out.push_back(0);
+
+    static const HuffmanTable dcLuma(kDcLumaBits, kDcValues);
+    static const HuffmanTable acLuma(kAcLumaBits, kAcLumaValues);
+    static const HuffmanTable dcChroma(kDcChromaBits, kDcValues);
+    static const HuffmanTable acChroma(kAcChromaBits, kAcChromaValues);
+    Component planes[3] = {
+        {lumaQuant, lumaReciprocal, &dcLuma, &acLuma},
+        {chromaQuant, chromaReciprocal, &dcChroma, &acChroma},
+        {chromaQuant, chromaReciprocal, &dcChroma, &acChroma}
+    };
+
+    const GridGeometry &grid = options.grid;
+    const bool useGrid = grid.blockSize > 1;
+
+    BitWriter writer(out);
+    float samples[3][64];
+    int coefficients[64];
+
+    for (int y0 = 0; y0 < height; y0 += 8) {
+        int y1 = std::min(y0 + 7, height - 1);
+        bool flatRows = useGrid &&
+            floorDiv(y0 - grid.phaseY, grid.blockSize) == floorDiv(y1 - grid.phaseY, grid.blockSize);
+
+        for (int x0 = 0; x0 < width; x0 += 8) {
+            int x1 = std::min(x0 + 7, width - 1);
+            bool flat = flatRows &&
+                floorDiv(x0 - grid.phaseX, grid.blockSize) == floorDiv(x1 - grid.phaseX, grid.blockSize);
+
+            if (flat) {
+                // The whole unit lies in one grid cell, so the transform of the
+                // constant block is just DC = 8 * sample; no DCT needed.
+                float level[3];
+                toYCbCr(pixelAt(image, x0, y0), image.format, level[0], level[1], level[2]);
+                for (int c = 0; c < 3; ++c) {
+                    std::fill(coefficients, coefficients + 64, 0);
+                    coefficients[0] = quantize(8.0f * level[c], planes[c].quant[0]);
+                    encodeBlock(writer, planes[c], coefficients);
+                }
+                continue;
+            }
+
+            loadUnit(image, x0, y0, samples);
+            for (int c = 0; c < 3; ++c) {
+                forwardDct(samples[c]);
+                for (int i = 0; i < 64; ++i) {
+                    coefficients[i] = quantizeScaled(samples[c][kZigZag[i]], planes[c].reciprocal[i]);
+                }
+                encodeBlock(writer, planes[c], coefficients);
+            }
+        }
+    }
+
+    writer.flush();
+    putMarker(out, 0xD9);
+    return true;
+}
+
+} // namespace i2p
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "export.h"
+#include "image.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+struct JpegOptions {
+    int quality = 75;       // 1..100, same scale as libjpeg / QImage::save
+    GridGeometry grid;      // used to emit DC-only blocks for flat 8x8 units
+};
+
+// Snaps a grid phase so that block edges coincide with the 8x8 MCU grid.
+// Block sizes that are multiples of 8 keep the phase in steps of 8, block
+// sizes that divide 8 must start at the origin, and anything else cannot be
+// aligned, so the phase is returned unchanged.
+I2P_API int alignPhaseToMcu(int blockSize, int phase);
+
+// True when alignPhaseToMcu() can line the grid up with the MCUs, i.e. the
+// block size is a multiple or a divisor of 8.
+I2P_API bool canAlignToMcu(int blockSize);
+
+// Encodes an image of any PixelFormat as baseline 4:4:4 JFIF. Alpha is dropped. Every 8x8 unit that lies inside a single grid cell is emitted as a
+// DC-only block straight from the cell colour; only units that straddle a
+// block edge go through the forward DCT.
+I2P_API bool encodeJpeg(const ConstImageView &image, const JpegOptions &options, std::vector<uint8_t> &out);
+
+} // namespace i2p
@@ -0,0 +1,518 @@
+#include "mosaic.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define I2P_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace i2p {
+
+namespace {
+
+// Pixels [x0, x1) of one row of the repeating tile that belong to the same
+// cell. The cell is given relative to the tile's first cell, so it may be
+// one of a neighbouring tile (negative, or past columnsPerTile/rowsPerTile).
+struct CellRun {
+    int x0;
+    int x1;
+    int column;
+    int row;
+    bool gap;   // Dot: outside the disc; averaged into the cell, painted with the background
+};
+
+// The tiling for one (shape, size). Every pixel of a single tile is
+// classified once, geometrically; images are then covered by repeating the
+// tile's runs, so averaging and filling never test a pixel against a shape.
+struct CellMap {
+    int periodX = 1;
+    int periodY = 1;
+    int columnsPerTile = 1;
+    int rowsPerTile = 1;
+    int minColumn = 0;
+    int maxColumn = 0;
+    int minRow = 0;
+    int maxRow = 0;
+    std::vector<CellRun> runs;
+    std::vector<int> rowStart;          // runs of tile row y are [rowStart[y], rowStart[y + 1])
+    std::vector<CellRun> sumRuns;       // the runs with gaps merged, for averaging
+    std::vector<int> sumRowStart;
+    std::vector<uint8_t> sameAsAbove;   // tile row y has the runs of row y - 1
+    std::vector<int> rowMin;            // smallest and largest run.row in each tile row
+    std::vector<int> rowMax;
+};
+
+struct CellHit {
+    int column = 0;
+    int row = 0;
+    bool gap = false;
+};
+
+// Hexagon and triangle rows are sqrt(3)/2 cell widths apart, which makes
+// the cells regular up to rounding.
+int rowHeight(int size) {
+    return std::max(1, static_cast<int>(std::lround(size * std::sqrt(3.0) / 2)));
+}
+
+CellHit classify(BlockShape shape, int size, int x, int y) {
+    const int h = rowHeight(size);
+    const double px = x + 0.5;
+    const double py = y + 0.5;
+    CellHit hit;
+    if (shape == BlockShape::Hexagon) {
+        // Nearest centre; odd rows are offset by half a cell.
+        double best = 0;
+        for (int row = -1; row <= 2; ++row) {
+            for (int column = -1; column <= 1; ++column) {
+                const double dx = px - (column + 0.5 + 0.5 * (row & 1)) * size;
+                const double dy = py - (row + 0.5) * h;
+                const double d = dx * dx + dy * dy;
+                if ((row == -1 && column == -1) || d < best) {
+                    best = d;
+                    hit.column = column;
+                    hit.row = row;
+                }
+            }
+        }
+    } else if (shape == BlockShape::Triangle) {
+        // Up triangles are centred on the tile, down triangles on its left
+        // and right edges; `width` is the up triangle's width at this
+        // height, mirrored in odd rows.
+        hit.row = y / h;
+        double width = ((y % h) + 0.5) / h;
+        if (hit.row & 1) width = 1 - width;
+        const double s = px / size - 0.5;
+        hit.column = std::fabs(s) <= width / 2 ? 1 : s < 0 ? 0 : 2;
+    } else {
+        const double r = size / 2.0;
+        hit.gap = (px - r) * (px - r) + (py - r) * (py - r) > r * r;
+    }
+    return hit;
+}
+
+CellMap buildCellMap(BlockShape shape, int size) {
+    CellMap map;
+    const int h = rowHeight(size);
+    map.periodX = size;
+    map.periodY = size;
+    if (shape == BlockShape::Hexagon || shape == BlockShape::Triangle) {
+        map.periodY = 2 * h;
+        map.columnsPerTile = shape == BlockShape::Triangle ? 2 : 1;
+        map.rowsPerTile = 2;
+    }
+
+    map.rowStart.push_back(0);
+    for (int y = 0; y < map.periodY; ++y) {
+        for (int x = 0; x < map.periodX; ++x) {
+            const CellHit hit = classify(shape, size, x, y);
+            if (x > 0) {
+                CellRun &last = map.runs.back();
+                if (last.column == hit.column && last.row == hit.row && last.gap == hit.gap) {
+                    last.x1 = x + 1;
+                    continue;
+                }
+            }
+            map.runs.push_back({x, x + 1, hit.column, hit.row, hit.gap});
+        }
+        map.rowStart.push_back(static_cast<int>(map.runs.size()));
+    }
+
+    map.sumRowStart.push_back(0);
+    for (int y = 0; y < map.periodY; ++y) {
+        for (int i = map.rowStart[y]; i < map.rowStart[y + 1]; ++i) {
+            CellRun run = map.runs[i];
+            run.gap = false;
+            if (i > map.rowStart[y] && map.sumRuns.back().column == run.column && map.sumRuns.back().row == run.row) {
+                map.sumRuns.back().x1 = run.x1;
+            } else {
+                map.sumRuns.push_back(run);
+            }
+        }
+        map.sumRowStart.push_back(static_cast<int>(map.sumRuns.size()));
+    }
+
+    map.minColumn = map.maxColumn = map.runs.front().column;
+    map.minRow = map.maxRow = map.runs.front().row;
+    map.sameAsAbove.assign(map.periodY, 0);
+    map.rowMin.resize(map.periodY);
+    map.rowMax.resize(map.periodY);
+    for (int y = 0; y < map.periodY; ++y) {
+        const int begin = map.rowStart[y];
+        const int end = map.rowStart[y + 1];
+        map.rowMin[y] = map.rowMax[y] = map.runs[begin].row;
+        for (int i = begin; i < end; ++i) {
+            const CellRun &run = map.runs[i];
+            map.rowMin[y] = std::min(map.rowMin[y], run.row);
+            map.rowMax[y] = std::max(map.rowMax[y], run.row);
+            map.minColumn = std::min(map.minColumn, run.column);
+            map.maxColumn = std::max(map.maxColumn, run.column);
+        }
+        map.minRow = std::min(map.minRow, map.rowMin[y]);
+        map.maxRow = std::max(map.maxRow, map.rowMax[y]);
+        if (y > 0 && end - begin == begin - map.rowStart[y - 1]) {
+            bool same = true;
+            for (int i = begin; i < end && same; ++i) {
+                const CellRun &a = map.runs[i];
+                const CellRun &b = map.runs[i - (end - begin)];
+                same = a.x0 == b.x0 && a.x1 == b.x1 && a.column == b.column && a.row == b.row && a.gap == b.gap;
+            }
+            map.sameAsAbove[y] = same;
+        }
+    }
+    return map;
+}
+
+// Maps are shared between calls and threads; a GUI session only ever sees
+// a handful of (shape, size) pairs.
+struct CellMapCache {
+    std::mutex mutex;
+    std::map<std::pair<int, int>, std::shared_ptr<const CellMap>> maps;
+};
+
+CellMapCache &cellMapCache() {
+    static CellMapCache cache;
+    return cache;
+}
+
+std::shared_ptr<const CellMap> cellMap(BlockShape shape, int size) {
+    CellMapCache &cache = cellMapCache();
+    const std::pair<int, int> key(static_cast<int>(shape), size);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    std::shared_ptr<const CellMap> &map = cache.maps[key];
+    if (!map) map = std::make_shared<const CellMap>(buildCellMap(shape, size));
+    return map;
+}
+
+// The tiles covering one image and the lattice their cells form.
+struct Layout {
+    std::shared_ptr<const CellMap> map;
+    int shiftX = 0;     // image x of tile column 0 is -shiftX
+    int shiftY = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    int firstFull = 0;  // tile columns [firstFull, lastFull) lie wholly inside the image
+    int lastFull = 0;
+    int columns = 0;
+    int rows = 0;
+
+    int column(int tileX, const CellRun &run) const {
+        return tileX * map->columnsPerTile + run.column - map->minColumn;
+    }
+    int row(int tileY, int runRow) const { return tileY * map->rowsPerTile + runRow - map->minRow; }
+};
+
+// The grid phase moves the tiling right and down, as it moves the block
+// grid in pixelate().
+int tileShift(int phase, int period) {
+    return (period - std::max(phase, 0) % period) % period;
+}
+
+bool makeLayout(int width, int height, const GridGeometry &grid, BlockShape shape, Layout &layout) {
+    if (width < 1 || height < 1 || grid.blockSize < 2 || shape == BlockShape::Square) return false;
+
+    layout.map = cellMap(shape, grid.blockSize);
+    const CellMap &map = *layout.map;
+    layout.shiftX = tileShift(grid.phaseX, map.periodX);
+    layout.shiftY = tileShift(grid.phaseY, map.periodY);
+    layout.tilesX = (width + layout.shiftX + map.periodX - 1) / map.periodX;
+    layout.tilesY = (height + layout.shiftY + map.periodY - 1) / map.periodY;
+    layout.firstFull = layout.shiftX ? 1 : 0;
+    layout.lastFull = std::max((width + layout.shiftX) / map.periodX, layout.firstFull);
+    layout.columns = (layout.tilesX - 1) * map.columnsPerTile + map.maxColumn - map.minColumn + 1;
+    layout.rows = (layout.tilesY - 1) * map.rowsPerTile + map.maxRow - map.minRow + 1;
+    return true;
+}
+
+// Adds `count` pixels to the channel sums at `sum`.
+template <int Channels>
+inline void addPixels(const uint8_t *p, int count, uint32_t *sum) {
+#ifdef I2P_HAVE_SSE2
+    if (Channels == 4) {
+        // One pixel per step, widened to four 32-bit lanes.
+        const __m128i zero = _mm_setzero_si128();
+        __m128i total = _mm_setzero_si128();
+        for (int i = 0; i < count; ++i, p += 4) {
+            int32_t pixel;
+            std::memcpy(&pixel, p, 4);
+            const __m128i bytes = _mm_cvtsi32_si128(pixel);
+            total = _mm_add_epi32(total, _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+        }
+        __m128i *cell = reinterpret_cast<__m128i *>(sum);
+        _mm_storeu_si128(cell, _mm_add_epi32(_mm_loadu_si128(cell), total));
+        return;
+    }
+#endif
+    uint32_t local[Channels] = {};
+    for (int i = 0; i < count; ++i, p += Channels) {
+        for (int c = 0; c < Channels; ++c) local[c] += p[c];
+    }
+    for (int c = 0; c < Channels; ++c) sum[c] += local[c];
+}
+
+// Lattice rows [firstRow, lastRow). Only the image rows that reach these
+// cells are scanned. For each, the runs of its tile row are resolved to cell
+// sums once, for tile 0; every further tile is the same runs moved by a
+// constant pixel and cell offset, and only the edge tiles need clipping.
+// Per pixel that leaves one add per channel into a register.
+template <int Channels>
+void averageMosaicRows(const ConstImageView &src, const ImageView &cells, const Layout &layout,
+                       const std::vector<int> &rowFirst, const std::vector<int> &rowLast, std::vector<uint8_t> &filled,
+                       int firstRow, int lastRow) {
+    struct Span {
+        int x0;
+        int x1;
+        uint32_t *cell;
+    };
+
+    const CellMap &map = *layout.map;
+    constexpr int Stride = Channels + 1;   // channel sums, then the pixel count
+    std::vector<uint32_t> sums(static_cast<size_t>(lastRow - firstRow) * layout.columns * Stride, 0);
+    std::vector<Span> spans;
+    const size_t tileStep = static_cast<size_t>(map.columnsPerTile) * Stride;
+
+    int yFirst = src.height;
+    int yLast = -1;
+    for (int r = firstRow; r < lastRow; ++r) {
+        yFirst = std::min(yFirst, rowFirst[r]);
+        yLast = std::max(yLast, rowLast[r]);
+    }
+
+    for (int y = yFirst; y <= yLast; ++y) {
+        const int tileY = (y + layout.shiftY) / map.periodY;
+        const int ty = (y + layout.shiftY) % map.periodY;
+        spans.clear();
+        for (int i = map.sumRowStart[ty]; i < map.sumRowStart[ty + 1]; ++i) {
+            const CellRun &run = map.sumRuns[i];
+            const int row = layout.row(tileY, run.row);
+            if (row < firstRow || row >= lastRow) continue;
+            uint32_t *cell = &sums[(static_cast<size_t>(row - firstRow) * layout.columns + layout.column(0, run)) *
+                                   Stride];
+            spans.push_back({run.x0 - layout.shiftX, run.x1 - layout.shiftX, cell});
+        }
+        if (spans.empty()) continue;
+
+        const uint8_t *line = src.row(y);
+        auto addTile = [&](int tileX, bool clip) {
+            const int originX = tileX * map.periodX;
+            const size_t offset = tileX * tileStep;
+            for (const Span &span : spans) {
+                int x0 = originX + span.x0;
+                int x1 = originX + span.x1;
+                if (clip) {
+                    x0 = std::max(x0, 0);
+                    x1 = std::min(x1, src.width);
+                    if (x0 >= x1) continue;
+                }
+                uint32_t *cell = span.cell + offset;
+                addPixels<Channels>(line + x0 * Channels, x1 - x0, cell);
+                cell[Channels] += static_cast<uint32_t>(x1 - x0);
+            }
+        };
+        for (int tileX = 0; tileX < layout.firstFull; ++tileX) addTile(tileX, true);
+        for (int tileX = layout.firstFull; tileX < layout.lastFull; ++tileX) addTile(tileX, false);
+        for (int tileX = layout.lastFull; tileX < layout.tilesX; ++tileX) addTile(tileX, true);
+    }
+
+    const uint32_t *cell = sums.data();
+    for (int r = firstRow; r < lastRow; ++r) {
+        uint8_t *out = cells.row(r);
+        uint8_t *hit = &filled[static_cast<size_t>(r) * layout.columns];
+        for (int i = 0; i < layout.columns; ++i, out += Channels, cell += Stride) {
+            hit[i] = cell[Channels] != 0;
+            if (!hit[i]) continue;
+            for (int c = 0; c < Channels; ++c) out[c] = static_cast<uint8_t>(cell[c] / cell[Channels]);
+        }
+    }
+}
+
+// Image rows [y0, y1), resolved per row like averageMosaicRows(). A row
+// whose tile row repeats the one above is copied from it.
+template <int Channels>
+void fillMosaicRows(const ConstImageView &cells, const ImageView &dst, const Layout &layout, int y0, int y1) {
+    struct Span {
+        int x0;
+        int x1;
+        const uint8_t *color;
+        size_t step;    // per tile; 0 for the background
+    };
+
+    static const uint8_t background[4] = {0, 0, 0, 255};
+    const CellMap &map = *layout.map;
+    const size_t rowBytes = static_cast<size_t>(dst.width) * Channels;
+    const size_t tileStep = static_cast<size_t>(map.columnsPerTile) * Channels;
+    std::vector<Span> spans;
+    for (int y = y0; y < y1; ++y) {
+        const int tileY = (y + layout.shiftY) / map.periodY;
+        const int ty = (y + layout.shiftY) % map.periodY;
+        uint8_t *out = dst.row(y);
+        if (y > y0 && map.sameAsAbove[ty]) {
+            std::memcpy(out, dst.row(y - 1), rowBytes);
+            continue;
+        }
+        spans.clear();
+        for (int i = map.rowStart[ty]; i < map.rowStart[ty + 1]; ++i) {
+            const CellRun &run = map.runs[i];
+            const int x0 = run.x0 - layout.shiftX;
+            const int x1 = run.x1 - layout.shiftX;
+            if (run.gap) {
+                spans.push_back({x0, x1, background, 0});
+            } else {
+                spans.push_back({x0, x1, cells.row(layout.row(tileY, run.row)) + layout.column(0, run) * Channels,
+                                 tileStep});
+            }
+        }
+
+        auto fillTile = [&](int tileX, bool clip) {
+            const int originX = tileX * map.periodX;
+            for (const Span &span : spans) {
+                int x0 = originX + span.x0;
+                int x1 = originX + span.x1;
+                if (clip) {
+                    x0 = std::max(x0, 0);
+                    x1 = std::min(x1, dst.width);
+                }
+                const uint8_t *color = span.color + tileX * span.step;
+                uint8_t *p = out + x0 * Channels;
+                for (int x = x0; x < x1; ++x, p += Channels) std::memcpy(p, color, Channels);
+            }
+        };
+        for (int tileX = 0; tileX < layout.firstFull; ++tileX) fillTile(tileX, true);
+        for (int tileX = layout.firstFull; tileX < layout.lastFull; ++tileX) fillTile(tileX, false);
+        for (int tileX = layout.lastFull; tileX < layout.tilesX; ++tileX) fillTile(tileX, true);
+    }
+}
+
+} // namespace
+
+void fillEmptyCells(const ImageView &cells, const uint8_t *filled) {
+    const int channels = bytesPerPixel(cells.format);
+    const size_t rowBytes = static_cast<size_t>(cells.width) * channels;
+    int source = -1;
+    int firstFilled = -1;
+    for (int r = 0; r < cells.height; ++r) {
+        const uint8_t *hit = &filled[static_cast<size_t>(r) * cells.width];
+        uint8_t *line = cells.row(r);
+        const int first = static_cast<int>(std::find(hit, hit + cells.width, 1) - hit);
+        if (first == cells.width) {
+            if (source >= 0) std::memcpy(line, cells.row(source), rowBytes);
+            continue;
+        }
+        for (int i = 0; i < cells.width; ++i) {
+            if (hit[i]) continue;
+            const int from = i < first ? first : i - 1;
+            std::memcpy(line + i * channels, line + from * channels, channels);
+        }
+        if (firstFilled < 0) firstFilled = r;
+        source = r;
+    }
+    for (int r = 0; r < firstFilled; ++r) std::memcpy(cells.row(r), cells.row(firstFilled), rowBytes);
+}
+
+bool mosaicCellCount(int width, int height, const GridGeometry &grid, BlockShape shape, int &columns, int &rows) {
+    Layout layout;
+    if (!makeLayout(width, height, grid, shape, layout)) return false;
+    columns = layout.columns;
+    rows = layout.rows;
+    return true;
+}
+
+bool averageMosaicCells(const ConstImageView &src, const ImageView &cells, const GridGeometry &grid,
+                        BlockShape shape, int threads) {
+    Layout layout;
+    if (!isValid(src) || !isValid(cells) || src.format != cells.format ||
+        !makeLayout(src.width, src.height, grid, shape, layout) || cells.width != layout.columns ||
+        cells.height != layout.rows) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("mosaic.average");
+    // The image rows reaching each lattice row, so a band of lattice rows
+    // scans only its own part of the image.
+    const CellMap &map = *layout.map;
+    std::vector<int> rowFirst(layout.rows, src.height);
+    std::vector<int> rowLast(layout.rows, -1);
+    for (int y = 0; y < src.height; ++y) {
+        const int tileY = (y + layout.shiftY) / map.periodY;
+        const int ty = (y + layout.shiftY) % map.periodY;
+        for (int r = layout.row(tileY, map.rowMin[ty]); r <= layout.row(tileY, map.rowMax[ty]); ++r) {
+            rowFirst[r] = std::min(rowFirst[r], y);
+            rowLast[r] = y;
+        }
+    }
+
+    std::vector<uint8_t> filled(static_cast<size_t>(layout.columns) * layout.rows);
+    parallelFor(0, layout.rows, threads, [&](int first, int last) {
+        switch (bytesPerPixel(src.format)) {
+            case 1: averageMosaicRows<1>(src, cells, layout, rowFirst, rowLast, filled, first, last); break;
+            case 3: averageMosaicRows<3>(src, cells, layout, rowFirst, rowLast, filled, first, last); break;
+            default: averageMosaicRows<4>(src, cells, layout, rowFirst, rowLast, filled, first, last); break;
+        }
+    });
+    fillEmptyCells(cells, filled.data());
+    return true;
+}
+
+bool fillMosaicCells(const ConstImageView &cells, const ImageView &dst, const GridGeometry &grid, BlockShape shape,
+                     int threads) {
+    Layout layout;
+    if (!isValid(cells) || !isValid(dst) || cells.format != dst.format ||
+        !makeLayout(dst.width, dst.height, grid, shape, layout) || cells.width != layout.columns ||
+        cells.height != layout.rows) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("mosaic.fill");
+    parallelFor(0, dst.height, threads, [&](int first, int last) {
+        switch (bytesPerPixel(dst.format)) {
+            case 1: fillMosaicRows<1>(cells, dst, layout, first, last); break;
+            case 3: fillMosaicRows<3>(cells, dst, layout, first, last); break;
+            default: fillMosaicRows<4>(cells, dst, layout, first, last); break;
+        }
+    });
+    return true;
+}
+
+bool pixelateMosaic(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid, BlockShape shape,
+                    int threads) {
+    int columns = 0;
+    int rows = 0;
+    if (!isValid(src) || !isValid(dst) || src.width != dst.width || src.height != dst.height ||
+        src.format != dst.format || !mosaicCellCount(src.width, src.height, grid, shape, columns, rows)) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("pixelate.mosaic");
+    const int channels = bytesPerPixel(src.format);
+    std::vector<uint8_t> lattice(static_cast<size_t>(columns) * rows * channels);
+    const ImageView cells{lattice.data(), columns, rows, static_cast<ptrdiff_t>(columns) * channels, src.format};
+    // Every cell is averaged before any pixel is written, which keeps
+    // in-place calls correct.
+    return averageMosaicCells(src, cells, grid, shape, threads) && fillMosaicCells(cells, dst, grid, shape, threads);
+}
+
+size_t mosaicCacheBytes() {
+    CellMapCache &cache = cellMapCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    size_t bytes = 0;
+    for (const auto &entry : cache.maps) {
+        const CellMap &map = *entry.second;
+        bytes += sizeof(map) + (map.runs.capacity() + map.sumRuns.capacity()) * sizeof(CellRun) +
+                 (map.rowStart.capacity() + map.sumRowStart.capacity() + map.rowMin.capacity() +
+                  map.rowMax.capacity()) * sizeof(int) +
+                 map.sameAsAbove.capacity();
+    }
+    return bytes;
+}
+
+} // namespace i2p
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+// Mosaics of hexagons, triangles or dots. Cells are laid out on a lattice of
+// `columns` x `rows` indices: a hexagon's neighbours in the next row are the
+// cells at the same and the next column index, a triangle row alternates
+// down and up triangles. The block size is the cell width and the grid phase
+// shifts the tiling, as for square blocks.
+
+// Size of the cell lattice covering a width x height image. Cells on the
+// border may lie partly or wholly outside the image.
+I2P_API bool mosaicCellCount(int width, int height, const GridGeometry &grid, BlockShape shape, int &columns,
+                             int &rows);
+
+// Averages every cell into one pixel of `cells`, which must have the lattice
+// size and src's format. Cells no pixel falls in copy a neighbour, so later
+// stages (palettes, dithering) only ever see image colours.
+I2P_API bool averageMosaicCells(const ConstImageView &src, const ImageView &cells, const GridGeometry &grid,
+                                BlockShape shape, int threads = 0);
+
+// Paints the cells into dst; Dot leaves black, opaque gaps between discs.
+I2P_API bool fillMosaicCells(const ConstImageView &cells, const ImageView &dst, const GridGeometry &grid,
+                             BlockShape shape, int threads = 0);
+
+// Gives every cell whose `filled` flag (one byte per cell, row-major) is 0
+// a colour: the nearest filled cell to its left in the same row, to its
+// right at the start of a row; rows with no filled cell at all copy the
+// nearest filled row above, or below. Also used by the rotated grid.
+I2P_API void fillEmptyCells(const ImageView &cells, const uint8_t *filled);
+
+// averageMosaicCells() followed by fillMosaicCells() through a temporary
+// lattice. Same view rules as pixelate(); called by pixelate() for shapes
+// other than BlockShape::Square.
+I2P_API bool pixelateMosaic(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid,
+                            BlockShape shape, int threads = 0);
+
+// Bytes held by the cell maps cached for every (shape, size) used so far,
+// for memory displays.
+I2P_API size_t mosaicCacheBytes();
+
+} // namespace i2p
@@ -0,0 +1,138 @@
+#include "netpbm_writer.h"
+
+#include <cstring>
+#include <vector>
+
+#include "cli_options.h"
+
+namespace i2p {
+
+namespace {
+
+enum class Layout { Raw, Gray, Rgb, Pam };
+
+Layout layoutFor(const std::string &path) {
+    if (hasExtension(path, "pgm")) return Layout::Gray;
+    if (hasExtension(path, "ppm")) return Layout::Rgb;
+    if (hasExtension(path, "pam")) return Layout::Pam;
+    return Layout::Raw;
+}
+
+// Reads one pixel as R, G, B, A whatever the buffer layout.
+inline void toRgba(const uint8_t *p, PixelFormat format, uint8_t *rgba) {
+    switch (format) {
+        case PixelFormat::Argb32: {
+            uint32_t argb;
+            std::memcpy(&argb, p, 4);
+            rgba[0] = static_cast<uint8_t>(argb >> 16);
+            rgba[1] = static_cast<uint8_t>(argb >> 8);
+            rgba[2] = static_cast<uint8_t>(argb);
+            rgba[3] = static_cast<uint8_t>(argb >> 24);
+            break;
+        }
+        case PixelFormat::Rgba8888:
+            std::memcpy(rgba, p, 4);
+            break;
+        case PixelFormat::Rgb888:
+            std::memcpy(rgba, p, 3);
+            rgba[3] = 255;
+            break;
+        case PixelFormat::Gray8:
+            rgba[0] = rgba[1] = rgba[2] = p[0];
+            rgba[3] = 255;
+            break;
+    }
+}
+
+int pamDepth(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::Gray8:  return 1;
+        case PixelFormat::Rgb888: return 3;
+        default:                  return 4;
+    }
+}
+
+} // namespace
+
+NetpbmWriter::~NetpbmWriter() {
+    close();
+}
+
+bool NetpbmWriter::supports(const std::string &path) {
+    return hasExtension(path, "pgm") || hasExtension(path, "ppm") || hasExtension(path, "pam") ||
+           hasExtension(path, "raw");
+}
+
+bool NetpbmWriter::open(const std::string &path, int width, int height, PixelFormat format) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    failed = false;
+    layout = static_cast<int>(layoutFor(path));
+
+    switch (static_cast<Layout>(layout)) {
+        case Layout::Gray:
+            std::fprintf(file, "P5\n%d %d\n255\n", width, height);
+            break;
+        case Layout::Rgb:
+            std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+            break;
+        case Layout::Pam: {
+            static const char *tupleTypes[] = {"", "GRAYSCALE", "", "RGB", "RGB_ALPHA"};
+            int depth = pamDepth(format);
+            std::fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                         width, height, depth, tupleTypes[depth]);
+            break;
+        }
+        case Layout::Raw:
+            break;
+    }
+    return !std::ferror(file);
+}
+
+bool NetpbmWriter::writeRows(const ConstImageView &rows) {
+    if (!file || failed) return false;
+
+    const Layout kind = static_cast<Layout>(layout);
+    const int bpp = bytesPerPixel(rows.format);
+    const bool passThrough = (kind == Layout::Raw && rows.format != PixelFormat::Argb32) ||
+                             (kind == Layout::Gray && rows.format == PixelFormat::Gray8) ||
+                             (kind == Layout::Rgb && rows.format == PixelFormat::Rgb888) ||
+                             (kind == Layout::Pam && rows.format != PixelFormat::Argb32);
+
+    std::vector<uint8_t> converted;
+    for (int y = 0; y < rows.height; ++y) {
+        const uint8_t *src = rows.row(y);
+        size_t bytes = static_cast<size_t>(rows.width) * bpp;
+        if (!passThrough) {
+            const int depth = kind == Layout::Gray ? 1 : kind == Layout::Rgb ? 3 : bpp;
+            converted.resize(static_cast<size_t>(rows.width) * depth);
+            uint8_t rgba[4];
+            for (int x = 0; x < rows.width; ++x) {
+                toRgba(src + x * bpp, rows.format, rgba);
+                uint8_t *out = &converted[static_cast<size_t>(x) * depth];
+                if (depth == 1) {
+                    out[0] = static_cast<uint8_t>((rgba[0] * 299 + rgba[1] * 587 + rgba[2] * 114) / 1000);
+                } else {
+                    std::memcpy(out, rgba, depth);
+                }
+            }
+            src = converted.data();
+            bytes = converted.size();
+        }
+        if (std::fwrite(src, 1, bytes, file) != bytes) {
+            failed = true;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NetpbmWriter::close() {
+    if (!file) return !failed;
+    bool ok = std::fclose(file) == 0 && !failed;
+    file = nullptr;
+    return ok;
+}
+
+} // namespace i2p
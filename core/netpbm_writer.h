@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "export.h"
+#include "image.h"
+
+namespace i2p {
+
+// Row-streaming writer for formats that need no whole-image pass: netpbm
+// (P5 for Gray8, P6 for Rgb888, P7 RGB_ALPHA for 4-channel formats) and raw
+// bytes. ARGB32 words are written as R, G, B, A in every layout.
+class I2P_API NetpbmWriter {
+public:
+    NetpbmWriter() = default;
+    NetpbmWriter(const NetpbmWriter &) = delete;
+    NetpbmWriter &operator=(const NetpbmWriter &) = delete;
+    ~NetpbmWriter();
+
+    // True for paths this writer can produce (.pgm, .ppm, .pam, .raw).
+    static bool supports(const std::string &path);
+
+    bool open(const std::string &path, int width, int height, PixelFormat format);
+    bool writeRows(const ConstImageView &rows);
+    bool close();
+
+private:
+    FILE *file = nullptr;
+    int layout = 0;
+    bool failed = false;
+};
+
+} // namespace i2p
@@ -0,0 +1,373 @@
+#include "oklab.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define I2P_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+inline int gridStart(int phase, int blockSize) {
+    int offset = phase % blockSize;
+    return offset ? offset - blockSize : 0;
+}
+
+// Oklab as defined by Bjorn Ottosson: linear sRGB to cone responses (LMS),
+// a cube root, then a second matrix to L, a, b. The second step is linear,
+// so averaging the cube-rooted LMS values averages Oklab exactly; the
+// kernel never needs the L, a, b matrices at all.
+constexpr double kLinearToLms[3][3] = {
+    {0.4122214708, 0.5363325363, 0.0514459929},
+    {0.2119034982, 0.6806995451, 0.1073969566},
+    {0.0883024619, 0.2817188376, 0.6299787005},
+};
+constexpr double kLmsToLab[3][3] = {
+    {0.2104542553, 0.7936177850, -0.0040720468},
+    {1.9779984951, -2.4285922050, 0.4505937099},
+    {0.0259040371, 0.7827717662, -0.8086757660},
+};
+constexpr double kLabToLms[3][3] = {
+    {1.0, 0.3963377774, 0.2158037573},
+    {1.0, -0.1055613458, -0.0638541728},
+    {1.0, -0.0894841775, -1.2914855480},
+};
+constexpr double kLmsToLinear[3][3] = {
+    {4.0767416621, -3.3077115913, 0.2309699292},
+    {-1.2684380046, 2.6097574011, -0.3413193965},
+    {-0.0041960863, -0.7034186147, 1.7076147010},
+};
+
+double decodeSrgb(double value) {
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+double encodeSrgb(double linear) {
+    return linear <= 0.0031308 ? 12.92 * linear : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+}
+
+// Buckets of the linear range for encoding. The closest two thresholds
+// (codes 0|1 and 1|2) are 3.0e-4 apart, more than a bucket, so a bucket
+// holds at most one threshold and one comparison finishes the search.
+constexpr int kEncodeSteps = 4096;
+
+struct OklabTables {
+    // LMS response of one channel value, so a pixel's response is
+    // red[r] + green[g] + blue[b]. The fourth lane is zero.
+    alignas(16) float red[256][4];
+    alignas(16) float green[256][4];
+    alignas(16) float blue[256][4];
+    // Cube-rooted LMS of a gray level. Each row of kLinearToLms sums to 1,
+    // so l = m = s = the linear value, and Gray8 needs no cube root at all.
+    alignas(16) float gray[256][4];
+    // Linear value halfway, in sRGB terms, between codes k and k + 1; the
+    // last entry is out of reach.
+    float threshold[256];
+    // Lowest code a linear value in bucket i can encode to.
+    uint8_t firstCode[kEncodeSteps + 1];
+
+    OklabTables() {
+        for (int v = 0; v < 256; ++v) {
+            const double linear = decodeSrgb(v / 255.0);
+            for (int i = 0; i < 3; ++i) {
+                red[v][i] = static_cast<float>(kLinearToLms[i][0] * linear);
+                green[v][i] = static_cast<float>(kLinearToLms[i][1] * linear);
+                blue[v][i] = static_cast<float>(kLinearToLms[i][2] * linear);
+            }
+            red[v][3] = green[v][3] = blue[v][3] = 0;
+            for (int i = 0; i < 3; ++i) {
+                const double cone = (kLinearToLms[i][0] + kLinearToLms[i][1] + kLinearToLms[i][2]) * linear;
+                gray[v][i] = static_cast<float>(std::cbrt(cone));
+            }
+            gray[v][3] = 0;
+        }
+        for (int k = 0; k < 255; ++k) threshold[k] = static_cast<float>(decodeSrgb((k + 0.5) / 255.0));
+        threshold[255] = 2.0f;
+        int code = 0;
+        for (int i = 0; i <= kEncodeSteps; ++i) {
+            const float linear = static_cast<float>(i) / kEncodeSteps;
+            while (code < 255 && linear >= threshold[code]) ++code;
+            firstCode[i] = static_cast<uint8_t>(code);
+        }
+    }
+};
+
+const OklabTables kTables;
+
+// Nearest 8-bit sRGB code of a linear value, exactly as rounding the
+// encoded value would give.
+inline uint8_t encodeLinear(float linear) {
+    linear = std::min(std::max(linear, 0.0f), 1.0f);
+    const int code = kTables.firstCode[static_cast<int>(linear * kEncodeSteps)];
+    return static_cast<uint8_t>(code + (linear >= kTables.threshold[code]));
+}
+
+// Cube root for x >= 0. A third of the float's bit pattern (plus a bias)
+// is an estimate within about 3%; one Halley step, y (y^3 + 2x) / (2y^3 + x),
+// cubes that error. Inputs are floored so that y^3 stays a normal float:
+// denormals are very slow on x86, and black pixels are common.
+constexpr float kCbrtFloor = 1e-15f;
+constexpr int32_t kCbrtBias = 709921077;
+
+inline float fastCbrt(float x) {
+    x = std::max(x, kCbrtFloor);
+    int32_t bits;
+    std::memcpy(&bits, &x, 4);
+    bits = static_cast<int32_t>(static_cast<float>(bits) * (1.0f / 3.0f)) + kCbrtBias;
+    float y;
+    std::memcpy(&y, &bits, 4);
+    const float y3 = y * y * y;
+    return y * (y3 + 2.0f * x) / (2.0f * y3 + x);
+}
+
+// Four float lanes (l, m, s, unused); the same steps as fastCbrt, so both
+// paths give identical results.
+#if defined(I2P_HAVE_SSE2)
+using Lanes = __m128;
+
+inline Lanes zeroLanes() { return _mm_setzero_ps(); }
+inline Lanes loadLanes(const float *p) { return _mm_loadu_ps(p); }
+inline Lanes addLanes(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+inline void storeLanes(float *p, Lanes v) { _mm_storeu_ps(p, v); }
+
+inline Lanes cbrtLanes(Lanes x) {
+    x = _mm_max_ps(x, _mm_set1_ps(kCbrtFloor));
+    const __m128 third = _mm_mul_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)), _mm_set1_ps(1.0f / 3.0f));
+    const __m128 y = _mm_castsi128_ps(_mm_add_epi32(_mm_cvttps_epi32(third), _mm_set1_epi32(kCbrtBias)));
+    const __m128 y3 = _mm_mul_ps(_mm_mul_ps(y, y), y);
+    const __m128 twoX = _mm_add_ps(x, x);
+    return _mm_div_ps(_mm_mul_ps(y, _mm_add_ps(y3, twoX)), _mm_add_ps(_mm_add_ps(y3, y3), x));
+}
+#else
+struct Lanes {
+    float v[4];
+};
+
+inline Lanes zeroLanes() { return {{0, 0, 0, 0}}; }
+inline Lanes loadLanes(const float *p) { return {{p[0], p[1], p[2], p[3]}}; }
+inline Lanes addLanes(Lanes a, Lanes b) {
+    return {{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+inline void storeLanes(float *p, Lanes v) { std::memcpy(p, v.v, sizeof(v.v)); }
+inline Lanes cbrtLanes(Lanes x) {
+    return {{fastCbrt(x.v[0]), fastCbrt(x.v[1]), fastCbrt(x.v[2]), fastCbrt(x.v[3])}};
+}
+#endif
+
+// Cube-rooted LMS of one colour.
+inline Lanes colorLms(Color c) {
+    return cbrtLanes(addLanes(addLanes(loadLanes(kTables.red[c.r]), loadLanes(kTables.green[c.g])),
+                              loadLanes(kTables.blue[c.b])));
+}
+
+// Cube-rooted LMS of one pixel.
+template <PixelFormat Format>
+inline Lanes pixelLms(const uint8_t *p) {
+    return Format == PixelFormat::Gray8 ? loadLanes(kTables.gray[p[0]]) : colorLms(readColor(p, Format));
+}
+
+template <PixelFormat Format>
+inline uint32_t pixelAlpha(const uint8_t *p) {
+    if (Format == PixelFormat::Argb32) {
+        uint32_t argb;
+        std::memcpy(&argb, p, 4);
+        return argb >> 24;
+    }
+    return Format == PixelFormat::Rgba8888 ? p[3] : 0;
+}
+
+// sRGB colour of a mean cube-rooted LMS value.
+Color colorFromLms(const float *lms) {
+    float cone[3];
+    for (int i = 0; i < 3; ++i) cone[i] = lms[i] * lms[i] * lms[i];
+    uint8_t rgb[3];
+    for (int i = 0; i < 3; ++i) {
+        const float linear = static_cast<float>(kLmsToLinear[i][0]) * cone[0] +
+                             static_cast<float>(kLmsToLinear[i][1]) * cone[1] +
+                             static_cast<float>(kLmsToLinear[i][2]) * cone[2];
+        rgb[i] = encodeLinear(linear);
+    }
+    return {rgb[0], rgb[1], rgb[2]};
+}
+
+// Colour of a mean cube-rooted LMS value for a pixel format. Gray8 means
+// have l = m = s, and each row of kLmsToLinear sums to 1, so the linear
+// value is simply the cube of one lane.
+template <PixelFormat Format>
+inline Color meanColor(const float *lms) {
+    if (Format == PixelFormat::Gray8) {
+        const uint8_t v = encodeLinear(lms[0] * lms[0] * lms[0]);
+        return {v, v, v};
+    }
+    return colorFromLms(lms);
+}
+
+template <PixelFormat Format>
+inline void storePixel(uint8_t *p, Color color, uint8_t alpha) {
+    if (Format == PixelFormat::Argb32) {
+        const uint32_t argb = (uint32_t(alpha) << 24) | (uint32_t(color.r) << 16) | (uint32_t(color.g) << 8) | color.b;
+        std::memcpy(p, &argb, 4);
+        return;
+    }
+    writeColor(p, Format, color);
+    if (Format == PixelFormat::Rgba8888) p[3] = alpha;
+}
+
+// Same structure as the separable mean kernel: each source row is streamed
+// once into per-block sums (of cube-rooted LMS rather than bytes), then the
+// first output row is expanded and copied down the block row.
+template <PixelFormat Format>
+void oklabBlockRows(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid, int firstBlockRow,
+                    int lastBlockRow) {
+    const int bpp = bytesPerPixel(Format);
+    const int blockSize = grid.blockSize;
+    const int startX = gridStart(grid.phaseX, blockSize);
+    const int startY = gridStart(grid.phaseY, blockSize);
+    const int blockColumns = (src.width - startX + blockSize - 1) / blockSize;
+    const size_t rowBytes = static_cast<size_t>(src.width) * bpp;
+
+    // Four floats per block column: cube-rooted l, m, s and an unused lane.
+    thread_local std::vector<float> sums;
+    thread_local std::vector<uint32_t> alphaSums;
+    thread_local std::vector<uint8_t> colors;
+    sums.resize(static_cast<size_t>(blockColumns) * 4);
+    alphaSums.resize(blockColumns);
+    colors.resize(static_cast<size_t>(blockColumns) * bpp);
+
+    for (int blockRow = firstBlockRow; blockRow < lastBlockRow; ++blockRow) {
+        const int y = startY + blockRow * blockSize;
+        const int y0 = std::max(y, 0);
+        const int y1 = std::min(y + blockSize, src.height);
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        std::fill(alphaSums.begin(), alphaSums.end(), 0u);
+
+        for (int by = y0; by < y1; ++by) {
+            const uint8_t *p = src.row(by);
+            for (int column = 0; column < blockColumns; ++column) {
+                const int x0 = std::max(startX + column * blockSize, 0);
+                const int x1 = std::min(startX + (column + 1) * blockSize, src.width);
+                // Two accumulators, so consecutive pixels do not wait on
+                // each other's float add.
+                Lanes evenSum = zeroLanes();
+                Lanes oddSum = zeroLanes();
+                uint32_t rowAlpha = 0;
+                int bx = x0;
+                for (; bx + 2 <= x1; bx += 2, p += 2 * bpp) {
+                    evenSum = addLanes(evenSum, pixelLms<Format>(p));
+                    oddSum = addLanes(oddSum, pixelLms<Format>(p + bpp));
+                    rowAlpha += pixelAlpha<Format>(p) + pixelAlpha<Format>(p + bpp);
+                }
+                if (bx < x1) {
+                    evenSum = addLanes(evenSum, pixelLms<Format>(p));
+                    rowAlpha += pixelAlpha<Format>(p);
+                    p += bpp;
+                }
+                float *sum = &sums[static_cast<size_t>(column) * 4];
+                storeLanes(sum, addLanes(loadLanes(sum), addLanes(evenSum, oddSum)));
+                alphaSums[column] += rowAlpha;
+            }
+        }
+
+        for (int column = 0; column < blockColumns; ++column) {
+            const int x0 = std::max(startX + column * blockSize, 0);
+            const int x1 = std::min(startX + (column + 1) * blockSize, src.width);
+            const uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+            const float scale = 1.0f / count;
+            float mean[4];
+            for (int i = 0; i < 4; ++i) mean[i] = sums[static_cast<size_t>(column) * 4 + i] * scale;
+            storePixel<Format>(&colors[static_cast<size_t>(column) * bpp], meanColor<Format>(mean),
+                               static_cast<uint8_t>(alphaSums[column] / count));
+        }
+
+        uint8_t *first = dst.row(y0);
+        for (int column = 0; column < blockColumns; ++column) {
+            const int x0 = std::max(startX + column * blockSize, 0);
+            const int x1 = std::min(startX + (column + 1) * blockSize, src.width);
+            uint8_t *p = first + x0 * bpp;
+            for (int bx = x0; bx < x1; ++bx, p += bpp) std::memcpy(p, &colors[static_cast<size_t>(column) * bpp], bpp);
+        }
+        for (int by = y0 + 1; by < y1; ++by) std::memcpy(dst.row(by), first, rowBytes);
+    }
+}
+
+} // namespace
+
+Oklab toOklab(Color color) {
+    float cone[3];
+    for (int i = 0; i < 3; ++i)
+        cone[i] = fastCbrt(kTables.red[color.r][i] + kTables.green[color.g][i] + kTables.blue[color.b][i]);
+    float lab[3];
+    for (int i = 0; i < 3; ++i) {
+        lab[i] = static_cast<float>(kLmsToLab[i][0] * cone[0] + kLmsToLab[i][1] * cone[1] + kLmsToLab[i][2] * cone[2]);
+    }
+    return {lab[0], lab[1], lab[2]};
+}
+
+Color fromOklab(Oklab lab) {
+    float cone[3];
+    for (int i = 0; i < 3; ++i)
+        cone[i] = static_cast<float>(kLabToLms[i][0] * lab.L + kLabToLms[i][1] * lab.a + kLabToLms[i][2] * lab.b);
+    return colorFromLms(cone);
+}
+
+Oklab toOklabExact(Color color) {
+    const double linear[3] = {decodeSrgb(color.r / 255.0), decodeSrgb(color.g / 255.0), decodeSrgb(color.b / 255.0)};
+    double cone[3];
+    for (int i = 0; i < 3; ++i)
+        cone[i] = std::cbrt(kLinearToLms[i][0] * linear[0] + kLinearToLms[i][1] * linear[1] + kLinearToLms[i][2] * linear[2]);
+    double lab[3];
+    for (int i = 0; i < 3; ++i) lab[i] = kLmsToLab[i][0] * cone[0] + kLmsToLab[i][1] * cone[1] + kLmsToLab[i][2] * cone[2];
+    return {static_cast<float>(lab[0]), static_cast<float>(lab[1]), static_cast<float>(lab[2])};
+}
+
+Color fromOklabExact(Oklab lab) {
+    double cone[3];
+    for (int i = 0; i < 3; ++i) {
+        const double root = kLabToLms[i][0] * lab.L + kLabToLms[i][1] * lab.a + kLabToLms[i][2] * lab.b;
+        cone[i] = root * root * root;
+    }
+    uint8_t rgb[3];
+    for (int i = 0; i < 3; ++i) {
+        const double linear = kLmsToLinear[i][0] * cone[0] + kLmsToLinear[i][1] * cone[1] + kLmsToLinear[i][2] * cone[2];
+        const double encoded = encodeSrgb(std::min(std::max(linear, 0.0), 1.0));
+        rgb[i] = static_cast<uint8_t>(std::lround(encoded * 255.0));
+    }
+    return {rgb[0], rgb[1], rgb[2]};
+}
+
+bool pixelateOklab(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid, int threads) {
+    if (!isValid(src) || !isValid(dst) || src.width != dst.width || src.height != dst.height ||
+        src.format != dst.format || grid.blockSize < 1) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("pixelate.oklab");
+    GridGeometry geometry = grid;
+    geometry.phaseX = std::max(geometry.phaseX, 0);
+    geometry.phaseY = std::max(geometry.phaseY, 0);
+    const int startY = gridStart(geometry.phaseY, geometry.blockSize);
+    const int blockRows = (src.height - startY + geometry.blockSize - 1) / geometry.blockSize;
+
+    // The whole block row is summed before any of it is written, so
+    // in-place calls stay correct.
+    parallelFor(0, blockRows, threads, [&](int first, int last) {
+        switch (src.format) {
+            case PixelFormat::Argb32: oklabBlockRows<PixelFormat::Argb32>(src, dst, geometry, first, last); break;
+            case PixelFormat::Rgba8888: oklabBlockRows<PixelFormat::Rgba8888>(src, dst, geometry, first, last); break;
+            case PixelFormat::Rgb888: oklabBlockRows<PixelFormat::Rgb888>(src, dst, geometry, first, last); break;
+            case PixelFormat::Gray8: oklabBlockRows<PixelFormat::Gray8>(src, dst, geometry, first, last); break;
+        }
+    });
+    return true;
+}
+
+} // namespace i2p
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+#include "palette.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+// A colour in Oklab: L is lightness in [0, 1], a and b are the green-red
+// and blue-yellow axes, within about +-0.4 for sRGB colours.
+struct Oklab {
+    float L = 0;
+    float a = 0;
+    float b = 0;
+};
+
+// Fast conversions used by the averaging kernel: sRGB decoding and encoding
+// go through tables, and the cube root is a bit-level estimate refined by
+// one Halley step.
+I2P_API Oklab toOklab(Color color);
+I2P_API Color fromOklab(Oklab lab);
+
+// Double-precision reference conversions (std::pow, std::cbrt), to check
+// the fast ones against.
+I2P_API Oklab toOklabExact(Color color);
+I2P_API Color fromOklabExact(Oklab lab);
+
+// pixelate() with every block averaged in Oklab instead of sRGB: hue edges
+// meet at the perceptual midpoint rather than a darker, muddier one. Alpha
+// is still averaged linearly. Called by pixelate() for BlockSampling::Oklab.
+I2P_API bool pixelateOklab(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid, int threads);
+
+} // namespace i2p
@@ -0,0 +1,360 @@
+#include "palette.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define I2P_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+void PaletteMatcher::reset(const Palette &palette, ColorMetric metric) {
+    colors = palette;
+    distanceMetric = metric;
+    count = static_cast<int>(palette.size());
+    const int padded = (count + 3) / 4 * 4;
+    redGreen.assign(static_cast<size_t>(padded) * 2, 0);
+    blueZero.assign(static_cast<size_t>(padded) * 2, 0);
+    for (int i = 0; i < padded; ++i) {
+        const Color &c = palette[std::min(i, count - 1)];
+        redGreen[2 * i] = c.r;
+        redGreen[2 * i + 1] = c.g;
+        blueZero[2 * i] = c.b;
+    }
+}
+
+int PaletteMatcher::nearest(Color color) const {
+#if I2P_HAVE_SSE2
+    // _mm_madd_epi16 of a difference vector with itself squares and adds
+    // neighbouring lanes: dr^2 + dg^2 from the (r, g) pairs, db^2 + 0 from
+    // the (b, 0) pairs, four entries per register. With the weighted metric
+    // one side of each product is scaled first. Distances stay below 2^20.
+    const bool weighted = distanceMetric == ColorMetric::Weighted;
+    const __m128i pixelRg = _mm_set1_epi32(color.r | (color.g << 16));
+    const __m128i pixelB = _mm_set1_epi32(color.b);
+    const __m128i weightRg = weighted ? _mm_set1_epi32(2 | (4 << 16)) : _mm_set1_epi32(1 | (1 << 16));
+    const __m128i weightB = _mm_set1_epi32(weighted ? 3 : 1);
+    __m128i bestDistance = _mm_set1_epi32(std::numeric_limits<int32_t>::max());
+    __m128i bestIndex = _mm_setzero_si128();
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i four = _mm_set1_epi32(4);
+    const int groups = (count + 3) / 4;
+    for (int g = 0; g < groups; ++g) {
+        const __m128i rg = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&redGreen[8 * g]));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&blueZero[8 * g]));
+        const __m128i drg = _mm_sub_epi16(rg, pixelRg);
+        const __m128i db = _mm_sub_epi16(b, pixelB);
+        const __m128i distance = _mm_add_epi32(_mm_madd_epi16(drg, _mm_mullo_epi16(drg, weightRg)),
+                                               _mm_madd_epi16(db, _mm_mullo_epi16(db, weightB)));
+        // Strictly closer only, so each lane keeps its lowest index.
+        const __m128i closer = _mm_cmplt_epi32(distance, bestDistance);
+        bestDistance = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, bestDistance));
+        bestIndex = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, bestIndex));
+        index = _mm_add_epi32(index, four);
+    }
+
+    alignas(16) int32_t distances[4];
+    alignas(16) int32_t indices[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(distances), bestDistance);
+    _mm_store_si128(reinterpret_cast<__m128i *>(indices), bestIndex);
+    int best = indices[0];
+    int32_t bestValue = distances[0];
+    for (int lane = 1; lane < 4; ++lane) {
+        if (distances[lane] < bestValue || (distances[lane] == bestValue && indices[lane] < best)) {
+            bestValue = distances[lane];
+            best = indices[lane];
+        }
+    }
+    // Padding repeats the last entry, which can only tie with it.
+    return std::min(best, count - 1);
+#else
+    int best = 0;
+    int bestValue = std::numeric_limits<int>::max();
+    for (int i = 0; i < count; ++i) {
+        const int distance = colorDistance(colors[i], color, distanceMetric);
+        if (distance < bestValue) {
+            bestValue = distance;
+            best = i;
+        }
+    }
+    return best;
+#endif
+}
+
+namespace {
+
+constexpr int kLutBits = 5;
+constexpr int kLutSide = 1 << kLutBits;
+constexpr int kCellWidth = 256 / kLutSide;
+
+// Per-axis weights of ColorMetric, for the cell bounds below.
+inline void metricWeights(ColorMetric metric, int *weights) {
+    const bool weighted = metric == ColorMetric::Weighted;
+    weights[0] = weighted ? 2 : 1;
+    weights[1] = weighted ? 4 : 1;
+    weights[2] = weighted ? 3 : 1;
+}
+
+} // namespace
+
+bool PaletteLut::build(const Palette &palette, ColorMetric metric, int threads) {
+    if (palette.empty() || palette.size() > static_cast<size_t>(kMaxPaletteSize)) return false;
+
+    I2P_TRACE_SPAN("palette.lut");
+    colors = palette;
+    distanceMetric = metric;
+    cells.assign(kLutSide * kLutSide * kLutSide, 0);
+    int weights[3];
+    metricWeights(metric, weights);
+    const int count = static_cast<int>(palette.size());
+
+    // For every cell: the smallest possible distance from each entry to any
+    // colour in the cell, and the largest. An entry can only be nearest
+    // somewhere in the cell if its smallest distance does not exceed the
+    // best largest distance, so the others are dropped. Each red slice of
+    // the cube is built on its own and the lists are joined afterwards.
+    std::vector<std::vector<uint8_t>> slices(kLutSide);
+    parallelFor(0, kLutSide, threads, [&](int first, int last) {
+        std::vector<int> nearBound(count), farBound(count);
+        for (int r = first; r < last; ++r) {
+            std::vector<uint8_t> &list = slices[r];
+            list.clear();
+            for (int g = 0; g < kLutSide; ++g) {
+                for (int b = 0; b < kLutSide; ++b) {
+                    const int low[3] = {r * kCellWidth, g * kCellWidth, b * kCellWidth};
+                    int bestFar = std::numeric_limits<int>::max();
+                    for (int i = 0; i < count; ++i) {
+                        const int value[3] = {palette[i].r, palette[i].g, palette[i].b};
+                        int nearSum = 0, farSum = 0;
+                        for (int c = 0; c < 3; ++c) {
+                            const int high = low[c] + kCellWidth - 1;
+                            const int nearAxis = value[c] < low[c] ? low[c] - value[c]
+                                                 : value[c] > high ? value[c] - high : 0;
+                            const int farAxis = std::max(value[c] - low[c], high - value[c]);
+                            nearSum += weights[c] * nearAxis * nearAxis;
+                            farSum += weights[c] * farAxis * farAxis;
+                        }
+                        nearBound[i] = nearSum;
+                        farBound[i] = farSum;
+                        bestFar = std::min(bestFar, farSum);
+                    }
+
+                    const size_t offset = list.size();
+                    for (int i = 0; i < count; ++i) {
+                        if (nearBound[i] <= bestFar) list.push_back(static_cast<uint8_t>(i));
+                    }
+                    const uint32_t listed = static_cast<uint32_t>(list.size() - offset);
+                    cells[(r << 10) | (g << 5) | b] = (static_cast<uint32_t>(offset) << kCountBits) | listed;
+                }
+            }
+        }
+    });
+
+    // Slice offsets were local; shift them by the lists before each slice.
+    candidateList.clear();
+    for (int r = 0; r < kLutSide; ++r) {
+        const uint32_t base = static_cast<uint32_t>(candidateList.size()) << kCountBits;
+        for (int cell = r << 10; cell < (r + 1) << 10; ++cell) cells[cell] += base;
+        candidateList.insert(candidateList.end(), slices[r].begin(), slices[r].end());
+    }
+    return true;
+}
+
+int PaletteLut::nearestAmong(Color color, const uint8_t *candidates, uint32_t count) const {
+    // Candidates are in palette order, so strict comparison keeps the
+    // lowest index on ties, as PaletteMatcher does.
+    int best = candidates[0];
+    int bestValue = colorDistance(colors[best], color, distanceMetric);
+    for (uint32_t i = 1; i < count; ++i) {
+        const int distance = colorDistance(colors[candidates[i]], color, distanceMetric);
+        if (distance < bestValue) {
+            bestValue = distance;
+            best = candidates[i];
+        }
+    }
+    return best;
+}
+
+namespace {
+
+// Matcher is PaletteMatcher or PaletteLut.
+template <typename Matcher>
+void remapRows(const ImageView &image, const Matcher &matcher, int firstRow, int lastRow) {
+    const int bpp = bytesPerPixel(image.format);
+    const size_t rowBytes = static_cast<size_t>(image.width) * bpp;
+    // Copy of the previous source row, which has been overwritten by now.
+    thread_local std::vector<uint8_t> previous;
+    previous.resize(rowBytes);
+
+    for (int y = firstRow; y < lastRow; ++y) {
+        uint8_t *row = image.row(y);
+        // Rows of one block row are identical after pixelation: reuse the
+        // mapped row above.
+        if (y > firstRow && std::memcmp(row, previous.data(), rowBytes) == 0) {
+            std::memcpy(row, image.row(y - 1), rowBytes);
+            continue;
+        }
+        std::memcpy(previous.data(), row, rowBytes);
+
+        Color last = readColor(row, image.format);
+        Color mapped = matcher.palette()[matcher.nearest(last)];
+        uint8_t *p = row;
+        for (int x = 0; x < image.width; ++x, p += bpp) {
+            const Color color = readColor(p, image.format);
+            if (!(color == last)) {
+                last = color;
+                mapped = matcher.palette()[matcher.nearest(color)];
+            }
+            writeColor(p, image.format, mapped);
+        }
+    }
+}
+
+} // namespace
+
+bool remapToPalette(const ImageView &image, const Palette &palette, int threads) {
+    if (!isValid(image) || palette.empty() || palette.size() > static_cast<size_t>(kMaxPaletteSize)) return false;
+
+    I2P_TRACE_SPAN("palette.remap");
+    const PaletteMatcher matcher(palette);
+    parallelFor(0, image.height, threads, [&](int first, int last) {
+        remapRows(image, matcher, first, last);
+    });
+    return true;
+}
+
+bool remapToPalette(const ImageView &image, const PaletteLut &lut, int threads) {
+    if (!isValid(image) || lut.empty()) return false;
+
+    I2P_TRACE_SPAN("palette.remap");
+    parallelFor(0, image.height, threads, [&](int first, int last) {
+        remapRows(image, lut, first, last);
+    });
+    return true;
+}
+
+bool builtinPalette(const std::string &name, Palette &palette) {
+    static const uint32_t pico8[] = {
+        0x000000, 0x1D2B53, 0x7E2553, 0x008751, 0xAB5236, 0x5F574F, 0xC2C3C7, 0xFFF1E8,
+        0xFF004D, 0xFFA300, 0xFFEC27, 0x00E436, 0x29ADFF, 0x83769C, 0xFF77A8, 0xFFCCAA,
+    };
+    static const uint32_t gameboy[] = {0x0F380F, 0x306230, 0x8BAC0F, 0x9BBC0F};
+
+    const uint32_t *values;
+    size_t count;
+    if (name == "pico8") {
+        values = pico8;
+        count = sizeof(pico8) / sizeof(pico8[0]);
+    } else if (name == "gameboy") {
+        values = gameboy;
+        count = sizeof(gameboy) / sizeof(gameboy[0]);
+    } else {
+        return false;
+    }
+    palette.clear();
+    for (size_t i = 0; i < count; ++i) {
+        palette.push_back({static_cast<uint8_t>(values[i] >> 16), static_cast<uint8_t>(values[i] >> 8),
+                           static_cast<uint8_t>(values[i])});
+    }
+    return true;
+}
+
+namespace {
+
+std::string trimmed(const std::string &line) {
+    size_t begin = 0, end = line.size();
+    while (begin < end && std::isspace(static_cast<unsigned char>(line[begin]))) ++begin;
+    while (end > begin && std::isspace(static_cast<unsigned char>(line[end - 1]))) --end;
+    return line.substr(begin, end - begin);
+}
+
+bool parseGplLine(const std::string &line, Color &color) {
+    int r, g, b;
+    if (std::sscanf(line.c_str(), "%d %d %d", &r, &g, &b) != 3) return false;
+    if (r < 0 || r > 255 || g < 0 || g > 255 || b < 0 || b > 255) return false;
+    color = {static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b)};
+    return true;
+}
+
+bool parseHexLine(std::string line, Color &color) {
+    if (!line.empty() && line[0] == '#') line.erase(0, 1);
+    if (line.size() != 6 || !std::all_of(line.begin(), line.end(), [](unsigned char c) { return std::isxdigit(c); }))
+        return false;
+    const unsigned long value = std::strtoul(line.c_str(), nullptr, 16);
+    color = {static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+    return true;
+}
+
+bool endsWith(const std::string &text, const char *suffix) {
+    const size_t length = std::strlen(suffix);
+    if (text.size() < length) return false;
+    for (size_t i = 0; i < length; ++i) {
+        if (std::tolower(static_cast<unsigned char>(text[text.size() - length + i])) != suffix[i]) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool loadPalette(const std::string &path, Palette &palette, std::string &error) {
+    const bool gpl = endsWith(path, ".gpl");
+    if (!gpl && !endsWith(path, ".hex")) {
+        error = "palette files must be .gpl or .hex: " + path;
+        return false;
+    }
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    palette.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        line = trimmed(line);
+        if (gpl && lineNumber == 1) {
+            if (line != "GIMP Palette") {
+                error = path + ": missing 'GIMP Palette' header";
+                return false;
+            }
+            continue;
+        }
+        if (line.empty() || (gpl && line[0] == '#')) continue;
+        if (gpl && (line.compare(0, 5, "Name:") == 0 || line.compare(0, 8, "Columns:") == 0)) continue;
+
+        Color color;
+        if (!(gpl ? parseGplLine(line, color) : parseHexLine(line, color))) {
+            error = path + ":" + std::to_string(lineNumber) + ": not a colour: " + line;
+            return false;
+        }
+        if (palette.size() == static_cast<size_t>(kMaxPaletteSize)) {
+            error = path + ": more than " + std::to_string(kMaxPaletteSize) + " colours";
+            return false;
+        }
+        palette.push_back(color);
+    }
+    if (palette.empty()) {
+        error = path + ": no colours";
+        return false;
+    }
+    return true;
+}
+
+bool resolvePalette(const std::string &nameOrPath, Palette &palette, std::string &error) {
+    if (builtinPalette(nameOrPath, palette)) return true;
+    return loadPalette(nameOrPath, palette, error);
+}
+
+} // namespace i2p
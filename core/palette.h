@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "export.h"
+#include "image.h"
+
+namespace i2p {
+
+struct Color {
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+};
+
+inline bool operator==(const Color &a, const Color &b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+using Palette = std::vector<Color>;
+
+// Largest palette the matcher and the quantizer handle.
+constexpr int kMaxPaletteSize = 256;
+
+// Colour of one pixel, whatever the buffer layout; gray pixels read as r = g = b.
+inline Color readColor(const uint8_t *p, PixelFormat format) {
+    switch (format) {
+        case PixelFormat::Argb32: {
+            uint32_t argb;
+            std::memcpy(&argb, p, 4);
+            return {static_cast<uint8_t>(argb >> 16), static_cast<uint8_t>(argb >> 8), static_cast<uint8_t>(argb)};
+        }
+        case PixelFormat::Gray8:
+            return {p[0], p[0], p[0]};
+        default:
+            return {p[0], p[1], p[2]};
+    }
+}
+
+// Stores a colour into one pixel, leaving alpha alone; gray pixels get the
+// colour's luma.
+inline void writeColor(uint8_t *p, PixelFormat format, Color color) {
+    switch (format) {
+        case PixelFormat::Argb32: {
+            uint32_t argb;
+            std::memcpy(&argb, p, 4);
+            argb = (argb & 0xFF000000u) | (uint32_t(color.r) << 16) | (uint32_t(color.g) << 8) | color.b;
+            std::memcpy(p, &argb, 4);
+            break;
+        }
+        case PixelFormat::Gray8:
+            p[0] = static_cast<uint8_t>((77 * color.r + 150 * color.g + 29 * color.b + 128) >> 8);
+            break;
+        default:
+            p[0] = color.r;
+            p[1] = color.g;
+            p[2] = color.b;
+            break;
+    }
+}
+
+// How colour differences are measured when matching against a palette.
+enum class ColorMetric {
+    Rgb,        // squared RGB distance
+    Weighted    // 2 dr^2 + 4 dg^2 + 3 db^2, closer to perceived difference
+};
+
+// Squared distance under the metric; at most 9 * 255^2.
+inline int colorDistance(Color a, Color b, ColorMetric metric) {
+    const int dr = a.r - b.r;
+    const int dg = a.g - b.g;
+    const int db = a.b - b.b;
+    if (metric == ColorMetric::Weighted) return 2 * dr * dr + 4 * dg * dg + 3 * db * db;
+    return dr * dr + dg * dg + db * db;
+}
+
+// Exact nearest-colour search (lowest index on ties). The palette is kept
+// as 16-bit lanes so SSE2 tests four entries per step.
+class I2P_API PaletteMatcher {
+public:
+    PaletteMatcher() = default;
+    explicit PaletteMatcher(const Palette &palette, ColorMetric metric = ColorMetric::Rgb) {
+        reset(palette, metric);
+    }
+
+    void reset(const Palette &palette, ColorMetric metric = ColorMetric::Rgb);
+    int size() const { return count; }
+    const Palette &palette() const { return colors; }
+
+    // Index of the nearest palette entry; the palette must not be empty.
+    int nearest(Color color) const;
+
+private:
+    Palette colors;
+    // Entries in groups of four: (r, g) pairs and (b, 0) pairs, padded with
+    // copies of the last entry so every group is complete.
+    std::vector<int16_t> redGreen;
+    std::vector<int16_t> blueZero;
+    ColorMetric distanceMetric = ColorMetric::Rgb;
+    int count = 0;
+};
+
+// Nearest-colour lookup through a 32x32x32 cube over RGB, for fixed
+// palettes that map many images. Each cell keeps the palette entries that
+// can be nearest to some colour inside it; most cells have exactly one, and
+// the rest (near Voronoi boundaries) are settled by an exact search over
+// their short candidate list. Results equal PaletteMatcher's.
+class I2P_API PaletteLut {
+public:
+    // Returns false for an empty palette or one larger than kMaxPaletteSize.
+    bool build(const Palette &palette, ColorMetric metric = ColorMetric::Rgb, int threads = 0);
+
+    bool empty() const { return colors.empty(); }
+    const Palette &palette() const { return colors; }
+    ColorMetric metric() const { return distanceMetric; }
+    // Bytes held by the lookup cube and candidate lists, for memory displays.
+    size_t memoryBytes() const {
+        return colors.capacity() * sizeof(Color) + cells.capacity() * sizeof(uint32_t) + candidateList.capacity();
+    }
+
+    int nearest(Color color) const {
+        const uint32_t cell = cells[((color.r >> 3) << 10) | ((color.g >> 3) << 5) | (color.b >> 3)];
+        const uint8_t *candidates = &candidateList[cell >> kCountBits];
+        const uint32_t count = cell & ((1u << kCountBits) - 1);
+        return count == 1 ? candidates[0] : nearestAmong(color, candidates, count);
+    }
+
+private:
+    // Cells pack a candidate count (low bits) and an offset into candidateList.
+    static constexpr int kCountBits = 9;
+
+    int nearestAmong(Color color, const uint8_t *candidates, uint32_t count) const;
+
+    Palette colors;
+    ColorMetric distanceMetric = ColorMetric::Rgb;
+    std::vector<uint32_t> cells;
+    std::vector<uint8_t> candidateList;
+};
+
+// Replaces every pixel by its nearest palette colour; alpha is kept. Rows
+// equal to the previous one and runs of equal pixels reuse the last match,
+// so pixelated images cost about one search per block.
+I2P_API bool remapToPalette(const ImageView &image, const Palette &palette, int threads = 0);
+
+// The same through a prebuilt lookup cube, using its metric.
+I2P_API bool remapToPalette(const ImageView &image, const PaletteLut &lut, int threads = 0);
+
+// Built-in palettes by name: "pico8" (16 colours), "gameboy" (4 shades).
+I2P_API bool builtinPalette(const std::string &name, Palette &palette);
+
+// Reads a GIMP palette (.gpl) or a list of RRGGBB lines (.hex, '#' optional).
+// On failure returns false and sets error.
+I2P_API bool loadPalette(const std::string &path, Palette &palette, std::string &error);
+
+// A built-in palette name or a palette file.
+I2P_API bool resolvePalette(const std::string &nameOrPath, Palette &palette, std::string &error);
+
+} // namespace i2p
@@ -0,0 +1,145 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+thread_local bool insideParallelFor = false;
+
+// Persistent workers so interactive updates do not pay for thread creation.
+// One job runs at a time; the submitting thread works alongside the helpers
+// and returns only after every helper has left the job.
+class ThreadPool {
+public:
+    static ThreadPool &instance() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    int capacity() const { return static_cast<int>(workers.size()) + 1; }
+
+    void run(int taskCount, int threads, const std::function<void(int)> &task) {
+        std::lock_guard<std::mutex> serialize(runMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            jobTasks = taskCount;
+            nextTask.store(0);
+            helpers = std::min(threads - 1, static_cast<int>(workers.size()));
+            active = helpers;
+            ++generation;
+        }
+        wake.notify_all();
+
+        drain();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return active == 0; });
+        job = nullptr;
+    }
+
+private:
+    ThreadPool() {
+        unsigned hw = std::thread::hardware_concurrency();
+        int count = hw > 1 ? static_cast<int>(hw) - 1 : 0;
+        for (int i = 0; i < count; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers) worker.join();
+    }
+
+    void drain() {
+        insideParallelFor = true;
+        for (;;) {
+            int index = nextTask.fetch_add(1);
+            if (index >= jobTasks) break;
+            (*job)(index);
+        }
+        insideParallelFor = false;
+    }
+
+    void workerLoop(int index) {
+        trace::setThreadName("worker " + std::to_string(index + 1));
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (index >= helpers) continue;
+
+            lock.unlock();
+            drain();
+            lock.lock();
+            if (--active == 0) done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex runMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const std::function<void(int)> *job = nullptr;
+    int jobTasks = 0;
+    std::atomic<int> nextTask{0};
+    int helpers = 0;
+    int active = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};
+
+} // namespace
+
+int hardwareThreads() {
+    return ThreadPool::instance().capacity();
+}
+
+int resolveThreadCount(int requested) {
+    int available = hardwareThreads();
+    if (requested <= 0) return available;
+    return std::min(requested, available);
+}
+
+void parallelFor(int begin, int end, int threads, const std::function<void(int, int)> &body) {
+    const int count = end - begin;
+    if (count <= 0) return;
+
+    int workers = std::min(resolveThreadCount(threads), count);
+    if (workers <= 1 || insideParallelFor) {
+        body(begin, end);
+        return;
+    }
+
+    // A few ranges per thread evens out rows of unequal cost.
+    const int tasks = std::min(count, workers * 4);
+    const uint64_t generation = trace::generation();
+    ThreadPool::instance().run(tasks, workers, [&](int task) {
+        trace::GenerationScope scope(generation);
+        int lo = begin + static_cast<int>(static_cast<int64_t>(count) * task / tasks);
+        int hi = begin + static_cast<int>(static_cast<int64_t>(count) * (task + 1) / tasks);
+        if (lo < hi) body(lo, hi);
+    });
+}
+
+} // namespace i2p
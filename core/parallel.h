@@ -0,0 +1,22 @@
+#pragma once
+
+#include <functional>
+
+#include "export.h"
+
+namespace i2p {
+
+// Number of threads the pool can run at once (workers plus the caller).
+I2P_API int hardwareThreads();
+
+// Resolves a user-facing thread count: 0 means "all", anything else is
+// clamped to [1, hardwareThreads()].
+I2P_API int resolveThreadCount(int requested);
+
+// Splits [begin, end) into contiguous ranges and runs body(lo, hi) on the
+// shared worker pool, with the calling thread taking part. Ranges are handed
+// out in increasing order. Returns once every range has finished. Calls made
+// from inside a body run serially on the calling worker.
+I2P_API void parallelFor(int begin, int end, int threads, const std::function<void(int, int)> &body);
+
+} // namespace i2p
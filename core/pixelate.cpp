@@ -0,0 +1,619 @@
+#include "pixelate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "mosaic.h"
+#include "oklab.h"
+#include "parallel.h"
+#include "rotated.h"
+#include "trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define I2P_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace i2p {
+
+namespace {
+
+// First grid line at or before the origin: a non-zero phase leaves a partial
+// block along the top/left edge.
+inline int gridStart(int phase, int blockSize) {
+    int offset = phase % blockSize;
+    return offset ? offset - blockSize : 0;
+}
+
+// Fixed-point reciprocals replacing sum / count for every pixel count up to
+// 100x100. With m = floor(2^40 / d) + 1, write m = 2^40 / d + e, 0 < e <= 1,
+// and n = q * d + r with 0 <= r < d. Then n * m / 2^40 = q + r / d + n * e / 2^40.
+// A channel sum is at most 255 * d, so the last term is below 255 * d / 2^40,
+// which is less than 1 / d whenever 255 * d^2 < 2^40 (d < 65660). As r / d is
+// at most (d - 1) / d, the total stays below q + 1, so (n * m) >> 40 == n / d.
+// Products fit in 64 bits: n < 2^22 and m < 2^40.
+constexpr int kReciprocalShift = 40;
+constexpr int kMaxReciprocalCount = 100 * 100;
+
+struct ReciprocalTable {
+    uint64_t values[kMaxReciprocalCount + 1];
+
+    ReciprocalTable() {
+        values[0] = 0;
+        for (int d = 1; d <= kMaxReciprocalCount; ++d) values[d] = (uint64_t(1) << kReciprocalShift) / d + 1;
+    }
+};
+
+const ReciprocalTable kReciprocals;
+
+// Truncating sum / count through the reciprocal table.
+inline uint8_t divideSum(uint32_t sum, uint32_t count) {
+    if (count <= kMaxReciprocalCount)
+        return static_cast<uint8_t>((sum * kReciprocals.values[count]) >> kReciprocalShift);
+    return static_cast<uint8_t>(sum / count);
+}
+
+// Averages source rows [y0, y1) and columns [x0, x1) into one pixel.
+template <int Channels, bool Reciprocal>
+inline void reduceBlock(const ConstImageView &src, int x0, int x1, int y0, int y1, uint8_t *color) {
+    uint32_t sum[Channels] = {};
+    for (int by = y0; by < y1; ++by) {
+        const uint8_t *p = src.row(by) + x0 * Channels;
+        for (int bx = x0; bx < x1; ++bx, p += Channels) {
+            for (int c = 0; c < Channels; ++c) sum[c] += p[c];
+        }
+    }
+
+    const uint32_t count = static_cast<uint32_t>((x1 - x0) * (y1 - y0));
+    if (Reciprocal) {
+        for (int c = 0; c < Channels; ++c) color[c] = divideSum(sum[c], count);
+    } else {
+        for (int c = 0; c < Channels; ++c) color[c] = static_cast<uint8_t>(sum[c] / count);
+    }
+}
+
+// Averages every block of one block row (source rows [y0, y1)) into one
+// pixel per block, for any block size.
+template <int Channels, bool Reciprocal = true>
+void reduceBlockRow(const ConstImageView &src, int startX, int blockSize, int y0, int y1, uint8_t *colors) {
+    for (int x = startX; x < src.width; x += blockSize, colors += Channels) {
+        reduceBlock<Channels, Reciprocal>(src, std::max(x, 0), std::min(x + blockSize, src.width), y0, y1, colors);
+    }
+}
+
+// Separable form of reduceBlockRow: each source row is read once, left to
+// right, adding its pixels into one accumulator per block; the accumulators
+// then hold the block sums of the whole block row. Keeps reads sequential,
+// which matters for large blocks on wide images.
+template <int Channels>
+void reduceBlockRowSeparable(const ConstImageView &src, int startX, int blockSize, int y0, int y1, uint8_t *colors) {
+    const int blockColumns = (src.width - startX + blockSize - 1) / blockSize;
+    thread_local std::vector<uint32_t> sums;
+    sums.assign(static_cast<size_t>(blockColumns) * Channels, 0);
+
+    for (int by = y0; by < y1; ++by) {
+        const uint8_t *p = src.row(by);
+        uint32_t *sum = sums.data();
+        for (int x = startX; x < src.width; x += blockSize, sum += Channels) {
+            const int x0 = std::max(x, 0);
+            const int x1 = std::min(x + blockSize, src.width);
+            // Summed locally first: byte loads may alias `sums`, which would
+            // otherwise force a store per pixel.
+            uint32_t rowSum[Channels] = {};
+            for (int bx = x0; bx < x1; ++bx, p += Channels) {
+                for (int c = 0; c < Channels; ++c) rowSum[c] += p[c];
+            }
+            for (int c = 0; c < Channels; ++c) sum[c] += rowSum[c];
+        }
+    }
+
+    const uint32_t *sum = sums.data();
+    for (int x = startX; x < src.width; x += blockSize, sum += Channels, colors += Channels) {
+        const uint32_t count = static_cast<uint32_t>((std::min(x + blockSize, src.width) - std::max(x, 0)) * (y1 - y0));
+        for (int c = 0; c < Channels; ++c) colors[c] = divideSum(sum[c], count);
+    }
+}
+
+constexpr int log2OfPowerOfTwo(int value) {
+    return value <= 1 ? 0 : 1 + log2OfPowerOfTwo(value / 2);
+}
+
+// reduceBlockRow for a power-of-two block size known at compile time: whole
+// blocks have constant trip counts and divide by shifting. Partial blocks
+// (grid phase, image edges) fall back to reduceBlock.
+template <int Channels, int BlockSize>
+void reduceBlockRowFixed(const ConstImageView &src, int startX, int blockSize, int y0, int y1, uint8_t *colors) {
+    static_assert((BlockSize & (BlockSize - 1)) == 0, "block size must be a power of two");
+    constexpr int Shift = 2 * log2OfPowerOfTwo(BlockSize);
+
+    if (y1 - y0 != BlockSize) {
+        reduceBlockRow<Channels>(src, startX, blockSize, y0, y1, colors);
+        return;
+    }
+
+    int x = startX;
+    if (x < 0) {
+        // The phase can leave a leading block wider than the whole image;
+        // x then lands past the edge and the trailing call is skipped.
+        reduceBlock<Channels, true>(src, 0, std::min(x + BlockSize, src.width), y0, y1, colors);
+        colors += Channels;
+        x += BlockSize;
+    }
+    for (; x + BlockSize <= src.width; x += BlockSize, colors += Channels) {
+        uint32_t sum[Channels] = {};
+        for (int by = 0; by < BlockSize; ++by) {
+            const uint8_t *p = src.row(y0 + by) + x * Channels;
+            for (int bx = 0; bx < BlockSize; ++bx, p += Channels) {
+                for (int c = 0; c < Channels; ++c) sum[c] += p[c];
+            }
+        }
+        for (int c = 0; c < Channels; ++c) colors[c] = static_cast<uint8_t>(sum[c] >> Shift);
+    }
+    if (x < src.width) reduceBlock<Channels, true>(src, x, src.width, y0, y1, colors);
+}
+
+// Dominant-colour sampling: a block's pixels are counted in a coarse
+// histogram, 4 bits per colour channel, and the block takes the mean of the
+// pixels in its fullest bin. Ties go to the bin that reached the count
+// first. Alpha (the fourth byte of both 4-channel layouts) is averaged with
+// the colour but does not choose the bin.
+constexpr int kDominantBits = 4;
+constexpr int kDominantBins = 1 << (3 * kDominantBits);
+
+template <int Channels>
+inline int dominantBin(const uint8_t *p) {
+    constexpr int shift = 8 - kDominantBits;
+    if (Channels == 1) return p[0] >> shift;
+    return ((p[0] >> shift) << (2 * kDominantBits)) | ((p[1] >> shift) << kDominantBits) | (p[2] >> shift);
+}
+
+template <int Channels>
+void reduceBlockDominant(const ConstImageView &src, int x0, int x1, int y0, int y1, uint8_t *color) {
+    // Reused by every block on this thread. The averaging pass revisits
+    // every pixel anyway, so it zeroes the bins the block touched and the
+    // histogram is clear again without a sweep over all 4096 bins.
+    thread_local std::vector<uint32_t> counts(kDominantBins, 0);
+    uint32_t *count = counts.data();
+
+    int best = 0;
+    uint32_t bestCount = 0;
+    for (int by = y0; by < y1; ++by) {
+        const uint8_t *p = src.row(by) + x0 * Channels;
+        for (int bx = x0; bx < x1; ++bx, p += Channels) {
+            const int bin = dominantBin<Channels>(p);
+            if (++count[bin] > bestCount) {
+                bestCount = count[bin];
+                best = bin;
+            }
+        }
+    }
+
+    uint32_t sum[Channels] = {};
+    for (int by = y0; by < y1; ++by) {
+        const uint8_t *p = src.row(by) + x0 * Channels;
+        for (int bx = x0; bx < x1; ++bx, p += Channels) {
+            const int bin = dominantBin<Channels>(p);
+            count[bin] = 0;
+            // All-ones for pixels in the winning bin, so the sum is branch-free.
+            const uint32_t mask = 0u - static_cast<uint32_t>(bin == best);
+            for (int c = 0; c < Channels; ++c) sum[c] += p[c] & mask;
+        }
+    }
+    for (int c = 0; c < Channels; ++c) color[c] = divideSum(sum[c], bestCount);
+}
+
+template <int Channels>
+void reduceBlockRowDominant(const ConstImageView &src, int startX, int blockSize, int y0, int y1, uint8_t *colors) {
+    for (int x = startX; x < src.width; x += blockSize, colors += Channels) {
+        reduceBlockDominant<Channels>(src, std::max(x, 0), std::min(x + blockSize, src.width), y0, y1, colors);
+    }
+}
+
+// Robust sampling ranks every channel on its own, alpha included: Median
+// takes the middle value (the truncated mean of the two middle values for
+// an even count), TrimmedMean the mean of the middle half once the lowest
+// and highest quarter are dropped. Both average the ranks [first, last).
+inline void rankRange(bool trimmed, int count, int &first, int &last) {
+    first = trimmed ? count / 4 : (count - 1) / 2;
+    last = trimmed ? count - count / 4 : count / 2 + 1;
+}
+
+// Blocks up to 8x8 are sorted by Batcher's odd-even merge network, 16
+// blocks at a time: lane l of slot k holds pixel k of block l, so every
+// compare-exchange is one min and one max over 16 bytes. Unused slots hold
+// 255 and sort past the real pixels.
+constexpr int kMaxNetworkBlock = 8;
+constexpr int kMaxNetworkValues = kMaxNetworkBlock * kMaxNetworkBlock;
+constexpr int kNetworkLanes = 16;
+
+struct Comparator {
+    uint8_t low;
+    uint8_t high;
+};
+
+struct SortingNetworks {
+    // networks[i] sorts 2^i values.
+    std::vector<Comparator> networks[7];
+
+    SortingNetworks() {
+        for (int i = 0; i < 7; ++i) addSort(networks[i], 0, 1 << i);
+    }
+
+    static void addMerge(std::vector<Comparator> &network, int lo, int n, int r) {
+        const int step = r * 2;
+        if (step < n) {
+            addMerge(network, lo, n, step);
+            addMerge(network, lo + r, n, step);
+            for (int i = lo + r; i + r < lo + n; i += step)
+                network.push_back({static_cast<uint8_t>(i), static_cast<uint8_t>(i + r)});
+        } else {
+            network.push_back({static_cast<uint8_t>(lo), static_cast<uint8_t>(lo + r)});
+        }
+    }
+
+    static void addSort(std::vector<Comparator> &network, int lo, int n) {
+        if (n < 2) return;
+        addSort(network, lo, n / 2);
+        addSort(network, lo + n / 2, n / 2);
+        addMerge(network, lo, n, 1);
+    }
+
+    // Smallest network for count values; also returns its size.
+    const std::vector<Comparator> &forCount(int count, int &size) const {
+        int i = 0;
+        while ((1 << i) < count) ++i;
+        size = 1 << i;
+        return networks[i];
+    }
+};
+
+const SortingNetworks kSortingNetworks;
+
+inline void sortLanes(uint8_t (*slots)[kNetworkLanes], const std::vector<Comparator> &network) {
+    for (const Comparator &c : network) {
+#if I2P_HAVE_SSE2
+        __m128i *low = reinterpret_cast<__m128i *>(slots[c.low]);
+        __m128i *high = reinterpret_cast<__m128i *>(slots[c.high]);
+        const __m128i a = _mm_load_si128(low);
+        const __m128i b = _mm_load_si128(high);
+        _mm_store_si128(low, _mm_min_epu8(a, b));
+        _mm_store_si128(high, _mm_max_epu8(a, b));
+#else
+        for (int l = 0; l < kNetworkLanes; ++l) {
+            const uint8_t a = slots[c.low][l], b = slots[c.high][l];
+            slots[c.low][l] = std::min(a, b);
+            slots[c.high][l] = std::max(a, b);
+        }
+#endif
+    }
+}
+
+// Lane-wise sums of slots [first, last).
+inline void sumLanes(const uint8_t (*slots)[kNetworkLanes], int first, int last, uint32_t *sums) {
+#if I2P_HAVE_SSE2
+    // At most 64 values per lane, so 16-bit sums cannot overflow.
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = zero, high = zero;
+    for (int k = first; k < last; ++k) {
+        const __m128i v = _mm_load_si128(reinterpret_cast<const __m128i *>(slots[k]));
+        low = _mm_add_epi16(low, _mm_unpacklo_epi8(v, zero));
+        high = _mm_add_epi16(high, _mm_unpackhi_epi8(v, zero));
+    }
+    alignas(16) uint16_t lanes[kNetworkLanes];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), low);
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanes + 8), high);
+    for (int l = 0; l < kNetworkLanes; ++l) sums[l] = lanes[l];
+#else
+    for (int l = 0; l < kNetworkLanes; ++l) sums[l] = 0;
+    for (int k = first; k < last; ++k) {
+        for (int l = 0; l < kNetworkLanes; ++l) sums[l] += slots[k][l];
+    }
+#endif
+}
+
+template <int Channels, bool Trimmed>
+void reduceBlockRowNetwork(const ConstImageView &src, int startX, int blockSize, int y0, int y1, uint8_t *colors) {
+    int values = 0;
+    const std::vector<Comparator> &network = kSortingNetworks.forCount(blockSize * (y1 - y0), values);
+    alignas(16) uint8_t slots[Channels][kMaxNetworkValues][kNetworkLanes];
+    int counts[kNetworkLanes];
+
+    for (int x = startX; x < src.width;) {
+        for (int c = 0; c < Channels; ++c) std::memset(slots[c], 0xFF, values * kNetworkLanes);
+        int lanes = 0;
+        for (; lanes < kNetworkLanes && x < src.width; ++lanes, x += blockSize) {
+            const int x0 = std::max(x, 0), x1 = std::min(x + blockSize, src.width);
+            int k = 0;
+            for (int by = y0; by < y1; ++by) {
+                const uint8_t *p = src.row(by) + x0 * Channels;
+                for (int bx = x0; bx < x1; ++bx, ++k, p += Channels) {
+                    for (int c = 0; c < Channels; ++c) slots[c][k][lanes] = p[c];
+                }
+            }
+            counts[lanes] = k;
+        }
+        for (int c = 0; c < Channels; ++c) sortLanes(slots[c], network);
+
+        // Only the first and last block of a row can be narrower; elsewhere
+        // all lanes share the rank range and are summed together.
+        bool sameCount = true;
+        for (int l = 1; l < lanes; ++l) sameCount &= counts[l] == counts[0];
+        if (sameCount) {
+            int first, last;
+            rankRange(Trimmed, counts[0], first, last);
+            uint32_t sums[kNetworkLanes];
+            for (int c = 0; c < Channels; ++c) {
+                sumLanes(slots[c], first, last, sums);
+                for (int l = 0; l < lanes; ++l) colors[l * Channels + c] = divideSum(sums[l], last - first);
+            }
+            colors += lanes * Channels;
+            continue;
+        }
+        for (int l = 0; l < lanes; ++l, colors += Channels) {
+            int first, last;
+            rankRange(Trimmed, counts[l], first, last);
+            for (int c = 0; c < Channels; ++c) {
+                uint32_t sum = 0;
+                for (int k = first; k < last; ++k) sum += slots[c][k][l];
+                colors[c] = divideSum(sum, last - first);
+            }
+        }
+    }
+}
+
+// Sums over values counted in 256 bins: of the ranks [first, last), and of
+// the `ranks` smallest or largest.
+inline uint32_t sumRanks(const uint32_t *bins, int first, int last) {
+    int v = 0, rank = 0;
+    for (; rank + static_cast<int>(bins[v]) <= first; ++v) rank += bins[v];
+    uint32_t sum = 0;
+    for (; rank < last; ++v) {
+        const int take = std::min(rank + static_cast<int>(bins[v]), last) - std::max(rank, first);
+        sum += static_cast<uint32_t>(v * take);
+        rank += bins[v];
+    }
+    return sum;
+}
+
+inline uint32_t sumLowest(const uint32_t *bins, int ranks) {
+    uint32_t sum = 0;
+    for (int v = 0; ranks > 0; ++v) {
+        const int take = std::min(ranks, static_cast<int>(bins[v]));
+        sum += static_cast<uint32_t>(v * take);
+        ranks -= take;
+    }
+    return sum;
+}
+
+inline uint32_t sumHighest(const uint32_t *bins, int ranks) {
+    uint32_t sum = 0;
+    for (int v = 255; ranks > 0; --v) {
+        const int take = std::min(ranks, static_cast<int>(bins[v]));
+        sum += static_cast<uint32_t>(v * take);
+        ranks -= take;
+    }
+    return sum;
+}
+
+// Larger blocks count each channel into 256 bins. The median walks them up
+// to the middle; the trimmed mean only walks the two dropped quarters and
+// takes them off the block's total.
+template <int Channels, bool Trimmed>
+void reduceBlockRanked(const ConstImageView &src, int x0, int x1, int y0, int y1, uint8_t *color) {
+    thread_local std::vector<uint32_t> histogram(Channels * 256, 0);
+    uint32_t *bins = histogram.data();
+
+    uint32_t total[Channels] = {};
+    for (int by = y0; by < y1; ++by) {
+        const uint8_t *p = src.row(by) + x0 * Channels;
+        for (int bx = x0; bx < x1; ++bx, p += Channels) {
+            for (int c = 0; c < Channels; ++c) {
+                ++bins[c * 256 + p[c]];
+                if (Trimmed) total[c] += p[c];
+            }
+        }
+    }
+
+    const int count = (x1 - x0) * (y1 - y0);
+    int first, last;
+    rankRange(Trimmed, count, first, last);
+    for (int c = 0; c < Channels; ++c) {
+        const uint32_t *channel = bins + c * 256;
+        const uint32_t sum = Trimmed ? total[c] - sumLowest(channel, first) - sumHighest(channel, count - last)
+                                     : sumRanks(channel, first, last);
+        color[c] = divideSum(sum, last - first);
+    }
+    std::fill(histogram.begin(), histogram.end(), 0u);
+}
+
+template <int Channels, bool Trimmed>
+void reduceBlockRowRanked(const ConstImageView &src, int startX, int blockSize, int y0, int y1, uint8_t *colors) {
+    for (int x = startX; x < src.width; x += blockSize, colors += Channels) {
+        reduceBlockRanked<Channels, Trimmed>(src, std::max(x, 0), std::min(x + blockSize, src.width), y0, y1,
+                                             colors);
+    }
+}
+
+using ReduceRowFn = void (*)(const ConstImageView &, int, int, int, int, uint8_t *);
+
+// Specialised reducers by block size, one per channel count (1, 3, 4).
+struct ReducerEntry {
+    int blockSize;
+    ReduceRowFn reduce[3];
+};
+
+template <int BlockSize>
+constexpr ReducerEntry fixedReducers() {
+    return {BlockSize,
+            {reduceBlockRowFixed<1, BlockSize>, reduceBlockRowFixed<3, BlockSize>, reduceBlockRowFixed<4, BlockSize>}};
+}
+
+const ReducerEntry kFixedReducers[] = {
+    fixedReducers<2>(), fixedReducers<4>(), fixedReducers<8>(), fixedReducers<16>(), fixedReducers<32>(),
+};
+
+inline int channelIndex(int channels) {
+    return channels == 1 ? 0 : channels == 3 ? 1 : 2;
+}
+
+ReduceRowFn selectReducer(int channels, int blockSize, ReduceKernel kernel, BlockSampling sampling) {
+    if (sampling == BlockSampling::Dominant) {
+        static const ReduceRowFn dominant[3] = {reduceBlockRowDominant<1>, reduceBlockRowDominant<3>,
+                                                reduceBlockRowDominant<4>};
+        return dominant[channelIndex(channels)];
+    }
+    if (sampling == BlockSampling::Median || sampling == BlockSampling::TrimmedMean) {
+        // [trimmed][sorting network][channels]
+        static const ReduceRowFn ranked[2][2][3] = {
+            {{reduceBlockRowRanked<1, false>, reduceBlockRowRanked<3, false>, reduceBlockRowRanked<4, false>},
+             {reduceBlockRowNetwork<1, false>, reduceBlockRowNetwork<3, false>, reduceBlockRowNetwork<4, false>}},
+            {{reduceBlockRowRanked<1, true>, reduceBlockRowRanked<3, true>, reduceBlockRowRanked<4, true>},
+             {reduceBlockRowNetwork<1, true>, reduceBlockRowNetwork<3, true>, reduceBlockRowNetwork<4, true>}}};
+        return ranked[sampling == BlockSampling::TrimmedMean][blockSize <= kMaxNetworkBlock][channelIndex(channels)];
+    }
+    if (kernel == ReduceKernel::Auto) {
+        for (const ReducerEntry &entry : kFixedReducers) {
+            if (entry.blockSize == blockSize) return entry.reduce[channelIndex(channels)];
+        }
+    }
+    if (kernel == ReduceKernel::Separable || kernel == ReduceKernel::Auto) {
+        static const ReduceRowFn separable[3] = {reduceBlockRowSeparable<1>, reduceBlockRowSeparable<3>,
+                                                 reduceBlockRowSeparable<4>};
+        return separable[channelIndex(channels)];
+    }
+    if (kernel == ReduceKernel::Division) {
+        static const ReduceRowFn division[3] = {reduceBlockRow<1, false>, reduceBlockRow<3, false>,
+                                                reduceBlockRow<4, false>};
+        return division[channelIndex(channels)];
+    }
+    static const ReduceRowFn generic[3] = {reduceBlockRow<1>, reduceBlockRow<3>, reduceBlockRow<4>};
+    return generic[channelIndex(channels)];
+}
+
+// Writes one output row from the block colours.
+template <int Channels>
+void expandRow(const uint8_t *colors, int startX, int blockSize, int width, uint8_t *row) {
+    for (int x = startX; x < width; x += blockSize, colors += Channels) {
+        const int x0 = std::max(x, 0);
+        const int x1 = std::min(x + blockSize, width);
+        uint8_t *p = row + x0 * Channels;
+        for (int bx = x0; bx < x1; ++bx, p += Channels) std::memcpy(p, colors, Channels);
+    }
+}
+
+// Every row of a block row is identical: expand the first one in place in
+// the destination, then copy it down, so most of the fill is a plain memcpy.
+template <int Channels>
+void pixelateBlockRows(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid,
+                       ReduceRowFn reduce, int firstBlockRow, int lastBlockRow) {
+    const int blockSize = grid.blockSize;
+    const int startX = gridStart(grid.phaseX, blockSize);
+    const int startY = gridStart(grid.phaseY, blockSize);
+    const int blockColumns = (src.width - startX + blockSize - 1) / blockSize;
+    const size_t rowBytes = static_cast<size_t>(src.width) * Channels;
+
+    // The whole block row is reduced before any of it is written, which
+    // keeps in-place calls (src == dst) correct.
+    thread_local std::vector<uint8_t> colors;
+    colors.resize(static_cast<size_t>(blockColumns) * Channels);
+
+    for (int blockRow = firstBlockRow; blockRow < lastBlockRow; ++blockRow) {
+        const int y = startY + blockRow * blockSize;
+        const int y0 = std::max(y, 0);
+        const int y1 = std::min(y + blockSize, src.height);
+
+        reduce(src, startX, blockSize, y0, y1, colors.data());
+        uint8_t *first = dst.row(y0);
+        expandRow<Channels>(colors.data(), startX, blockSize, src.width, first);
+        for (int by = y0 + 1; by < y1; ++by) std::memcpy(dst.row(by), first, rowBytes);
+    }
+}
+
+void copyRows(const ConstImageView &src, const ImageView &dst) {
+    if (src.data == dst.data) return;
+    const size_t rowBytes = static_cast<size_t>(src.width) * bytesPerPixel(src.format);
+    for (int y = 0; y < src.height; ++y) std::memcpy(dst.row(y), src.row(y), rowBytes);
+}
+
+} // namespace
+
+const char *blockSamplingName(BlockSampling sampling) {
+    switch (sampling) {
+        case BlockSampling::Mean: return "mean";
+        case BlockSampling::Oklab: return "oklab";
+        case BlockSampling::Dominant: return "dominant";
+        case BlockSampling::Median: return "median";
+        case BlockSampling::TrimmedMean: return "trimmed-mean";
+    }
+    return "?";
+}
+
+bool parseBlockSampling(const char *name, BlockSampling &sampling) {
+    for (BlockSampling s : {BlockSampling::Mean, BlockSampling::Oklab, BlockSampling::Dominant,
+                            BlockSampling::Median, BlockSampling::TrimmedMean}) {
+        if (!std::strcmp(name, blockSamplingName(s))) {
+            sampling = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *blockShapeName(BlockShape shape) {
+    switch (shape) {
+        case BlockShape::Square: return "square";
+        case BlockShape::Hexagon: return "hexagon";
+        case BlockShape::Triangle: return "triangle";
+        case BlockShape::Dot: return "dot";
+    }
+    return "?";
+}
+
+bool parseBlockShape(const char *name, BlockShape &shape) {
+    for (BlockShape s : {BlockShape::Square, BlockShape::Hexagon, BlockShape::Triangle, BlockShape::Dot}) {
+        if (!std::strcmp(name, blockShapeName(s))) {
+            shape = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool pixelate(const ConstImageView &src, const ImageView &dst, const PixelateParams &params) {
+    if (!isValid(src) || !isValid(dst) || src.width != dst.width || src.height != dst.height ||
+        src.format != dst.format) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("pixelate");
+    GridGeometry grid = params.grid;
+    if (grid.blockSize <= 1) {
+        copyRows(src, dst);
+        return true;
+    }
+    grid.phaseX = std::max(grid.phaseX, 0);
+    grid.phaseY = std::max(grid.phaseY, 0);
+    if (params.shape != BlockShape::Square) return pixelateMosaic(src, dst, grid, params.shape, params.threads);
+    if (params.angle != 0.0) return pixelateRotated(src, dst, grid, params.angle, params.threads);
+    if (params.sampling == BlockSampling::Oklab) return pixelateOklab(src, dst, grid, params.threads);
+
+    // Block rows are independent, so bands of them go to the thread pool.
+    const int startY = gridStart(grid.phaseY, grid.blockSize);
+    const int blockRows = (src.height - startY + grid.blockSize - 1) / grid.blockSize;
+
+    const int channels = bytesPerPixel(src.format);
+    const ReduceRowFn reduce = selectReducer(channels, grid.blockSize, params.kernel, params.sampling);
+
+    parallelFor(0, blockRows, params.threads, [&](int first, int last) {
+        I2P_TRACE_SPAN("pixelate.rows");
+        switch (channels) {
+            case 1: pixelateBlockRows<1>(src, dst, grid, reduce, first, last); break;
+            case 3: pixelateBlockRows<3>(src, dst, grid, reduce, first, last); break;
+            default: pixelateBlockRows<4>(src, dst, grid, reduce, first, last); break;
+        }
+    });
+    return true;
+}
+
+} // namespace i2p
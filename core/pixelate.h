@@ -0,0 +1,65 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+
+namespace i2p {
+
+// Geometry of the pixelation grid: block edges fall on x = phaseX + k * blockSize
+// (and likewise for y). A block size of 1 means "no grid".
+struct GridGeometry {
+    int blockSize = 1;
+    int phaseX = 0;
+    int phaseY = 0;
+};
+
+// Which averaging kernel pixelate() uses. Every kernel produces identical
+// output; the choice exists so the benchmark can measure each one.
+enum class ReduceKernel {
+    Auto,       // specialised for 2-32 if a power of two, otherwise separable
+    Generic,    // runtime block size, reciprocal-table division
+    Division,   // runtime block size, hardware division per block
+    Separable   // row-streaming horizontal sums added up over the block rows
+};
+
+// How a block's colour is taken from its pixels.
+enum class BlockSampling {
+    Mean,       // per-channel mean of the stored sRGB values
+    Oklab,      // mean in the Oklab perceptual space (see oklab.h)
+    Dominant,   // mean of the most frequent colour, from a 4-bit-per-channel histogram
+    Median,     // per-channel median, robust against outlying pixels
+    TrimmedMean // per-channel mean of the middle half, lowest and highest quarter dropped
+};
+
+I2P_API const char *blockSamplingName(BlockSampling sampling);
+I2P_API bool parseBlockSampling(const char *name, BlockSampling &sampling);
+
+// Shape of the cells the image is tiled with; the block size sets their
+// width (see mosaic.h for the other shapes).
+enum class BlockShape {
+    Square,
+    Hexagon,    // pointy-top hexagons, alternate rows offset by half a cell
+    Triangle,   // alternating up and down triangles, rows mirrored
+    Dot         // a disc in every square block, on a black background
+};
+
+I2P_API const char *blockShapeName(BlockShape shape);
+I2P_API bool parseBlockShape(const char *name, BlockShape &shape);
+
+struct PixelateParams {
+    GridGeometry grid;
+    int threads = 0;    // 0 = use every hardware thread
+    ReduceKernel kernel = ReduceKernel::Auto;   // Mean sampling only
+    BlockSampling sampling = BlockSampling::Mean;
+    BlockShape shape = BlockShape::Square;      // other shapes always take the mean
+    double angle = 0.0;     // degrees; turns a grid of squares, which then always take the mean (rotated.h)
+};
+
+// Replaces every grid cell by one colour, by default its per-channel mean
+// (truncated, as the original QColor implementation did). Source and destination must have the
+// same size and format; they may be the same buffer. Returns false for
+// invalid or mismatched views. Non-square shapes go to pixelateMosaic(), turned
+// squares to pixelateRotated().
+I2P_API bool pixelate(const ConstImageView &src, const ImageView &dst, const PixelateParams &params);
+
+} // namespace i2p
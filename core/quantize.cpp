@@ -0,0 +1,185 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+inline int gridStart(int phase, int blockSize) {
+    int offset = phase % blockSize;
+    return offset ? offset - blockSize : 0;
+}
+
+inline uint8_t component(const Color &color, int axis) {
+    return axis == 0 ? color.r : axis == 1 ? color.g : color.b;
+}
+
+// Samples [begin, end) with their bounding box in RGB.
+struct ColorBox {
+    int begin;
+    int end;
+    uint8_t low[3];
+    uint8_t high[3];
+
+    int longestAxis() const {
+        int axis = 0;
+        for (int c = 1; c < 3; ++c) {
+            if (high[c] - low[c] > high[axis] - low[axis]) axis = c;
+        }
+        return axis;
+    }
+    int spread() const { return high[longestAxis()] - low[longestAxis()]; }
+};
+
+ColorBox makeBox(const std::vector<Color> &samples, int begin, int end) {
+    ColorBox box{begin, end, {255, 255, 255}, {0, 0, 0}};
+    for (int i = begin; i < end; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            box.low[c] = std::min(box.low[c], component(samples[i], c));
+            box.high[c] = std::max(box.high[c], component(samples[i], c));
+        }
+    }
+    return box;
+}
+
+Palette medianCut(std::vector<Color> samples, int colors) {
+    std::vector<ColorBox> boxes{makeBox(samples, 0, static_cast<int>(samples.size()))};
+    while (static_cast<int>(boxes.size()) < colors) {
+        // Split the box whose widest side, weighted by its sample count, is
+        // largest; boxes of one colour cannot be split.
+        int chosen = -1;
+        uint64_t chosenScore = 0;
+        for (int i = 0; i < static_cast<int>(boxes.size()); ++i) {
+            const uint64_t score = static_cast<uint64_t>(boxes[i].spread()) * (boxes[i].end - boxes[i].begin);
+            if (score > chosenScore) {
+                chosenScore = score;
+                chosen = i;
+            }
+        }
+        if (chosen < 0) break;
+
+        const ColorBox box = boxes[chosen];
+        const int axis = box.longestAxis();
+        auto first = samples.begin() + box.begin;
+        auto last = samples.begin() + box.end;
+        std::nth_element(first, first + (box.end - box.begin) / 2, last,
+                         [axis](const Color &a, const Color &b) { return component(a, axis) < component(b, axis); });
+        // Cut between distinct values so no colour lands in both halves:
+        // below the median value, or up to it when the median is the minimum.
+        const uint8_t median = component(first[(box.end - box.begin) / 2], axis);
+        const bool includeMedian = median == box.low[axis];
+        auto cut = std::partition(first, last, [axis, median, includeMedian](const Color &c) {
+            return includeMedian ? component(c, axis) <= median : component(c, axis) < median;
+        });
+        const int middle = static_cast<int>(cut - samples.begin());
+        boxes[chosen] = makeBox(samples, box.begin, middle);
+        boxes.push_back(makeBox(samples, middle, box.end));
+    }
+
+    Palette palette;
+    for (const ColorBox &box : boxes) {
+        uint64_t sum[3] = {};
+        for (int i = box.begin; i < box.end; ++i) {
+            for (int c = 0; c < 3; ++c) sum[c] += component(samples[i], c);
+        }
+        const uint64_t count = box.end - box.begin;
+        palette.push_back({static_cast<uint8_t>((sum[0] + count / 2) / count),
+                           static_cast<uint8_t>((sum[1] + count / 2) / count),
+                           static_cast<uint8_t>((sum[2] + count / 2) / count)});
+    }
+    return palette;
+}
+
+// Lloyd iterations from a starting palette: assign every sample to its
+// nearest centre (in parallel, with the SIMD matcher), move each centre to
+// the mean of its samples, and stop once no assignment changes.
+Palette refineKMeans(const std::vector<Color> &samples, Palette centers, int threads) {
+    constexpr int kMaxIterations = 8;
+    const int k = static_cast<int>(centers.size());
+    std::vector<uint8_t> assignment(samples.size(), 0);
+    PaletteMatcher matcher;
+
+    for (int iteration = 0; iteration < kMaxIterations; ++iteration) {
+        matcher.reset(centers);
+        std::vector<uint64_t> sums(static_cast<size_t>(k) * 3, 0);
+        std::vector<uint64_t> counts(k, 0);
+        size_t changed = 0;
+        std::mutex merge;
+
+        parallelFor(0, static_cast<int>(samples.size()), threads, [&](int first, int last) {
+            std::vector<uint64_t> localSums(static_cast<size_t>(k) * 3, 0);
+            std::vector<uint64_t> localCounts(k, 0);
+            size_t localChanged = 0;
+            for (int i = first; i < last; ++i) {
+                const int nearest = matcher.nearest(samples[i]);
+                if (nearest != assignment[i]) {
+                    assignment[i] = static_cast<uint8_t>(nearest);
+                    ++localChanged;
+                }
+                localSums[3 * nearest] += samples[i].r;
+                localSums[3 * nearest + 1] += samples[i].g;
+                localSums[3 * nearest + 2] += samples[i].b;
+                ++localCounts[nearest];
+            }
+            // Integer totals, so the merge order does not change the result.
+            std::lock_guard<std::mutex> lock(merge);
+            for (size_t j = 0; j < sums.size(); ++j) sums[j] += localSums[j];
+            for (int j = 0; j < k; ++j) counts[j] += localCounts[j];
+            changed += localChanged;
+        });
+
+        if (iteration > 0 && changed == 0) break;
+        for (int j = 0; j < k; ++j) {
+            const uint64_t count = counts[j];
+            if (!count) continue;   // empty cluster keeps its centre
+            centers[j] = {static_cast<uint8_t>((sums[3 * j] + count / 2) / count),
+                          static_cast<uint8_t>((sums[3 * j + 1] + count / 2) / count),
+                          static_cast<uint8_t>((sums[3 * j + 2] + count / 2) / count)};
+        }
+    }
+    return centers;
+}
+
+} // namespace
+
+std::vector<Color> sampleBlockColors(const ConstImageView &image, int blockSize, int phaseX, int phaseY,
+                                     int maxSamples) {
+    std::vector<Color> samples;
+    if (!isValid(image)) return samples;
+
+    blockSize = std::max(blockSize, 1);
+    const int startX = gridStart(std::max(phaseX, 0), blockSize);
+    const int startY = gridStart(std::max(phaseY, 0), blockSize);
+    const int columns = (image.width - startX + blockSize - 1) / blockSize;
+    const int rows = (image.height - startY + blockSize - 1) / blockSize;
+
+    // Every step-th cell in both directions keeps the count under maxSamples.
+    const double cells = static_cast<double>(columns) * rows;
+    const int step = cells > maxSamples ? static_cast<int>(std::ceil(std::sqrt(cells / std::max(maxSamples, 1)))) : 1;
+    const int bpp = bytesPerPixel(image.format);
+    samples.reserve(static_cast<size_t>((columns + step - 1) / step) * ((rows + step - 1) / step));
+    for (int row = 0; row < rows; row += step) {
+        const uint8_t *line = image.row(std::max(startY + row * blockSize, 0));
+        for (int column = 0; column < columns; column += step) {
+            const int x = std::max(startX + column * blockSize, 0);
+            samples.push_back(readColor(line + x * bpp, image.format));
+        }
+    }
+    return samples;
+}
+
+Palette buildPalette(const std::vector<Color> &samples, int colors, QuantizeMethod method, int threads) {
+    if (samples.empty() || colors < 1) return Palette();
+    I2P_TRACE_SPAN("palette.build");
+    Palette palette = medianCut(samples, std::min(colors, kMaxPaletteSize));
+    if (method == QuantizeMethod::KMeans) palette = refineKMeans(samples, palette, threads);
+    return palette;
+}
+
+} // namespace i2p
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include "export.h"
+#include "image.h"
+#include "palette.h"
+
+namespace i2p {
+
+enum class QuantizeMethod {
+    MedianCut,  // split the colour box with the widest spread at its median
+    KMeans      // median cut, refined by Lloyd iterations
+};
+
+// One colour per cell of the grid with the given block size and phase
+// (the top-left pixel of each cell, clipped to the image). After pixelation
+// every cell is flat, so these are the block colours. Grids with more cells
+// than maxSamples are subsampled evenly.
+I2P_API std::vector<Color> sampleBlockColors(const ConstImageView &image, int blockSize, int phaseX, int phaseY,
+                                             int maxSamples = 1 << 16);
+
+// Palette of at most `colors` entries (1-256) for the samples; fewer when
+// the samples hold fewer distinct colours. Empty for empty input.
+I2P_API Palette buildPalette(const std::vector<Color> &samples, int colors, QuantizeMethod method,
+                             int threads = 0);
+
+} // namespace i2p
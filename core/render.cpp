@@ -0,0 +1,163 @@
+#include "render.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace i2p {
+
+namespace {
+
+constexpr long long kLutBlockThreshold = 1 << 16;
+
+long long gridBlockCount(int size, int blockSize, int phase) {
+    if (blockSize <= 1) return size;
+    const int offset = phase % blockSize;
+    const int start = offset ? offset - blockSize : 0;
+    return (size - start + blockSize - 1) / blockSize;
+}
+
+bool pixelateStage(const ConstImageView &src, const ImageView &dst, const RenderParams &params, RenderStats *stats) {
+    if (params.mode == PixelateMode::Adaptive) {
+        AdaptiveParams adaptive;
+        adaptive.minBlockSize = params.pixelate.grid.blockSize;
+        adaptive.maxBlockSize = params.maxBlockSize;
+        adaptive.maxDeviation = params.maxDeviation;
+        adaptive.phaseX = params.pixelate.grid.phaseX;
+        adaptive.phaseY = params.pixelate.grid.phaseY;
+        adaptive.threads = params.pixelate.threads;
+        return pixelateAdaptive(src, dst, adaptive, stats ? &stats->blocks : nullptr);
+    }
+
+    if (!pixelate(src, dst, params.pixelate)) return false;
+    if (stats) {
+        const GridGeometry &grid = params.pixelate.grid;
+        stats->blocks = gridBlockCount(src.width, grid.blockSize, std::max(grid.phaseX, 0)) *
+                        gridBlockCount(src.height, grid.blockSize, std::max(grid.phaseY, 0));
+    }
+    return true;
+}
+
+// Palette and dithering on the pixelated image, block by block of `grid`.
+bool paletteStage(const ImageView &dst, const GridGeometry &grid, const RenderParams &params, RenderStats *stats) {
+    const int threads = params.pixelate.threads;
+    const bool fixedPalette = params.palette && !params.palette->empty();
+    if (!fixedPalette && params.colors <= 0) return true;
+
+    // A fitted palette comes from the block colours rather than from every
+    // pixel, and before dithering; adaptive blocks are sampled on the grid of
+    // their smallest size.
+    const Palette palette = fixedPalette ? params.palette->palette()
+                                         : buildPalette(sampleBlockColors(dst, grid.blockSize, grid.phaseX, grid.phaseY),
+                                                        params.colors, params.quantize, threads);
+    // Error diffusion maps the blocks itself; ordered dithering only
+    // offsets them before the remap.
+    const bool diffuse = isErrorDiffusion(params.dither);
+    if (!diffuse &&
+        !applyOrderedDither(dst, grid, params.dither, ditherSpread(static_cast<int>(palette.size())), threads))
+        return false;
+
+    bool mapped;
+    if (fixedPalette) {
+        mapped = diffuse ? applyErrorDiffusion(dst, grid, params.dither, *params.palette, threads)
+                         : remapToPalette(dst, *params.palette, threads);
+    } else {
+        // Searching costs about one match per block; past kLutBlockThreshold
+        // blocks building the lookup cube once is cheaper.
+        const long long blocks = gridBlockCount(dst.width, grid.blockSize, std::max(grid.phaseX, 0)) *
+                                 gridBlockCount(dst.height, grid.blockSize, std::max(grid.phaseY, 0));
+        PaletteLut lut;
+        if (blocks > kLutBlockThreshold) {
+            mapped = lut.build(palette, ColorMetric::Rgb, threads) &&
+                     (diffuse ? applyErrorDiffusion(dst, grid, params.dither, lut, threads)
+                              : remapToPalette(dst, lut, threads));
+        } else {
+            mapped = diffuse ? applyErrorDiffusion(dst, grid, params.dither, palette, threads)
+                             : remapToPalette(dst, palette, threads);
+        }
+    }
+    if (!mapped) return false;
+    if (stats) stats->palette = palette;
+    return true;
+}
+
+// The lattice modes run the palette stages on their cells, one pixel per
+// cell, so dithering and the fitted palette see the cells exactly; the
+// cells are then painted back at full size.
+template <typename Average, typename Fill>
+bool renderCells(const ConstImageView &src, int columns, int rows, const RenderParams &params, RenderStats *stats,
+                 Average average, Fill fill) {
+    const int channels = bytesPerPixel(src.format);
+    std::vector<uint8_t> lattice(static_cast<size_t>(columns) * rows * channels);
+    const ImageView cells{lattice.data(), columns, rows, static_cast<ptrdiff_t>(columns) * channels, src.format};
+    if (!average(cells)) return false;
+    if (stats) stats->blocks = static_cast<long long>(columns) * rows;
+    return paletteStage(cells, GridGeometry(), params, stats) && fill(cells);
+}
+
+bool sameShape(const ConstImageView &src, const ImageView &dst) {
+    return isValid(src) && isValid(dst) && src.width == dst.width && src.height == dst.height &&
+           src.format == dst.format;
+}
+
+bool renderTarget(const ConstImageView &src, const ImageView &dst, const RenderParams &params, RenderStats *stats) {
+    if (!sameShape(src, dst) || params.gridColumns < 1 || params.gridRows < 1) return false;
+
+    // A grid finer than the image is the image itself.
+    const int threads = params.pixelate.threads;
+    return renderCells(
+        src, std::min(params.gridColumns, src.width), std::min(params.gridRows, src.height), params, stats,
+        [&](const ImageView &cells) { return averageCells(src, cells, threads); },
+        [&](const ConstImageView &cells) { return expandCells(cells, dst, threads); });
+}
+
+// Non-square shapes: the lattice has no block grid for the palette stages
+// to sample, and Dot gaps must stay black.
+bool renderMosaic(const ConstImageView &src, const ImageView &dst, const RenderParams &params, RenderStats *stats) {
+    const PixelateParams &p = params.pixelate;
+    int columns = 0;
+    int rows = 0;
+    if (!sameShape(src, dst) || !mosaicCellCount(src.width, src.height, p.grid, p.shape, columns, rows)) return false;
+
+    return renderCells(
+        src, columns, rows, params, stats,
+        [&](const ImageView &cells) { return averageMosaicCells(src, cells, p.grid, p.shape, p.threads); },
+        [&](const ConstImageView &cells) { return fillMosaicCells(cells, dst, p.grid, p.shape, p.threads); });
+}
+
+// Turned squares, whose edges no block grid follows either.
+bool renderRotated(const ConstImageView &src, const ImageView &dst, const RenderParams &params, RenderStats *stats) {
+    const PixelateParams &p = params.pixelate;
+    int columns = 0;
+    int rows = 0;
+    if (!sameShape(src, dst) || !rotatedCellCount(src.width, src.height, p.grid, p.angle, columns, rows)) return false;
+
+    return renderCells(
+        src, columns, rows, params, stats,
+        [&](const ImageView &cells) { return averageRotatedCells(src, cells, p.grid, p.angle, p.threads); },
+        [&](const ConstImageView &cells) { return fillRotatedCells(cells, dst, p.grid, p.angle, p.threads); });
+}
+
+} // namespace
+
+bool render(const ConstImageView &src, const ImageView &dst, const RenderParams &params, RenderStats *stats) {
+    // Both dithering stages work on a uniform block grid, which quadtree
+    // leaves do not follow: Bayer thresholds would give a leaf several
+    // offsets, and error diffusion would repaint it as grid cells.
+    if (params.mode == PixelateMode::Adaptive && params.dither != DitherMethod::None) return false;
+    if (params.mode == PixelateMode::Target) return renderTarget(src, dst, params, stats);
+    if (params.mode == PixelateMode::Grid && params.pixelate.grid.blockSize > 1) {
+        if (params.pixelate.shape != BlockShape::Square) return renderMosaic(src, dst, params, stats);
+        if (params.pixelate.angle != 0.0) return renderRotated(src, dst, params, stats);
+    }
+    return pixelateStage(src, dst, params, stats) && paletteStage(dst, params.pixelate.grid, params, stats);
+}
+
+bool isStreamable(const RenderParams &params) {
+    // Bands are mapped by streamSynthetic with pixelate() alone, and a
+    // fitted palette depends on the whole image anyway. Hexagon, triangle
+    // and turned cells straddle the block rows bands are cut along.
+    return params.mode == PixelateMode::Grid && params.pixelate.shape == BlockShape::Square &&
+           params.pixelate.angle == 0.0 && params.colors <= 0 && !params.palette;
+}
+
+} // namespace i2p
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "adaptive.h"
+#include "dither.h"
+#include "export.h"
+#include "image.h"
+#include "mosaic.h"
+#include "pixelate.h"
+#include "quantize.h"
+#include "resample.h"
+#include "rotated.h"
+
+namespace i2p {
+
+enum class PixelateMode {
+    Grid,       // uniform blocks, pixelate(); mosaic cells for non-square shapes, turned by the angle
+    Adaptive,   // quadtree blocks, pixelateAdaptive()
+    Target      // a fixed grid of fractional cells, averageCells()
+};
+
+// Everything the front ends need to produce the output pixels, so the GUI,
+// its headless mode and the core CLI share one code path.
+struct RenderParams {
+    PixelateMode mode = PixelateMode::Grid;
+    PixelateParams pixelate;        // Adaptive uses its block size as the minimum
+    int maxBlockSize = 64;
+    int maxDeviation = 10;
+    int gridColumns = 0;            // Target: output grid in cells, clamped to the image size
+    int gridRows = 0;
+    int colors = 0;                 // palette size after pixelation, 0 = keep every colour
+    QuantizeMethod quantize = QuantizeMethod::KMeans;
+    const PaletteLut *palette = nullptr;   // fixed palette to map to; takes precedence over colors
+    DitherMethod dither = DitherMethod::None;   // ordered or error diffusion, if there is a palette
+};
+
+struct RenderStats {
+    long long blocks = 0;   // output blocks, counting partial edge blocks (cells in Target, mosaic and turned grids)
+    Palette palette;        // the colours used, when quantizing
+};
+
+// Same view rules as pixelate(); in-place calls are allowed. Fails for
+// Adaptive with any dithering.
+I2P_API bool render(const ConstImageView &src, const ImageView &dst, const RenderParams &params,
+                    RenderStats *stats = nullptr);
+
+// True when render() can run band by band (see streamSynthetic), i.e. every
+// output row depends only on its own block row.
+I2P_API bool isStreamable(const RenderParams &params);
+
+} // namespace i2p
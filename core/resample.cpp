@@ -0,0 +1,207 @@
+#include "resample.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+// Coverage of one cell along one axis of `pixels` pixels split into `cells`
+// cells. Measured in 1/cells of a pixel, cell i spans [i * pixels,
+// (i + 1) * pixels), so every overlap is a whole number: pixels strictly
+// inside the cell weigh `cells`, the first and last pixel weigh `head` and
+// `tail`, and the weights of one cell add up to `pixels`.
+struct AxisSpan {
+    int first = 0;
+    int last = 0;       // == first when the cell lies inside one pixel
+    uint32_t head = 0;
+    uint32_t tail = 0;  // 0 when last == first
+};
+
+std::vector<AxisSpan> axisSpans(int pixels, int cells) {
+    std::vector<AxisSpan> spans(cells);
+    for (int i = 0; i < cells; ++i) {
+        const int64_t begin = static_cast<int64_t>(i) * pixels;
+        const int64_t end = begin + pixels;
+        AxisSpan &span = spans[i];
+        span.first = static_cast<int>(begin / cells);
+        span.last = static_cast<int>((end - 1) / cells);
+        if (span.first == span.last) {
+            span.head = static_cast<uint32_t>(pixels);
+        } else {
+            span.head = static_cast<uint32_t>((span.first + 1) * static_cast<int64_t>(cells) - begin);
+            span.tail = static_cast<uint32_t>(end - span.last * static_cast<int64_t>(cells));
+        }
+    }
+    return spans;
+}
+
+// First pixel of every cell when each pixel goes to the cell holding its
+// centre: pixel x belongs to cell i once (2x + 1) * cells >= 2 * i * pixels.
+// The last entry is `pixels`.
+std::vector<int> centreRuns(int pixels, int cells) {
+    std::vector<int> runs(cells + 1);
+    for (int i = 0; i < cells; ++i) {
+        const int64_t numerator = 2 * static_cast<int64_t>(i) * pixels - cells;
+        const int64_t step = 2 * static_cast<int64_t>(cells);
+        runs[i] = numerator <= 0 ? 0 : static_cast<int>((numerator + step - 1) / step);
+    }
+    runs[cells] = pixels;
+    return runs;
+}
+
+// Weighted sum over one cell column of a row of per-channel values.
+template <int Channels, typename T>
+inline void spanSum(const T *line, const AxisSpan &span, uint32_t full, uint64_t *sum) {
+    const T *head = line + span.first * Channels;
+    const T *tail = line + span.last * Channels;
+    uint64_t inner[Channels] = {};
+    for (const T *p = head + Channels; p < tail; p += Channels) {
+        for (int c = 0; c < Channels; ++c) inner[c] += p[c];
+    }
+    for (int c = 0; c < Channels; ++c) {
+        sum[c] = uint64_t(span.head) * head[c] + uint64_t(full) * inner[c] + uint64_t(span.tail) * tail[c];
+    }
+}
+
+// Truncating sum / area. The floating-point quotient is off by at most one
+// either way, which the two comparisons correct.
+inline uint8_t divideArea(uint64_t sum, uint64_t area, double inverse) {
+    uint64_t quotient = static_cast<uint64_t>(static_cast<double>(sum) * inverse);
+    if (quotient * area > sum) {
+        --quotient;
+    } else if ((quotient + 1) * area <= sum) {
+        ++quotient;
+    }
+    return static_cast<uint8_t>(quotient);
+}
+
+// Cell rows [firstRow, lastRow), separably. The rows strictly inside a
+// cell row all weigh the same, so they are summed into one row with plain
+// adds; that row and the two edge rows are then weighted along each cell
+// column, and the three results by their row weights. Per pixel this is one
+// add, as in the integer kernel; the weights apply once per cell.
+template <int Channels>
+void averageCellRows(const ConstImageView &src, const ImageView &cells, const std::vector<AxisSpan> &columns,
+                     const std::vector<AxisSpan> &rows, int firstRow, int lastRow) {
+    const uint64_t area = static_cast<uint64_t>(src.width) * src.height;
+    const double inverse = 1.0 / static_cast<double>(area);
+    const uint32_t fullColumn = static_cast<uint32_t>(cells.width);
+    const uint64_t fullRow = static_cast<uint64_t>(cells.height);
+    const size_t rowValues = static_cast<size_t>(src.width) * Channels;
+    std::vector<uint32_t> inner(rowValues);
+
+    for (int r = firstRow; r < lastRow; ++r) {
+        const AxisSpan &row = rows[r];
+        const int innerRows = std::max(row.last - row.first - 1, 0);
+        if (innerRows > 1) {
+            std::fill(inner.begin(), inner.end(), 0u);
+            for (int y = row.first + 1; y < row.last; ++y) {
+                const uint8_t *line = src.row(y);
+                for (size_t i = 0; i < rowValues; ++i) inner[i] += line[i];
+            }
+        }
+        const uint8_t *headLine = src.row(row.first);
+        const uint8_t *tailLine = src.row(row.last);
+        // A single inner row is read in place.
+        const uint8_t *innerLine = innerRows == 1 ? src.row(row.first + 1) : nullptr;
+
+        uint8_t *out = cells.row(r);
+        for (const AxisSpan &column : columns) {
+            uint64_t head[Channels], middle[Channels] = {}, tail[Channels] = {};
+            spanSum<Channels>(headLine, column, fullColumn, head);
+            if (innerLine) {
+                spanSum<Channels>(innerLine, column, fullColumn, middle);
+            } else if (innerRows) {
+                spanSum<Channels>(inner.data(), column, fullColumn, middle);
+            }
+            if (row.tail) spanSum<Channels>(tailLine, column, fullColumn, tail);
+            for (int c = 0; c < Channels; ++c) {
+                const uint64_t sum = row.head * head[c] + fullRow * middle[c] + row.tail * tail[c];
+                out[c] = divideArea(sum, area, inverse);
+            }
+            out += Channels;
+        }
+    }
+}
+
+// Cell rows [firstRow, lastRow) of dst: the first pixel row of each is
+// expanded from the cells, the rest are copies of it.
+template <int Channels>
+void expandCellRows(const ConstImageView &cells, const ImageView &dst, const std::vector<int> &columnRuns,
+                    const std::vector<int> &rowRuns, int firstRow, int lastRow) {
+    const size_t rowBytes = static_cast<size_t>(dst.width) * Channels;
+    for (int r = firstRow; r < lastRow; ++r) {
+        const int y0 = rowRuns[r];
+        const int y1 = rowRuns[r + 1];
+        const uint8_t *color = cells.row(r);
+        uint8_t *first = dst.row(y0);
+        for (int i = 0; i < cells.width; ++i, color += Channels) {
+            uint8_t *p = first + columnRuns[i] * Channels;
+            for (int x = columnRuns[i]; x < columnRuns[i + 1]; ++x, p += Channels) std::memcpy(p, color, Channels);
+        }
+        for (int y = y0 + 1; y < y1; ++y) std::memcpy(dst.row(y), first, rowBytes);
+    }
+}
+
+} // namespace
+
+bool averageCells(const ConstImageView &src, const ImageView &cells, int threads) {
+    if (!isValid(src) || !isValid(cells) || src.format != cells.format || cells.width > src.width ||
+        cells.height > src.height) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("resample.average");
+    const std::vector<AxisSpan> columns = axisSpans(src.width, cells.width);
+    const std::vector<AxisSpan> rows = axisSpans(src.height, cells.height);
+    parallelFor(0, cells.height, threads, [&](int first, int last) {
+        switch (bytesPerPixel(src.format)) {
+            case 1: averageCellRows<1>(src, cells, columns, rows, first, last); break;
+            case 3: averageCellRows<3>(src, cells, columns, rows, first, last); break;
+            default: averageCellRows<4>(src, cells, columns, rows, first, last); break;
+        }
+    });
+    return true;
+}
+
+bool expandCells(const ConstImageView &cells, const ImageView &dst, int threads) {
+    if (!isValid(cells) || !isValid(dst) || cells.format != dst.format || cells.width > dst.width ||
+        cells.height > dst.height) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("resample.expand");
+    const std::vector<int> columnRuns = centreRuns(dst.width, cells.width);
+    const std::vector<int> rowRuns = centreRuns(dst.height, cells.height);
+    parallelFor(0, cells.height, threads, [&](int first, int last) {
+        switch (bytesPerPixel(dst.format)) {
+            case 1: expandCellRows<1>(cells, dst, columnRuns, rowRuns, first, last); break;
+            case 3: expandCellRows<3>(cells, dst, columnRuns, rowRuns, first, last); break;
+            default: expandCellRows<4>(cells, dst, columnRuns, rowRuns, first, last); break;
+        }
+    });
+    return true;
+}
+
+bool pixelateToGrid(const ConstImageView &src, const ImageView &dst, int columns, int rows, int threads) {
+    if (!isValid(src) || !isValid(dst) || src.width != dst.width || src.height != dst.height ||
+        src.format != dst.format || columns < 1 || rows < 1 || columns > src.width || rows > src.height) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("pixelate.grid");
+    const int channels = bytesPerPixel(src.format);
+    std::vector<uint8_t> grid(static_cast<size_t>(columns) * rows * channels);
+    const ImageView cells{grid.data(), columns, rows, static_cast<ptrdiff_t>(columns) * channels, src.format};
+    // Every cell is averaged before any pixel is written, which keeps
+    // in-place calls correct.
+    return averageCells(src, cells, threads) && expandCells(cells, dst, threads);
+}
+
+} // namespace i2p
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+
+namespace i2p {
+
+// Target-resolution pixelation: instead of a whole-pixel block size the
+// caller picks the output grid, columns x rows cells, and every cell spans
+// width / columns x height / rows source pixels, fractional sizes included.
+
+// Averages every cell into one pixel of `cells`, whose size is the grid
+// (at most the source size) and whose format matches src. Pixels cut by a
+// cell edge count with the part of their area inside the cell, so the
+// result is a box-filtered downscale; channels are truncated like
+// pixelate().
+I2P_API bool averageCells(const ConstImageView &src, const ImageView &cells, int threads = 0);
+
+// Fills dst with the cell colours: each pixel takes the cell its centre
+// falls in. dst must be at least as large as the grid in `cells`.
+I2P_API bool expandCells(const ConstImageView &cells, const ImageView &dst, int threads = 0);
+
+// averageCells() followed by expandCells() through a temporary grid. Same
+// view rules as pixelate(); src and dst may be the same buffer.
+I2P_API bool pixelateToGrid(const ConstImageView &src, const ImageView &dst, int columns, int rows,
+                            int threads = 0);
+
+} // namespace i2p
@@ -0,0 +1,383 @@
+#include "rotated.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "mosaic.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+// Lattice coordinates are stepped in 32.32 fixed point. Each step is off by
+// at most 2^-33 of a cell, so even a 100000-pixel row drifts by about 1e-5
+// cells, well inside the half pixel that separates every pixel centre from
+// an unturned cell edge: at angle 0 the cells are exactly pixelate()'s.
+constexpr int kFractionBits = 32;
+constexpr double kFixedOne = 4294967296.0;
+
+// Pixels of one image row, from the end of the previous run up to `end`,
+// that fall in lattice cell `cell` (row * columns + column).
+struct RotatedRun {
+    int end;
+    int cell;
+};
+
+struct RotatedKey {
+    double angle = 0;
+    int blockSize = 0;
+    int phaseX = 0;
+    int phaseY = 0;
+    int width = 0;
+    int height = 0;
+
+    bool operator==(const RotatedKey &other) const {
+        return angle == other.angle && blockSize == other.blockSize && phaseX == other.phaseX &&
+               phaseY == other.phaseY && width == other.width && height == other.height;
+    }
+};
+
+// The turned axes, scaled to cells: a point (x, y) lies at
+//   u = (x cos + y sin - phaseX) / blockSize - columnOrigin
+//   v = (y cos - x sin - phaseY) / blockSize - rowOrigin
+// with the origins chosen so that every pixel centre has u, v >= 0.
+struct Lattice {
+    double cos = 1;
+    double sin = 0;
+    double scale = 1;
+    double phaseX = 0;
+    double phaseY = 0;
+    double columnOrigin = 0;
+    double rowOrigin = 0;
+    int columns = 0;
+    int rows = 0;
+
+    double u(double x, double y) const { return (x * cos + y * sin - phaseX) * scale - columnOrigin; }
+    double v(double x, double y) const { return (y * cos - x * sin - phaseY) * scale - rowOrigin; }
+};
+
+bool makeKey(int width, int height, const GridGeometry &grid, double angle, RotatedKey &key) {
+    if (width < 1 || height < 1 || grid.blockSize < 2 || !std::isfinite(angle)) return false;
+    key.angle = angle;
+    key.blockSize = grid.blockSize;
+    key.phaseX = std::max(grid.phaseX, 0);
+    key.phaseY = std::max(grid.phaseY, 0);
+    key.width = width;
+    key.height = height;
+    return true;
+}
+
+// The only trigonometry: one sine and cosine per geometry. The pixel
+// centres at the image corners bound the lattice.
+Lattice makeLattice(const RotatedKey &key) {
+    Lattice lattice;
+    const double radians = key.angle * (3.14159265358979323846 / 180.0);
+    lattice.cos = std::cos(radians);
+    lattice.sin = std::sin(radians);
+    lattice.scale = 1.0 / key.blockSize;
+    lattice.phaseX = key.phaseX;
+    lattice.phaseY = key.phaseY;
+
+    double uMin = HUGE_VAL, uMax = -HUGE_VAL, vMin = HUGE_VAL, vMax = -HUGE_VAL;
+    for (double x : {0.5, key.width - 0.5}) {
+        for (double y : {0.5, key.height - 0.5}) {
+            uMin = std::min(uMin, lattice.u(x, y));
+            uMax = std::max(uMax, lattice.u(x, y));
+            vMin = std::min(vMin, lattice.v(x, y));
+            vMax = std::max(vMax, lattice.v(x, y));
+        }
+    }
+    lattice.columnOrigin = std::floor(uMin);
+    lattice.rowOrigin = std::floor(vMin);
+    lattice.columns = static_cast<int>(std::floor(uMax) - lattice.columnOrigin) + 1;
+    lattice.rows = static_cast<int>(std::floor(vMax) - lattice.rowOrigin) + 1;
+    return lattice;
+}
+
+struct RotatedMap {
+    RotatedKey key;
+    int columns = 0;
+    int rows = 0;
+    std::vector<RotatedRun> runs;
+    std::vector<size_t> rowStart;   // runs of image row y are [rowStart[y], rowStart[y + 1])
+    std::vector<int> rowFirst;      // lattice rows image row y reaches
+    std::vector<int> rowLast;
+};
+
+// Walks image row y with the DDA: the lattice position of the first pixel
+// centre is computed directly, every next one is two fixed-point adds, and
+// the cell index is the integer part. `emit(end, column, row)` is called
+// once per run of pixels in the same cell.
+template <typename Emit>
+void walkRow(const Lattice &lattice, int width, int y, Emit &&emit) {
+    const int64_t du = std::llround(lattice.cos * lattice.scale * kFixedOne);
+    const int64_t dv = std::llround(-lattice.sin * lattice.scale * kFixedOne);
+    int64_t u = std::llround(lattice.u(0.5, y + 0.5) * kFixedOne);
+    int64_t v = std::llround(lattice.v(0.5, y + 0.5) * kFixedOne);
+    int64_t column = u >> kFractionBits;
+    int64_t row = v >> kFractionBits;
+    // Rounding may step a hair outside the lattice at its border.
+    auto clampedEmit = [&](int end) {
+        emit(end, static_cast<int>(std::min<int64_t>(std::max<int64_t>(column, 0), lattice.columns - 1)),
+             static_cast<int>(std::min<int64_t>(std::max<int64_t>(row, 0), lattice.rows - 1)));
+    };
+    for (int x = 1; x < width; ++x) {
+        u += du;
+        v += dv;
+        const int64_t nextColumn = u >> kFractionBits;
+        const int64_t nextRow = v >> kFractionBits;
+        if (nextColumn != column || nextRow != row) {
+            clampedEmit(x);
+            column = nextColumn;
+            row = nextRow;
+        }
+    }
+    clampedEmit(width);
+}
+
+std::shared_ptr<const RotatedMap> buildRotatedMap(const RotatedKey &key, int threads) {
+    I2P_TRACE_SPAN("rotated.map");
+    const Lattice lattice = makeLattice(key);
+    auto map = std::make_shared<RotatedMap>();
+    map->key = key;
+    map->columns = lattice.columns;
+    map->rows = lattice.rows;
+    map->rowStart.assign(key.height + 1, 0);
+    map->rowFirst.assign(key.height, lattice.rows);
+    map->rowLast.assign(key.height, -1);
+
+    // Rows are walked twice, to count their runs and then to store them at
+    // their offsets, so the walk runs in parallel without a merge.
+    parallelFor(0, key.height, threads, [&](int first, int last) {
+        for (int y = first; y < last; ++y) {
+            size_t count = 0;
+            int &rowFirst = map->rowFirst[y];
+            int &rowLast = map->rowLast[y];
+            walkRow(lattice, key.width, y, [&](int, int, int row) {
+                ++count;
+                rowFirst = std::min(rowFirst, row);
+                rowLast = std::max(rowLast, row);
+            });
+            map->rowStart[y + 1] = count;
+        }
+    });
+    for (int y = 0; y < key.height; ++y) map->rowStart[y + 1] += map->rowStart[y];
+    map->runs.resize(map->rowStart[key.height]);
+    parallelFor(0, key.height, threads, [&](int first, int last) {
+        for (int y = first; y < last; ++y) {
+            RotatedRun *run = map->runs.data() + map->rowStart[y];
+            walkRow(lattice, key.width, y, [&](int end, int column, int row) {
+                *run++ = {end, row * lattice.columns + column};
+            });
+        }
+    });
+    return map;
+}
+
+// The mapping of the last geometry used. The GUI renders one image at a
+// time, so a single entry covers every re-render at the same angle.
+struct RotatedCache {
+    std::mutex mutex;
+    std::shared_ptr<const RotatedMap> map;
+};
+
+RotatedCache &rotatedCache() {
+    static RotatedCache cache;
+    return cache;
+}
+
+std::shared_ptr<const RotatedMap> rotatedMap(const RotatedKey &key, int threads) {
+    RotatedCache &cache = rotatedCache();
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        if (cache.map && cache.map->key == key) return cache.map;
+    }
+    std::shared_ptr<const RotatedMap> map = buildRotatedMap(key, threads);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.map = map;
+    return map;
+}
+
+// Lattice rows are averaged in chunks of about kChunkValues sums (4 MiB),
+// each chunk summed, divided and dropped by one task, so the working memory
+// is a chunk per thread whatever the lattice size. Smaller chunks cut every
+// image row into more, shorter pieces and averaging slows down.
+constexpr size_t kChunkValues = size_t(1) << 20;
+
+int chunkRows(const RotatedMap &map, int channels) {
+    const size_t rowValues = static_cast<size_t>(map.columns) * (channels + 1);
+    return static_cast<int>(std::max<size_t>(1, kChunkValues / rowValues));
+}
+
+// The runs of image row y that fall in lattice rows [firstRow, lastRow).
+// Along an image row the lattice row only ever rises or only falls, so
+// those runs are contiguous and found by binary search.
+void clipRuns(const RotatedMap &map, int y, int firstRow, int lastRow, size_t &begin, size_t &end) {
+    const RotatedRun *first = map.runs.data() + map.rowStart[y];
+    const RotatedRun *last = map.runs.data() + map.rowStart[y + 1];
+    const int columns = map.columns;
+    const bool rising = first->cell / columns <= (last - 1)->cell / columns;
+    auto before = [&](int row) {
+        return [=](const RotatedRun &run) { return rising ? run.cell / columns < row : run.cell / columns >= row; };
+    };
+    const RotatedRun *lo = std::partition_point(first, last, before(rising ? firstRow : lastRow));
+    const RotatedRun *hi = std::partition_point(lo, last, before(rising ? lastRow : firstRow));
+    begin = static_cast<size_t>(lo - map.runs.data());
+    end = static_cast<size_t>(hi - map.runs.data());
+}
+
+// Lattice rows [firstRow, lastRow): every image row reaching them adds its
+// clipped runs to `sums` (channel sums and a pixel count per cell), which
+// are then divided, truncating like pixelate().
+template <int Channels>
+void averageRotatedRows(const ConstImageView &src, const ImageView &cells, const RotatedMap &map, uint8_t *filled,
+                        int firstRow, int lastRow, std::vector<uint32_t> &sums) {
+    constexpr int Stride = Channels + 1;
+    const int columns = map.columns;
+    sums.assign(static_cast<size_t>(lastRow - firstRow) * columns * Stride, 0);
+    uint32_t *base = sums.data() - static_cast<ptrdiff_t>(firstRow) * columns * Stride;
+
+    for (int y = 0; y < src.height; ++y) {
+        if (map.rowLast[y] < firstRow || map.rowFirst[y] >= lastRow) continue;
+        size_t begin, end;
+        clipRuns(map, y, firstRow, lastRow, begin, end);
+        int x = begin == map.rowStart[y] ? 0 : map.runs[begin - 1].end;
+        const uint8_t *p = src.row(y) + x * Channels;
+        for (size_t i = begin; i < end; ++i) {
+            const RotatedRun &run = map.runs[i];
+            uint32_t local[Channels] = {};
+            const int start = x;
+            for (; x < run.end; ++x, p += Channels) {
+                for (int c = 0; c < Channels; ++c) local[c] += p[c];
+            }
+            uint32_t *cell = base + static_cast<ptrdiff_t>(run.cell) * Stride;
+            for (int c = 0; c < Channels; ++c) cell[c] += local[c];
+            cell[Channels] += static_cast<uint32_t>(run.end - start);
+        }
+    }
+
+    const uint32_t *cell = sums.data();
+    for (int r = firstRow; r < lastRow; ++r) {
+        uint8_t *out = cells.row(r);
+        uint8_t *hit = filled + static_cast<size_t>(r) * columns;
+        for (int i = 0; i < columns; ++i, out += Channels, cell += Stride) {
+            hit[i] = cell[Channels] != 0;
+            if (!hit[i]) continue;
+            for (int c = 0; c < Channels; ++c) out[c] = static_cast<uint8_t>(cell[c] / cell[Channels]);
+        }
+    }
+}
+
+template <int Channels>
+void fillRotatedRows(const ConstImageView &cells, const ImageView &dst, const RotatedMap &map, int y0, int y1) {
+    for (int y = y0; y < y1; ++y) {
+        uint8_t *p = dst.row(y);
+        int x = 0;
+        for (size_t i = map.rowStart[y]; i < map.rowStart[y + 1]; ++i) {
+            const RotatedRun &run = map.runs[i];
+            const int row = run.cell / map.columns;
+            const uint8_t *color = cells.row(row) + (run.cell - row * map.columns) * Channels;
+            for (; x < run.end; ++x, p += Channels) std::memcpy(p, color, Channels);
+        }
+    }
+}
+
+} // namespace
+
+bool rotatedCellCount(int width, int height, const GridGeometry &grid, double angle, int &columns, int &rows) {
+    RotatedKey key;
+    if (!makeKey(width, height, grid, angle, key)) return false;
+    const Lattice lattice = makeLattice(key);
+    columns = lattice.columns;
+    rows = lattice.rows;
+    return true;
+}
+
+bool averageRotatedCells(const ConstImageView &src, const ImageView &cells, const GridGeometry &grid, double angle,
+                         int threads) {
+    RotatedKey key;
+    if (!isValid(src) || !isValid(cells) || src.format != cells.format ||
+        !makeKey(src.width, src.height, grid, angle, key)) {
+        return false;
+    }
+    const std::shared_ptr<const RotatedMap> map = rotatedMap(key, threads);
+    if (cells.width != map->columns || cells.height != map->rows) return false;
+
+    I2P_TRACE_SPAN("rotated.average");
+    // Turned cells straddle any split into image row bands, so the work is
+    // split by lattice rows instead: each chunk of them has one owner.
+    const int channels = bytesPerPixel(src.format);
+    const int rowsPerChunk = chunkRows(*map, channels);
+    const int chunkCount = (map->rows + rowsPerChunk - 1) / rowsPerChunk;
+    std::vector<uint8_t> filled(static_cast<size_t>(map->columns) * map->rows);
+    parallelFor(0, chunkCount, threads, [&](int first, int last) {
+        std::vector<uint32_t> sums;
+        for (int chunk = first; chunk < last; ++chunk) {
+            const int r0 = chunk * rowsPerChunk;
+            const int r1 = std::min(r0 + rowsPerChunk, map->rows);
+            switch (channels) {
+                case 1: averageRotatedRows<1>(src, cells, *map, filled.data(), r0, r1, sums); break;
+                case 3: averageRotatedRows<3>(src, cells, *map, filled.data(), r0, r1, sums); break;
+                default: averageRotatedRows<4>(src, cells, *map, filled.data(), r0, r1, sums); break;
+            }
+        }
+    });
+    fillEmptyCells(cells, filled.data());
+    return true;
+}
+
+bool fillRotatedCells(const ConstImageView &cells, const ImageView &dst, const GridGeometry &grid, double angle,
+                      int threads) {
+    RotatedKey key;
+    if (!isValid(cells) || !isValid(dst) || cells.format != dst.format ||
+        !makeKey(dst.width, dst.height, grid, angle, key)) {
+        return false;
+    }
+    const std::shared_ptr<const RotatedMap> map = rotatedMap(key, threads);
+    if (cells.width != map->columns || cells.height != map->rows) return false;
+
+    I2P_TRACE_SPAN("rotated.fill");
+    parallelFor(0, dst.height, threads, [&](int first, int last) {
+        switch (bytesPerPixel(dst.format)) {
+            case 1: fillRotatedRows<1>(cells, dst, *map, first, last); break;
+            case 3: fillRotatedRows<3>(cells, dst, *map, first, last); break;
+            default: fillRotatedRows<4>(cells, dst, *map, first, last); break;
+        }
+    });
+    return true;
+}
+
+bool pixelateRotated(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid, double angle,
+                     int threads) {
+    int columns = 0;
+    int rows = 0;
+    if (!isValid(src) || !isValid(dst) || src.width != dst.width || src.height != dst.height ||
+        src.format != dst.format || !rotatedCellCount(src.width, src.height, grid, angle, columns, rows)) {
+        return false;
+    }
+
+    I2P_TRACE_SPAN("pixelate.rotated");
+    const int channels = bytesPerPixel(src.format);
+    std::vector<uint8_t> lattice(static_cast<size_t>(columns) * rows * channels);
+    const ImageView cells{lattice.data(), columns, rows, static_cast<ptrdiff_t>(columns) * channels, src.format};
+    // Every cell is averaged before any pixel is written, which keeps
+    // in-place calls correct.
+    return averageRotatedCells(src, cells, grid, angle, threads) && fillRotatedCells(cells, dst, grid, angle, threads);
+}
+
+size_t rotatedCacheBytes() {
+    RotatedCache &cache = rotatedCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (!cache.map) return 0;
+    const RotatedMap &map = *cache.map;
+    return sizeof(map) + map.runs.capacity() * sizeof(RotatedRun) + map.rowStart.capacity() * sizeof(size_t) +
+           (map.rowFirst.capacity() + map.rowLast.capacity()) * sizeof(int);
+}
+
+} // namespace i2p
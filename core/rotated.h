@@ -0,0 +1,44 @@
+#pragma once
+
+#include "export.h"
+#include "image.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+// Square blocks on a grid turned by `angle` degrees about the image origin;
+// positive angles turn it clockwise on screen. The block size and phase are
+// measured along the turned axes, so angle 0 gives exactly pixelate()'s
+// grid. Cells are indexed on a `columns` x `rows` lattice covering the
+// image; corner cells of the lattice may hold no pixel.
+//
+// Which cell each pixel centre falls in is found once per geometry (angle,
+// block size, phase, image size) by a fixed-point DDA along every scanline
+// and kept as runs of pixels; the most recent mapping is cached, so renders
+// that only change colours, palette or dithering reuse it.
+
+I2P_API bool rotatedCellCount(int width, int height, const GridGeometry &grid, double angle, int &columns,
+                              int &rows);
+
+// Averages every cell into one pixel of `cells`, which must have the lattice
+// size and src's format. Work is split into chunks of lattice rows, each
+// summed into a small buffer of its own from the runs that reach it, so
+// memory does not grow with the thread count. Cells with no pixel copy a
+// neighbour (see fillEmptyCells()).
+I2P_API bool averageRotatedCells(const ConstImageView &src, const ImageView &cells, const GridGeometry &grid,
+                                 double angle, int threads = 0);
+
+// Paints every pixel with the colour of its cell.
+I2P_API bool fillRotatedCells(const ConstImageView &cells, const ImageView &dst, const GridGeometry &grid,
+                              double angle, int threads = 0);
+
+// averageRotatedCells() followed by fillRotatedCells() through a temporary
+// lattice. Same view rules as pixelate(); called by pixelate() for square
+// blocks with a non-zero angle.
+I2P_API bool pixelateRotated(const ConstImageView &src, const ImageView &dst, const GridGeometry &grid,
+                             double angle, int threads = 0);
+
+// Bytes held by the cached mapping, for memory displays.
+I2P_API size_t rotatedCacheBytes();
+
+} // namespace i2p
@@ -0,0 +1,221 @@
+#include "synth.h"
+
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "netpbm_writer.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace i2p {
+
+namespace {
+
+// splitmix64 finaliser: cheap, stateless and well distributed, so a pixel's
+// value can be computed from its coordinates alone.
+inline uint64_t mix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline uint8_t lerp(uint8_t a, uint8_t b, int t) {
+    // t in [0, 255]
+    return static_cast<uint8_t>(a + ((b - a) * t) / 255);
+}
+
+inline void storePixel(uint8_t *p, PixelFormat format, const uint8_t *rgba) {
+    switch (format) {
+        case PixelFormat::Argb32: {
+            uint32_t argb = (uint32_t(rgba[3]) << 24) | (uint32_t(rgba[0]) << 16) |
+                            (uint32_t(rgba[1]) << 8) | uint32_t(rgba[2]);
+            std::memcpy(p, &argb, 4);
+            break;
+        }
+        case PixelFormat::Rgba8888:
+            std::memcpy(p, rgba, 4);
+            break;
+        case PixelFormat::Rgb888:
+            std::memcpy(p, rgba, 3);
+            break;
+        case PixelFormat::Gray8:
+            p[0] = static_cast<uint8_t>((rgba[0] * 299 + rgba[1] * 587 + rgba[2] * 114) / 1000);
+            break;
+    }
+}
+
+// Per-image constants derived from the seed.
+struct Palette {
+    uint8_t from[3];
+    uint8_t to[3];
+    int cellSize;       // Flat
+    uint64_t zoneScale; // Texture
+
+    explicit Palette(uint64_t seed) {
+        uint64_t h = mix(seed);
+        for (int c = 0; c < 3; ++c) {
+            from[c] = static_cast<uint8_t>(h >> (8 * c));
+            to[c] = static_cast<uint8_t>(h >> (8 * c + 24));
+        }
+        cellSize = 32 + static_cast<int>(mix(seed ^ 0xf1a7) % 225);
+        zoneScale = 1 + mix(seed ^ 0x20e) % 4;
+    }
+};
+
+void gradientAt(const SynthParams &params, const Palette &palette, int x, int y, uint8_t *rgba) {
+    int tx = static_cast<int>(int64_t(x) * 255 / std::max(params.width - 1, 1));
+    int ty = static_cast<int>(int64_t(y) * 255 / std::max(params.height - 1, 1));
+    rgba[0] = lerp(palette.from[0], palette.to[0], tx);
+    rgba[1] = lerp(palette.from[1], palette.to[1], ty);
+    rgba[2] = lerp(palette.from[2], palette.to[2], (tx + ty) / 2);
+    rgba[3] = 255;
+}
+
+} // namespace
+
+bool parseSynthPattern(const std::string &name, SynthPattern &pattern) {
+    for (SynthPattern p : {SynthPattern::Noise, SynthPattern::Gradient, SynthPattern::Flat,
+                           SynthPattern::Alpha, SynthPattern::Texture}) {
+        if (name == synthPatternName(p)) {
+            pattern = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *synthPatternName(SynthPattern pattern) {
+    switch (pattern) {
+        case SynthPattern::Noise:    return "noise";
+        case SynthPattern::Gradient: return "gradient";
+        case SynthPattern::Flat:     return "flat";
+        case SynthPattern::Alpha:    return "alpha";
+        case SynthPattern::Texture:  return "texture";
+    }
+    return "?";
+}
+
+void synthesizeRows(const SynthParams &params, int firstRow, const ImageView &band) {
+    const Palette palette(params.seed);
+    const uint64_t noiseBase = mix(params.seed ^ 0x6e6f697365ull);
+    const int bpp = bytesPerPixel(band.format);
+    uint8_t rgba[4];
+
+    for (int row = 0; row < band.height; ++row) {
+        const int y = firstRow + row;
+        uint8_t *p = band.row(row);
+
+        for (int x = 0; x < band.width; ++x, p += bpp) {
+            switch (params.pattern) {
+                case SynthPattern::Noise: {
+                    uint64_t h = mix(noiseBase + uint64_t(y) * uint64_t(params.width) + uint64_t(x));
+                    rgba[0] = static_cast<uint8_t>(h);
+                    rgba[1] = static_cast<uint8_t>(h >> 8);
+                    rgba[2] = static_cast<uint8_t>(h >> 16);
+                    rgba[3] = 255;
+                    break;
+                }
+                case SynthPattern::Gradient:
+                    gradientAt(params, palette, x, y, rgba);
+                    break;
+                case SynthPattern::Flat: {
+                    uint64_t cell = (uint64_t(y / palette.cellSize) << 32) | uint64_t(x / palette.cellSize);
+                    uint64_t h = mix(noiseBase ^ cell);
+                    rgba[0] = static_cast<uint8_t>(h);
+                    rgba[1] = static_cast<uint8_t>(h >> 8);
+                    rgba[2] = static_cast<uint8_t>(h >> 16);
+                    rgba[3] = 255;
+                    break;
+                }
+                case SynthPattern::Alpha: {
+                    gradientAt(params, palette, x, y, rgba);
+                    uint64_t tile = (uint64_t(y >> 4) << 32) | uint64_t(x >> 4);
+                    static const uint8_t levels[4] = {0, 85, 170, 255};
+                    rgba[3] = levels[mix(noiseBase ^ tile) & 3];
+                    break;
+                }
+                case SynthPattern::Texture: {
+                    // Zone plate (frequency rising with radius) in red, one
+                    // pixel checkers in green, fine noise in blue.
+                    uint64_t phase = ((uint64_t(x) * x + uint64_t(y) * y) * palette.zoneScale >> 6) & 511;
+                    rgba[0] = static_cast<uint8_t>(phase < 256 ? phase : 511 - phase);
+                    rgba[1] = ((x ^ y) & 1) ? 255 : 0;
+                    rgba[2] = static_cast<uint8_t>(mix(noiseBase + uint64_t(y) * uint64_t(params.width) + x) & 0x3F);
+                    rgba[3] = 255;
+                    break;
+                }
+            }
+            storePixel(p, band.format, rgba);
+        }
+    }
+}
+
+bool streamSynthetic(const std::string &path, const SynthParams &params,
+                     const PixelateParams &pixelateParams, std::string &error) {
+    if (params.width <= 0 || params.height <= 0) {
+        error = "image size must be positive";
+        return false;
+    }
+    if (!NetpbmWriter::supports(path)) {
+        error = "streamed output must be a .pgm, .ppm, .pam or .raw file";
+        return false;
+    }
+
+    NetpbmWriter writer;
+    if (!writer.open(path, params.width, params.height, params.format)) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    // Bands hold whole block rows (about 32 MB of pixels) so that pixelating
+    // a band never needs rows from its neighbours.
+    const int blockSize = std::max(pixelateParams.grid.blockSize, 1);
+    const size_t rowBytes = static_cast<size_t>(params.width) * bytesPerPixel(params.format);
+    const size_t targetRows = std::max<size_t>(1, (size_t(32) << 20) / rowBytes);
+    const int rowsPerBand = static_cast<int>(std::max<size_t>(1, targetRows / blockSize)) * blockSize;
+    const int offset = std::max(pixelateParams.grid.phaseY, 0) % blockSize;
+    const int startY = offset ? offset - blockSize : 0;
+
+    std::vector<uint8_t> buffer(static_cast<size_t>(rowsPerBand) * rowBytes);
+    for (int first = 0; first < params.height;) {
+        const int last = std::min(params.height, (first == 0 ? startY : first) + rowsPerBand);
+
+        ImageView band;
+        band.data = buffer.data();
+        band.width = params.width;
+        band.height = last - first;
+        band.stride = static_cast<ptrdiff_t>(rowBytes);
+        band.format = params.format;
+
+        parallelFor(0, band.height, pixelateParams.threads, [&](int lo, int hi) {
+            I2P_TRACE_SPAN("synth.rows");
+            ImageView rows = band;
+            rows.data = band.row(lo);
+            rows.height = hi - lo;
+            synthesizeRows(params, first + lo, rows);
+        });
+
+        // Later bands start on a grid line; only the first can begin mid-block.
+        PixelateParams bandParams = pixelateParams;
+        bandParams.grid.phaseY = first == 0 ? offset : 0;
+        pixelate(band, band, bandParams);
+
+        I2P_TRACE_SPAN("stream.write");
+        if (!writer.writeRows(band)) {
+            error = "cannot write " + path;
+            return false;
+        }
+        first = last;
+    }
+
+    if (!writer.close()) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+} // namespace i2p
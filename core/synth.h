@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "export.h"
+#include "image.h"
+#include "pixelate.h"
+
+namespace i2p {
+
+enum class SynthPattern {
+    Noise,      // independent random channels
+    Gradient,   // smooth ramps across the image
+    Flat,       // large single-colour regions
+    Alpha,      // colour ramps under a checkerboard of alpha levels
+    Texture     // zone plate and one-pixel stripes: worst case for averaging
+};
+
+struct SynthParams {
+    SynthPattern pattern = SynthPattern::Noise;
+    uint64_t seed = 1;
+    int width = 0;
+    int height = 0;
+    PixelFormat format = PixelFormat::Rgba8888;
+};
+
+I2P_API bool parseSynthPattern(const std::string &name, SynthPattern &pattern);
+I2P_API const char *synthPatternName(SynthPattern pattern);
+
+// Fills `band` with rows [firstRow, firstRow + band.height) of the image
+// described by params. Every pixel is a pure function of (seed, x, y), so
+// any band can be produced on its own and the result is identical on every
+// machine. band.width must equal params.width.
+I2P_API void synthesizeRows(const SynthParams &params, int firstRow, const ImageView &band);
+
+// Generates, pixelates and writes the image one band of block rows at a
+// time, so memory use stays at a few bands whatever the image size. The
+// output must be a .pgm/.ppm/.pam (netpbm) or .raw file.
+I2P_API bool streamSynthetic(const std::string &path, const SynthParams &params,
+                             const PixelateParams &pixelateParams, std::string &error);
+
+} // namespace i2p
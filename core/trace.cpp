@@ -0,0 +1,155 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace i2p {
+namespace trace {
+
+namespace {
+
+struct Event {
+    const char *name;
+    uint64_t generation;
+    int64_t beginNs;
+    int64_t endNs;
+};
+
+// Per-thread buffers live in a global registry so that events survive the
+// thread that recorded them. Each buffer has its own lock, which is only
+// ever contended while a trace is being exported.
+struct ThreadBuffer {
+    int id = 0;
+    std::string name;
+    std::mutex mutex;
+    std::vector<Event> events;
+};
+
+// Keeps a runaway recording from eating memory (~32 MB per thread).
+const size_t kMaxEventsPerThread = size_t(1) << 20;
+
+std::mutex registryMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> registry;
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+ThreadBuffer &threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        auto created = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(registryMutex);
+        created->id = static_cast<int>(registry.size()) + 1;
+        registry.push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+void appendEscaped(std::string &out, const std::string &text) {
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+}
+
+} // namespace
+
+namespace detail {
+
+std::atomic<bool> enabled{false};
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+uint64_t &currentGeneration() {
+    thread_local uint64_t generation = 0;
+    return generation;
+}
+
+void record(const char *name, uint64_t generation, int64_t beginNs, int64_t endNs) {
+    ThreadBuffer &buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.size() < kMaxEventsPerThread) {
+        buffer.events.push_back({name, generation, beginNs, endNs});
+    }
+}
+
+} // namespace detail
+
+void setEnabled(bool on) {
+    detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+void clear() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto &buffer : registry) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        buffer->events.clear();
+    }
+}
+
+void setThreadName(const std::string &name) {
+    ThreadBuffer &buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+std::string chromeTraceJson() {
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    char line[256];
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto &buffer : registry) {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        if (!first) out += ",\n";
+        first = false;
+        out += "{\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(buffer->id) +
+               ",\"name\":\"thread_name\",\"args\":{\"name\":\"";
+        appendEscaped(out, buffer->name.empty() ? "thread " + std::to_string(buffer->id) : buffer->name);
+        out += "\"}}";
+
+        for (const Event &event : buffer->events) {
+            std::snprintf(line, sizeof(line),
+                          ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\","
+                          "\"args\":{\"generation\":%llu}}",
+                          buffer->id, event.beginNs / 1000.0, (event.endNs - event.beginNs) / 1000.0, event.name,
+                          static_cast<unsigned long long>(event.generation));
+            out += line;
+        }
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+ScopedTraceFile::ScopedTraceFile(const std::string &path) : path(path) {
+    if (!path.empty()) setEnabled(true);
+}
+
+ScopedTraceFile::~ScopedTraceFile() {
+    if (path.empty()) return;
+    setEnabled(false);
+    if (!writeChromeTrace(path)) std::fprintf(stderr, "error: cannot write trace %s\n", path.c_str());
+}
+
+bool writeChromeTrace(const std::string &path) {
+    std::string json = chromeTraceJson();
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(json.data(), 1, json.size(), file) == json.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+} // namespace trace
+} // namespace i2p
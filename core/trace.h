@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "export.h"
+
+namespace i2p {
+namespace trace {
+
+namespace detail {
+I2P_API extern std::atomic<bool> enabled;
+I2P_API void record(const char *name, uint64_t generation, int64_t beginNs, int64_t endNs);
+I2P_API int64_t nowNs();
+I2P_API uint64_t &currentGeneration();
+} // namespace detail
+
+// Recording is off by default; a disabled span costs one relaxed load.
+I2P_API void setEnabled(bool on);
+inline bool isEnabled() { return detail::enabled.load(std::memory_order_relaxed); }
+
+// Drops everything recorded so far.
+I2P_API void clear();
+
+// Names the calling thread in exported traces ("GUI", "worker 3", ...).
+I2P_API void setThreadName(const std::string &name);
+
+// Job generation attached to spans opened on this thread. parallelFor()
+// carries the caller's generation over to the workers it uses.
+inline uint64_t generation() { return detail::currentGeneration(); }
+
+class GenerationScope {
+public:
+    explicit GenerationScope(uint64_t generation) : previous(detail::currentGeneration()) {
+        detail::currentGeneration() = generation;
+    }
+    ~GenerationScope() { detail::currentGeneration() = previous; }
+
+    GenerationScope(const GenerationScope &) = delete;
+    GenerationScope &operator=(const GenerationScope &) = delete;
+
+private:
+    uint64_t previous;
+};
+
+// Records [construction, destruction) as a complete event. `name` must be a
+// string literal (only the pointer is stored).
+class Span {
+public:
+    explicit Span(const char *name) : name(name), beginNs(isEnabled() ? detail::nowNs() : -1) {}
+    ~Span() {
+        if (beginNs >= 0) detail::record(name, generation(), beginNs, detail::nowNs());
+    }
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+private:
+    const char *name;
+    int64_t beginNs;
+};
+
+// Turns recording on for its lifetime and writes the trace to `path` when it
+// goes out of scope; an empty path makes it a no-op. Used for --trace.
+class I2P_API ScopedTraceFile {
+public:
+    explicit ScopedTraceFile(const std::string &path);
+    ~ScopedTraceFile();
+
+    ScopedTraceFile(const ScopedTraceFile &) = delete;
+    ScopedTraceFile &operator=(const ScopedTraceFile &) = delete;
+
+private:
+    std::string path;
+};
+
+// Chrome / Perfetto trace-event JSON ("traceEvents" array of complete events
+// plus thread_name metadata). Opens in chrome://tracing or ui.perfetto.dev.
+I2P_API std::string chromeTraceJson();
+I2P_API bool writeChromeTrace(const std::string &path);
+
+} // namespace trace
+} // namespace i2p
+
+#define I2P_TRACE_CONCAT_(a, b) a##b
+#define I2P_TRACE_CONCAT(a, b) I2P_TRACE_CONCAT_(a, b)
+#define I2P_TRACE_SPAN(name) ::i2p::trace::Span I2P_TRACE_CONCAT(i2pTraceSpan, __LINE__)(name)
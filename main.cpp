@@ -16,12 +16,87 @@
 #include <QMenuBar>
 #include <QMenu>
 #include <QAction>
+#include <QActionGroup>
 #include <QMessageBox>
 #include <QDesktopServices>
 #include <QUrl>
 
 #include <QSpinBox>
+#include <QCheckBox>
 #include <QFileInfo>
+#include <QFile>
+#include <QInputDialog>
+#include <QElapsedTimer>
+#include <QFontDatabase>
+
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include "core/buffer_pool.h"
+#include "core/cli_options.h"
+#include "core/jpeg_writer.h"
+#include "core/netpbm_writer.h"
+#include "core/parallel.h"
+#include "core/pixelate.h"
+#include "core/render.h"
+#include "core/synth.h"
+#include "core/trace.h"
+
+// Views over Format_ARGB32 images for the Qt-free core.
+static i2p::ConstImageView constView(const QImage &image) {
+    return i2p::ConstImageView(image.constBits(), image.width(), image.height(), image.bytesPerLine(),
+                               i2p::PixelFormat::Argb32);
+}
+
+static i2p::ImageView mutableView(QImage &image) {
+    i2p::ImageView view;
+    view.data = image.bits();
+    view.width = image.width();
+    view.height = image.height();
+    view.stride = image.bytesPerLine();
+    view.format = i2p::PixelFormat::Argb32;
+    return view;
+}
+
+// Cleanup hook for QImages that wrap a BufferPool buffer.
+static void releasePooledBuffer(void *data) {
+    i2p::BufferPool::instance().release(data);
+}
+
+// Image view that reports its paint time to the trace, tagged with the
+// generation of the image it is showing, and to the performance HUD.
+// Images are drawn straight from the (pooled) QImage, scaled to the label,
+// so showing a new render does not allocate a QPixmap.
+class ImageLabel : public QLabel {
+public:
+    uint64_t generation = 0;
+    std::function<void(double)> onPainted;
+
+    void setImage(const QImage &newImage) {
+        if (image.isNull()) clear();
+        image = newImage;
+        update();
+    }
+
+protected:
+    void paintEvent(QPaintEvent *event) override {
+        i2p::trace::GenerationScope scope(generation);
+        I2P_TRACE_SPAN("display.paint");
+        QElapsedTimer timer;
+        timer.start();
+        if (image.isNull()) {
+            QLabel::paintEvent(event);
+        } else {
+            QPainter painter(this);
+            painter.drawImage(rect(), image);
+        }
+        if (onPainted) onPainted(timer.nsecsElapsed() / 1e6);
+    }
+
+private:
+    QImage image;
+};
 
 class PixelatorWindow : public QMainWindow {
     Q_OBJECT
@@ -84,6 +159,115 @@ public:
         connect(actThemeLight, &QAction::triggered, [this](){ currentTheme = Theme::Light; applyTheme(); });
         connect(actThemeDark, &QAction::triggered, [this](){ currentTheme = Theme::Dark; applyTheme(); });
 
+        jpegMenu = settingsMenu->addMenu("JPEG Export");
+        alignMcuAction = jpegMenu->addAction("Align Pixel Grid to 8×8 Blocks");
+        alignMcuAction->setCheckable(true);
+        gridPhaseAction = jpegMenu->addAction("Grid Phase...");
+
+        connect(alignMcuAction, &QAction::toggled, [this](bool checked){ alignToMcu = checked; updatePixelation(); });
+        connect(gridPhaseAction, &QAction::triggered, this, &PixelatorWindow::chooseGridPhase);
+
+        // How each block's colour is taken from its pixels.
+        samplingMenu = settingsMenu->addMenu("Block Color");
+        QActionGroup *samplingGroup = new QActionGroup(this);
+        samplingMeanAction = samplingMenu->addAction("Average (sRGB)");
+        samplingMeanAction->setData(static_cast<int>(i2p::BlockSampling::Mean));
+        samplingOklabAction = samplingMenu->addAction("Perceptual Average (Oklab)");
+        samplingOklabAction->setData(static_cast<int>(i2p::BlockSampling::Oklab));
+        samplingDominantAction = samplingMenu->addAction("Dominant Color");
+        samplingDominantAction->setData(static_cast<int>(i2p::BlockSampling::Dominant));
+        samplingMedianAction = samplingMenu->addAction("Median");
+        samplingMedianAction->setData(static_cast<int>(i2p::BlockSampling::Median));
+        samplingTrimmedAction = samplingMenu->addAction("Trimmed Mean");
+        samplingTrimmedAction->setData(static_cast<int>(i2p::BlockSampling::TrimmedMean));
+        for (QAction *action : samplingMenu->actions()) {
+            action->setCheckable(true);
+            samplingGroup->addAction(action);
+        }
+        samplingMeanAction->setChecked(true);
+        connect(samplingGroup, &QActionGroup::triggered, [this](QAction *action){
+            blockSampling = static_cast<i2p::BlockSampling>(action->data().toInt());
+            updatePixelation();
+        });
+
+        // Cell shape of the uniform grid; the block size is the cell width.
+        shapeMenu = settingsMenu->addMenu("Block Shape");
+        QActionGroup *shapeGroup = new QActionGroup(this);
+        shapeSquareAction = shapeMenu->addAction("Square");
+        shapeSquareAction->setData(static_cast<int>(i2p::BlockShape::Square));
+        shapeHexagonAction = shapeMenu->addAction("Hexagon");
+        shapeHexagonAction->setData(static_cast<int>(i2p::BlockShape::Hexagon));
+        shapeTriangleAction = shapeMenu->addAction("Triangle");
+        shapeTriangleAction->setData(static_cast<int>(i2p::BlockShape::Triangle));
+        shapeDotAction = shapeMenu->addAction("Dot");
+        shapeDotAction->setData(static_cast<int>(i2p::BlockShape::Dot));
+        for (QAction *action : shapeMenu->actions()) {
+            action->setCheckable(true);
+            shapeGroup->addAction(action);
+        }
+        shapeSquareAction->setChecked(true);
+        connect(shapeGroup, &QActionGroup::triggered, [this](QAction *action){
+            blockShape = static_cast<i2p::BlockShape>(action->data().toInt());
+            updatePixelation();
+        });
+
+        // Fixed palettes: blocks map to the nearest entry through a lookup
+        // cube built once per palette, instead of fitting one with Colors.
+        paletteMenu = settingsMenu->addMenu("Palette");
+        QActionGroup *paletteGroup = new QActionGroup(this);
+        paletteNoneAction = paletteMenu->addAction("No Fixed Palette");
+        QAction *actPico8 = paletteMenu->addAction("PICO-8");
+        QAction *actGameBoy = paletteMenu->addAction("Game Boy");
+        paletteLoadAction = paletteMenu->addAction("Load Palette File...");
+        for (QAction *action : {paletteNoneAction, actPico8, actGameBoy, paletteLoadAction}) {
+            action->setCheckable(true);
+            paletteGroup->addAction(action);
+        }
+        paletteNoneAction->setChecked(true);
+        paletteMenu->addSeparator();
+        paletteWeightedAction = paletteMenu->addAction("Weighted Color Distance");
+        paletteWeightedAction->setCheckable(true);
+
+        connect(paletteNoneAction, &QAction::triggered, [this](){ setFixedPalette(i2p::Palette()); });
+        connect(actPico8, &QAction::triggered, [this](){ setBuiltinPalette("pico8"); });
+        connect(actGameBoy, &QAction::triggered, [this](){ setBuiltinPalette("gameboy"); });
+        connect(paletteLoadAction, &QAction::triggered, this, &PixelatorWindow::loadPaletteFile);
+        connect(paletteWeightedAction, &QAction::toggled, [this](bool){ setFixedPalette(paletteLut.palette()); });
+
+        // Dithering before palette mapping (Colors or a fixed palette).
+        ditherMenu = settingsMenu->addMenu("Dithering");
+        QActionGroup *ditherGroup = new QActionGroup(this);
+        ditherNoneAction = ditherMenu->addAction("None");
+        ditherNoneAction->setData(static_cast<int>(i2p::DitherMethod::None));
+        ditherMenu->addAction(QString::fromUtf8("Bayer 2×2"))->setData(static_cast<int>(i2p::DitherMethod::Bayer2));
+        ditherMenu->addAction(QString::fromUtf8("Bayer 4×4"))->setData(static_cast<int>(i2p::DitherMethod::Bayer4));
+        ditherMenu->addAction(QString::fromUtf8("Bayer 8×8"))->setData(static_cast<int>(i2p::DitherMethod::Bayer8));
+        ditherMenu->addSeparator();
+        ditherMenu->addAction(QString::fromUtf8("Floyd–Steinberg"))->setData(static_cast<int>(i2p::DitherMethod::FloydSteinberg));
+        ditherMenu->addAction("Atkinson")->setData(static_cast<int>(i2p::DitherMethod::Atkinson));
+        for (QAction *action : ditherMenu->actions()) {
+            if (action->isSeparator()) continue;
+            action->setCheckable(true);
+            ditherGroup->addAction(action);
+        }
+        ditherNoneAction->setChecked(true);
+        connect(ditherGroup, &QActionGroup::triggered, [this](QAction *action){
+            ditherMethod = static_cast<i2p::DitherMethod>(action->data().toInt());
+            updatePixelation();
+        });
+
+        traceMenu = settingsMenu->addMenu("Performance Trace");
+        recordTraceAction = traceMenu->addAction("Record Trace");
+        recordTraceAction->setCheckable(true);
+        exportTraceAction = traceMenu->addAction("Export Trace...");
+        traceMenu->addSeparator();
+        hudAction = traceMenu->addAction("Show Performance HUD");
+        hudAction->setCheckable(true);
+
+        connect(recordTraceAction, &QAction::toggled, [](bool checked){ i2p::trace::setEnabled(checked); });
+        connect(exportTraceAction, &QAction::triggered, this, &PixelatorWindow::exportTrace);
+        connect(hudAction, &QAction::toggled, [this](bool checked){ hudLabel->setVisible(checked); updateHud(); });
+
         // Help Menu
         helpMenu = menuBar->addMenu("Help");
         aboutAction = helpMenu->addAction("About");
@@ -110,6 +294,49 @@ public:
         spinBlockSize->setValue(10);
         spinBlockSize->setFixedWidth(80);
 
+        // Turns the grid of square blocks; only the uniform grid uses it.
+        lblAngle = new QLabel("Angle:");
+        spinAngle = new QSpinBox();
+        spinAngle->setRange(-90, 90);
+        spinAngle->setValue(0);
+        spinAngle->setSuffix(QString::fromUtf8("°"));
+        spinAngle->setFixedWidth(80);
+
+        // Palette size for the quantization stage; 0 keeps every colour.
+        lblColors = new QLabel("Colors:");
+        spinColors = new QSpinBox();
+        spinColors->setRange(0, i2p::kMaxPaletteSize);
+        spinColors->setValue(0);
+        spinColors->setSpecialValueText("Off");
+        spinColors->setFixedWidth(80);
+
+        // Adaptive mode: the pixel size becomes the smallest block and flat
+        // areas merge into blocks of up to 64 pixels.
+        chkAdaptive = new QCheckBox("Adaptive");
+        lblTolerance = new QLabel("Tolerance:");
+        spinTolerance = new QSpinBox();
+        spinTolerance->setRange(0, 255);
+        spinTolerance->setValue(10);
+        spinTolerance->setFixedWidth(80);
+        lblTolerance->setEnabled(false);
+        spinTolerance->setEnabled(false);
+
+        // Fixed grid: the output is exactly columns x rows cells, whatever
+        // fractional pixel size that takes; replaces the pixel size.
+        chkGrid = new QCheckBox("Fixed Grid");
+        spinGridColumns = new QSpinBox();
+        spinGridColumns->setRange(1, 10000);
+        spinGridColumns->setValue(64);
+        spinGridColumns->setFixedWidth(80);
+        lblGridBy = new QLabel(QString::fromUtf8("×"));
+        spinGridRows = new QSpinBox();
+        spinGridRows->setRange(1, 10000);
+        spinGridRows->setValue(64);
+        spinGridRows->setFixedWidth(80);
+        spinGridColumns->setEnabled(false);
+        lblGridBy->setEnabled(false);
+        spinGridRows->setEnabled(false);
+
         toolbarLayout->addWidget(btnOpen);
         toolbarLayout->addWidget(btnSave);
         toolbarLayout->addSpacing(20);
@@ -120,6 +347,20 @@ public:
         toolbarLayout->addStretch();
         toolbarLayout->addWidget(lblBlockSize);
         toolbarLayout->addWidget(spinBlockSize);
+        toolbarLayout->addWidget(lblAngle);
+        toolbarLayout->addWidget(spinAngle);
+        toolbarLayout->addSpacing(10);
+        toolbarLayout->addWidget(lblColors);
+        toolbarLayout->addWidget(spinColors);
+        toolbarLayout->addSpacing(10);
+        toolbarLayout->addWidget(chkAdaptive);
+        toolbarLayout->addWidget(lblTolerance);
+        toolbarLayout->addWidget(spinTolerance);
+        toolbarLayout->addSpacing(10);
+        toolbarLayout->addWidget(chkGrid);
+        toolbarLayout->addWidget(spinGridColumns);
+        toolbarLayout->addWidget(lblGridBy);
+        toolbarLayout->addWidget(spinGridRows);
 
         mainLayout->addLayout(toolbarLayout);
 
@@ -130,15 +371,24 @@ public:
         scrollArea->setAlignment(Qt::AlignCenter);
         scrollArea->setStyleSheet("QScrollArea { border: none; background-color: #1e1e1e; }");
 
-        imageLabel = new QLabel;
+        imageLabel = new ImageLabel;
         imageLabel->setAlignment(Qt::AlignCenter);
         imageLabel->setText("No image loaded.<br>Click <b>Open Image</b> to start.");
         imageLabel->setStyleSheet("color: #777;");
-        imageLabel->setScaledContents(true); // Allow pixmap to scale with label size
+        imageLabel->setScaledContents(true); // Allow the image to scale with label size
         
         // Enable mouse tracking for smoother interaction if needed, 
         // but event filter is enough for wheel.
         imageLabel->installEventFilter(this); 
+        imageLabel->onPainted = [this](double ms) {
+            // Only the first paint after a render is attributed to it; later
+            // paints come from scrolling and would hide the render cost.
+            if (imageLabel->generation != hudPaintGeneration) {
+                hudPaintGeneration = imageLabel->generation;
+                hudStats.paintMs = ms;
+                updateHud();
+            }
+        };
 
         scrollArea->setWidget(imageLabel);
         mainLayout->addWidget(scrollArea);
@@ -148,6 +398,14 @@ public:
         statusLabel->setStyleSheet("color: #888; font-size: 11px;");
         mainLayout->addWidget(statusLabel);
 
+        // Performance HUD (Settings -> Performance Trace -> Show Performance HUD)
+        hudLabel = new QLabel;
+        hudLabel->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+        hudLabel->setStyleSheet("color: #888; font-size: 11px;");
+        hudLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+        hudLabel->hide();
+        mainLayout->addWidget(hudLabel);
+
         // Connections
         connect(btnOpen, &QPushButton::clicked, this, &PixelatorWindow::openImage);
         connect(btnSave, &QPushButton::clicked, this, &PixelatorWindow::saveImage);
@@ -158,6 +416,35 @@ public:
         connect(spinBlockSize, QOverload<int>::of(&QSpinBox::valueChanged), [this](int val){
             updateTexts(); // Centralized text update
         });
+        connect(spinAngle, QOverload<int>::of(&QSpinBox::valueChanged), this, &PixelatorWindow::updatePixelation);
+        connect(chkAdaptive, &QCheckBox::toggled, [this](bool checked){
+            lblTolerance->setEnabled(checked);
+            spinTolerance->setEnabled(checked);
+            lblAngle->setEnabled(!checked && !chkGrid->isChecked());
+            spinAngle->setEnabled(!checked && !chkGrid->isChecked());
+            // Dithering follows a uniform block grid, not the quadtree leaves.
+            ditherMenu->setEnabled(!checked);
+            if (checked && ditherMethod != i2p::DitherMethod::None) {
+                ditherNoneAction->setChecked(true);
+                ditherMethod = i2p::DitherMethod::None;
+            }
+            updatePixelation();
+        });
+        connect(spinTolerance, QOverload<int>::of(&QSpinBox::valueChanged), this, &PixelatorWindow::updatePixelation);
+        connect(chkGrid, &QCheckBox::toggled, [this](bool checked){
+            spinGridColumns->setEnabled(checked);
+            lblGridBy->setEnabled(checked);
+            spinGridRows->setEnabled(checked);
+            lblBlockSize->setEnabled(!checked);
+            spinBlockSize->setEnabled(!checked);
+            chkAdaptive->setEnabled(!checked);
+            lblAngle->setEnabled(!checked && !chkAdaptive->isChecked());
+            spinAngle->setEnabled(!checked && !chkAdaptive->isChecked());
+            updatePixelation();
+        });
+        connect(spinGridColumns, QOverload<int>::of(&QSpinBox::valueChanged), this, &PixelatorWindow::updatePixelation);
+        connect(spinGridRows, QOverload<int>::of(&QSpinBox::valueChanged), this, &PixelatorWindow::updatePixelation);
+        connect(spinColors, QOverload<int>::of(&QSpinBox::valueChanged), this, &PixelatorWindow::updatePixelation);
 
         // Initialize
         applyTheme();
@@ -253,8 +540,16 @@ private slots:
                                                         QStandardPaths::writableLocation(QStandardPaths::PicturesLocation), 
                                                         filter);
         if (!fileName.isEmpty()) {
-            if (originalImage.load(fileName)) {
-                originalImage = originalImage.convertToFormat(QImage::Format_ARGB32);
+            bool loaded;
+            {
+                I2P_TRACE_SPAN("open.load");
+                loaded = originalImage.load(fileName);
+            }
+            if (loaded) {
+                {
+                    I2P_TRACE_SPAN("open.convert");
+                    originalImage = originalImage.convertToFormat(QImage::Format_ARGB32);
+                }
                 currentFilePath = fileName;
                 btnSave->setEnabled(true);
                 scaleFactor = 1.0; 
@@ -308,7 +603,8 @@ private slots:
                                                         defaultFileName, 
                                                         filter);
         if (!fileName.isEmpty()) {
-            if (processedImage.save(fileName)) {
+            I2P_TRACE_SPAN("save");
+            if (saveProcessedImage(fileName)) {
                 statusLabel->setText(successMsg.arg(fileName));
             } else {
                 statusLabel->setText(errorMsg);
@@ -316,19 +612,113 @@ private slots:
         }
     }
 
+    void chooseGridPhase() {
+        QString title, label;
+        switch (currentLanguage) {
+            case Language::Chinese:
+                title = QString::fromUtf8("网格相位");
+                label = QString::fromUtf8("网格偏移（像素）：");
+                break;
+            case Language::French:
+                title = "Phase de la grille";
+                label = "Décalage de la grille (pixels) :";
+                break;
+            case Language::German:
+                title = "Rasterphase";
+                label = "Rasterversatz (Pixel):";
+                break;
+            case Language::Japanese:
+                title = QString::fromUtf8("グリッド位相");
+                label = QString::fromUtf8("グリッドのオフセット（ピクセル）:");
+                break;
+            default:
+                title = "Grid Phase";
+                label = "Grid offset (pixels):";
+                break;
+        }
+
+        // With MCU alignment on, only multiples of 8 keep block edges on the DCT grid.
+        bool ok = false;
+        int phase = QInputDialog::getInt(this, title, label, gridPhase, 0, spinBlockSize->maximum() - 1,
+                                         alignToMcu ? 8 : 1, &ok);
+        if (ok) {
+            gridPhase = phase;
+            updatePixelation();
+        }
+    }
+
     void updatePixelation() {
         if (originalImage.isNull()) return;
 
-        int blockSize = spinBlockSize->value();
-        if (blockSize <= 1) {
+        // Every render gets a new generation so its spans can be told apart,
+        // including the ones recorded on pool workers.
+        i2p::trace::GenerationScope generation(++renderGeneration);
+        I2P_TRACE_SPAN("update");
+
+        QElapsedTimer timer;
+        timer.start();
+        i2p::RenderParams params;
+        params.mode = chkGrid->isChecked()     ? i2p::PixelateMode::Target
+                      : chkAdaptive->isChecked() ? i2p::PixelateMode::Adaptive
+                                                 : i2p::PixelateMode::Grid;
+        params.gridColumns = spinGridColumns->value();
+        params.gridRows = spinGridRows->value();
+        params.pixelate.grid.blockSize = spinBlockSize->value();
+        params.pixelate.grid.phaseX = params.pixelate.grid.phaseY = effectiveGridPhase();
+        params.pixelate.sampling = blockSampling;
+        params.pixelate.shape = blockShape;
+        params.pixelate.angle = spinAngle->value();
+        params.maxDeviation = spinTolerance->value();
+        params.colors = spinColors->value();
+        if (!paletteLut.empty()) params.palette = &paletteLut;
+        params.dither = ditherMethod;
+        if (params.mode == i2p::PixelateMode::Grid && params.pixelate.grid.blockSize <= 1 && params.colors == 0 &&
+            !params.palette) {
             processedImage = originalImage;
         } else {
-            processedImage = pixelate(originalImage, blockSize);
+            processedImage = render(originalImage, params);
         }
+        hudStats.kernelMs = timer.nsecsElapsed() / 1e6;
+        hudStats.pixels = static_cast<double>(originalImage.width()) * originalImage.height();
 
         updateImageDisplay();
     }
 
+    int effectiveGridPhase() const {
+        int blockSize = spinBlockSize->value();
+        if (blockSize <= 1) return 0;
+        return alignToMcu ? i2p::alignPhaseToMcu(blockSize, gridPhase) : gridPhase % blockSize;
+    }
+
+    bool saveProcessedImage(const QString &fileName) {
+        QString suffix = QFileInfo(fileName).suffix().toLower();
+        // Adaptive blocks, fractional cells, mosaics and turned blocks do not
+        // follow the grid the encoder would assume, and block sizes that are
+        // neither a multiple nor a divisor of 8 leave few units flat.
+        if (!alignToMcu || !i2p::canAlignToMcu(spinBlockSize->value()) || chkAdaptive->isChecked() ||
+            chkGrid->isChecked() || blockShape != i2p::BlockShape::Square || spinAngle->value() != 0 ||
+            (suffix != "jpg" && suffix != "jpeg")) {
+            return processedImage.save(fileName);
+        }
+
+        // MCU-aligned export: hand the grid to the encoder so that flat 8x8
+        // units are written as DC-only blocks.
+        i2p::JpegOptions options;
+        options.grid.blockSize = spinBlockSize->value();
+        options.grid.phaseX = effectiveGridPhase();
+        options.grid.phaseY = options.grid.phaseX;
+
+        std::vector<uint8_t> encoded;
+        if (!i2p::encodeJpeg(constView(processedImage), options, encoded)) {
+            return false;
+        }
+
+        QFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly)) return false;
+        return file.write(reinterpret_cast<const char *>(encoded.data()), encoded.size()) ==
+               static_cast<qint64>(encoded.size());
+    }
+
     void scaleImage(double factor) {
         if (processedImage.isNull()) return;
         
@@ -355,7 +745,169 @@ private slots:
         scrollArea->setWidgetResizable(false);
         QSize newSize = scaleFactor * processedImage.size();
         imageLabel->resize(newSize);
-        imageLabel->setPixmap(QPixmap::fromImage(processedImage));
+
+        QElapsedTimer timer;
+        timer.start();
+        imageLabel->generation = renderGeneration;
+        {
+            I2P_TRACE_SPAN("display.setImage");
+            imageLabel->setImage(processedImage);
+        }
+        hudStats.uploadMs = timer.nsecsElapsed() / 1e6;
+        updateHud();
+    }
+
+    void updateHud() {
+        if (!hudLabel->isVisible()) return;
+
+        QString hudFormat;
+        switch (currentLanguage) {
+            case Language::Chinese:
+                hudFormat = QString::fromUtf8("处理 %1 ms (%2 MP/s) | 上传 %3 ms | 绘制 %4 ms | 图像缓冲 %5 MB | 缓存 %6 MB | 线程 %7");
+                break;
+            case Language::French:
+                hudFormat = "Traitement %1 ms (%2 MP/s) | Envoi %3 ms | Dessin %4 ms | Tampons %5 Mo | Caches %6 Mo | Threads %7";
+                break;
+            case Language::German:
+                hudFormat = "Verarbeitung %1 ms (%2 MP/s) | Upload %3 ms | Zeichnen %4 ms | Puffer %5 MB | Caches %6 MB | Threads %7";
+                break;
+            case Language::Japanese:
+                hudFormat = QString::fromUtf8("処理 %1 ms (%2 MP/s) | 転送 %3 ms | 描画 %4 ms | バッファ %5 MB | キャッシュ %6 MB | スレッド %7");
+                break;
+            default:
+                hudFormat = "Kernel %1 ms (%2 MP/s) | Upload %3 ms | Paint %4 ms | Buffers %5 MB | Caches %6 MB | Threads %7";
+                break;
+        }
+
+        // Image buffers held by the window: the source plus every pooled
+        // render buffer, in use or kept for the next update.
+        const i2p::BufferPool &pool = i2p::BufferPool::instance();
+        qint64 bufferBytes = originalImage.sizeInBytes() + static_cast<qint64>(pool.inUseBytes() + pool.idleBytes());
+        // Lookup structures kept between renders: the turned-grid and mosaic
+        // cell maps and the fixed palette's lookup cube.
+        qint64 cacheBytes =
+            static_cast<qint64>(i2p::rotatedCacheBytes() + i2p::mosaicCacheBytes() + paletteLut.memoryBytes());
+
+        double mpPerSecond = hudStats.kernelMs > 0 ? hudStats.pixels / 1e3 / hudStats.kernelMs : 0.0;
+        hudLabel->setText(hudFormat
+                              .arg(hudStats.kernelMs, 0, 'f', 2)
+                              .arg(mpPerSecond, 0, 'f', 1)
+                              .arg(hudStats.uploadMs, 0, 'f', 2)
+                              .arg(hudStats.paintMs, 0, 'f', 2)
+                              .arg(bufferBytes / (1024.0 * 1024.0), 0, 'f', 1)
+                              .arg(cacheBytes / (1024.0 * 1024.0), 0, 'f', 1)
+                              .arg(i2p::resolveThreadCount(0)));
+    }
+
+    void setBuiltinPalette(const char *name) {
+        i2p::Palette palette;
+        i2p::builtinPalette(name, palette);
+        setFixedPalette(palette);
+    }
+
+    void setFixedPalette(const i2p::Palette &palette) {
+        if (palette.empty()) {
+            paletteLut = i2p::PaletteLut();
+        } else {
+            paletteLut.build(palette, paletteWeightedAction->isChecked() ? i2p::ColorMetric::Weighted
+                                                                         : i2p::ColorMetric::Rgb);
+        }
+        // A fixed palette replaces the fitted one.
+        lblColors->setEnabled(paletteLut.empty());
+        spinColors->setEnabled(paletteLut.empty());
+        updatePixelation();
+    }
+
+    void loadPaletteFile() {
+        QString title, filter, errorMsg;
+        switch (currentLanguage) {
+            case Language::Chinese:
+                title = QString::fromUtf8("加载调色板");
+                filter = QString::fromUtf8("调色板 (*.gpl *.hex)");
+                errorMsg = QString::fromUtf8("无法加载调色板: %1");
+                break;
+            case Language::French:
+                title = "Charger une palette";
+                filter = "Palettes (*.gpl *.hex)";
+                errorMsg = "Impossible de charger la palette : %1";
+                break;
+            case Language::German:
+                title = "Palette laden";
+                filter = "Paletten (*.gpl *.hex)";
+                errorMsg = "Palette konnte nicht geladen werden: %1";
+                break;
+            case Language::Japanese:
+                title = QString::fromUtf8("パレットを読み込む");
+                filter = QString::fromUtf8("パレット (*.gpl *.hex)");
+                errorMsg = QString::fromUtf8("パレットを読み込めませんでした: %1");
+                break;
+            default:
+                title = "Load Palette";
+                filter = "Palettes (*.gpl *.hex)";
+                errorMsg = "Cannot load palette: %1";
+                break;
+        }
+
+        QString fileName = QFileDialog::getOpenFileName(this, title, QString(), filter);
+        i2p::Palette palette;
+        std::string error;
+        if (fileName.isEmpty() || !i2p::loadPalette(fileName.toLocal8Bit().constData(), palette, error)) {
+            if (!fileName.isEmpty()) statusLabel->setText(errorMsg.arg(QString::fromStdString(error)));
+            // Keep the menu showing the palette that is still in use.
+            if (paletteLut.empty()) paletteNoneAction->setChecked(true);
+            return;
+        }
+        setFixedPalette(palette);
+    }
+
+    void exportTrace() {
+        QString title, filter, successMsg, errorMsg;
+        switch (currentLanguage) {
+            case Language::Chinese:
+                title = QString::fromUtf8("导出追踪");
+                filter = QString::fromUtf8("Chrome 追踪文件 (*.json)");
+                successMsg = QString::fromUtf8("追踪已保存至: %1");
+                errorMsg = QString::fromUtf8("保存追踪失败。");
+                break;
+            case Language::French:
+                title = "Exporter la trace";
+                filter = "Trace Chrome (*.json)";
+                successMsg = "Trace enregistrée sous : %1";
+                errorMsg = "Erreur lors de l'enregistrement de la trace.";
+                break;
+            case Language::German:
+                title = "Trace exportieren";
+                filter = "Chrome-Trace (*.json)";
+                successMsg = "Trace gespeichert unter: %1";
+                errorMsg = "Fehler beim Speichern des Traces.";
+                break;
+            case Language::Japanese:
+                title = QString::fromUtf8("トレースを書き出す");
+                filter = QString::fromUtf8("Chrome トレース (*.json)");
+                successMsg = QString::fromUtf8("トレースを保存しました: %1");
+                errorMsg = QString::fromUtf8("トレースの保存に失敗しました。");
+                break;
+            default:
+                title = "Export Trace";
+                filter = "Chrome Trace (*.json)";
+                successMsg = "Trace saved to: %1";
+                errorMsg = "Error saving trace.";
+                break;
+        }
+
+        QString fileName = QFileDialog::getSaveFileName(this, title,
+                                                        QStandardPaths::writableLocation(QStandardPaths::DocumentsLocation) + "/image2pixel-trace.json",
+                                                        filter);
+        if (fileName.isEmpty()) return;
+
+        std::string json = i2p::trace::chromeTraceJson();
+        QFile file(fileName);
+        if (file.open(QIODevice::WriteOnly) &&
+            file.write(json.data(), json.size()) == static_cast<qint64>(json.size())) {
+            statusLabel->setText(successMsg.arg(fileName));
+        } else {
+            statusLabel->setText(errorMsg);
+        }
     }
 
     void showAboutDialog() {
@@ -413,59 +965,37 @@ private slots:
     }
 
 private:
-    QImage pixelate(const QImage &source, int blockSize) {
-        QImage result = source.copy();
-        int width = result.width();
-        int height = result.height();
-
-        // Direct memory access for speed (simplified for readability/safety)
-        for (int y = 0; y < height; y += blockSize) {
-            for (int x = 0; x < width; x += blockSize) {
-                
-                long r = 0, g = 0, b = 0, a = 0;
-                int count = 0;
-
-                // 1. Calculate Average
-                for (int by = 0; by < blockSize; ++by) {
-                    if (y + by >= height) break;
-                    for (int bx = 0; bx < blockSize; ++bx) {
-                        if (x + bx >= width) break;
-                        
-                        QColor pixelColor = source.pixelColor(x + bx, y + by);
-                        r += pixelColor.red();
-                        g += pixelColor.green();
-                        b += pixelColor.blue();
-                        a += pixelColor.alpha();
-                        count++;
-                    }
-                }
+    QImage render(const QImage &source, const i2p::RenderParams &params) {
+        // source is always Format_ARGB32 (converted in openImage). The result
+        // wraps a pooled buffer that goes back to the pool once the last
+        // QImage sharing it (processedImage or the view's copy) is gone, so
+        // steady-state updates recycle two buffers instead of allocating.
+        i2p::ImageView target = i2p::BufferPool::instance().acquire(source.width(), source.height(),
+                                                                     i2p::PixelFormat::Argb32);
+        if (!target.data) return QImage();
+        QImage result(target.data, target.width, target.height, static_cast<qsizetype>(target.stride),
+                      QImage::Format_ARGB32, releasePooledBuffer, target.data);
 
-                if (count == 0) continue;
-                
-                QColor avgColor(r/count, g/count, b/count, a/count);
-                QRgb avgRgb = avgColor.rgba();
-
-                // 2. Fill Block
-                for (int by = 0; by < blockSize; ++by) {
-                    int destY = y + by;
-                    if (destY >= height) break;
-                    
-                    // Optimization: Get scanline pointer could be faster, but setPixel is safer
-                    for (int bx = 0; bx < blockSize; ++bx) {
-                        int destX = x + bx;
-                        if (destX >= width) break;
-                        
-                        result.setPixel(destX, destY, avgRgb);
-                    }
-                }
-            }
-        }
+        // On failure the buffer was never written; dropping `result` hands
+        // it back to the pool.
+        if (!i2p::render(constView(source), target, params)) return QImage();
         return result;
     }
 
     void updateTexts() {
         QString title, btnOpenText, btnSaveText, zoomText, pixelSizeText, helpText, settingsText, langText, themeText, aboutText, noImageText, readyText;
         QString themeSystemText, themeLightText, themeDarkText;
+        QString jpegText, alignMcuText, gridPhaseText;
+        QString traceText, recordTraceText, exportTraceText, hudText;
+        QString adaptiveText, toleranceText, adaptiveTip;
+        QString gridText, gridTip;
+        QString angleText, angleTip;
+        QString colorsText, colorsOffText;
+        QString paletteText, paletteNoneText, paletteLoadText, paletteWeightedText;
+        QString ditherText, ditherNoneText;
+        QString samplingText, samplingMeanText, samplingOklabText, samplingDominantText;
+        QString samplingMedianText, samplingTrimmedText;
+        QString shapeText, shapeSquareText, shapeHexagonText, shapeTriangleText, shapeDotText;
 
         switch (currentLanguage) {
             case Language::Chinese:
@@ -484,6 +1014,39 @@ private:
                 themeSystemText = QString::fromUtf8("系统默认");
                 themeLightText = QString::fromUtf8("白天模式");
                 themeDarkText = QString::fromUtf8("夜间模式");
+                jpegText = QString::fromUtf8("JPEG 导出");
+                alignMcuText = QString::fromUtf8("像素网格对齐 8×8 块");
+                gridPhaseText = QString::fromUtf8("网格相位...");
+                traceText = QString::fromUtf8("性能追踪");
+                recordTraceText = QString::fromUtf8("记录追踪");
+                exportTraceText = QString::fromUtf8("导出追踪...");
+                hudText = QString::fromUtf8("显示性能 HUD");
+                adaptiveText = QString::fromUtf8("自适应");
+                toleranceText = QString::fromUtf8("容差:");
+                adaptiveTip = QString::fromUtf8("细节处保留小块，平坦区域合并为大块；像素大小为最小块");
+                gridText = QString::fromUtf8("固定网格");
+                gridTip = QString::fromUtf8("输出恰好为 列×行 个方块，方块可以是小数像素大小；代替像素大小");
+                angleText = QString::fromUtf8("角度:");
+                angleTip = QString::fromUtf8("将方块网格顺时针旋转；旋转后的方块始终取平均色");
+                colorsText = QString::fromUtf8("颜色数:");
+                colorsOffText = QString::fromUtf8("关闭");
+                paletteText = QString::fromUtf8("调色板");
+                paletteNoneText = QString::fromUtf8("不使用固定调色板");
+                paletteLoadText = QString::fromUtf8("加载调色板文件...");
+                paletteWeightedText = QString::fromUtf8("加权颜色距离");
+                ditherText = QString::fromUtf8("抖动");
+                ditherNoneText = QString::fromUtf8("无");
+                samplingText = QString::fromUtf8("方块颜色");
+                samplingMeanText = QString::fromUtf8("平均值（sRGB）");
+                samplingOklabText = QString::fromUtf8("感知平均（Oklab）");
+                samplingDominantText = QString::fromUtf8("主色");
+                samplingMedianText = QString::fromUtf8("中位数");
+                samplingTrimmedText = QString::fromUtf8("截尾平均");
+                shapeText = QString::fromUtf8("方块形状");
+                shapeSquareText = QString::fromUtf8("方形");
+                shapeHexagonText = QString::fromUtf8("六边形");
+                shapeTriangleText = QString::fromUtf8("三角形");
+                shapeDotText = QString::fromUtf8("圆点");
                 break;
             case Language::French:
                 title = "Image2Pixel";
@@ -501,6 +1064,39 @@ private:
                 themeSystemText = "Défaut système";
                 themeLightText = "Clair";
                 themeDarkText = "Sombre";
+                jpegText = "Export JPEG";
+                alignMcuText = "Aligner la grille sur les blocs 8×8";
+                gridPhaseText = "Phase de la grille...";
+                traceText = "Trace de performance";
+                recordTraceText = "Enregistrer la trace";
+                exportTraceText = "Exporter la trace...";
+                hudText = "Afficher le HUD de performance";
+                adaptiveText = "Adaptatif";
+                toleranceText = "Tolérance :";
+                adaptiveTip = "Petits blocs dans les détails, grands blocs dans les zones unies ; la taille du pixel est le plus petit bloc";
+                gridText = "Grille fixe";
+                gridTip = QString::fromUtf8("Exactement colonnes × lignes blocs, de taille fractionnaire si besoin ; remplace la taille du pixel");
+                angleText = "Angle :";
+                angleTip = QString::fromUtf8("Fait pivoter la grille des blocs dans le sens horaire ; les blocs pivotés prennent toujours la moyenne");
+                colorsText = "Couleurs :";
+                colorsOffText = "Désactivé";
+                paletteText = "Palette";
+                paletteNoneText = "Aucune palette fixe";
+                paletteLoadText = "Charger un fichier de palette...";
+                paletteWeightedText = "Distance de couleur pondérée";
+                ditherText = "Tramage";
+                ditherNoneText = "Aucun";
+                samplingText = "Couleur des blocs";
+                samplingMeanText = "Moyenne (sRGB)";
+                samplingOklabText = "Moyenne perceptuelle (Oklab)";
+                samplingDominantText = "Couleur dominante";
+                samplingMedianText = QString::fromUtf8("Médiane");
+                samplingTrimmedText = QString::fromUtf8("Moyenne tronquée");
+                shapeText = "Forme des blocs";
+                shapeSquareText = QString::fromUtf8("Carré");
+                shapeHexagonText = "Hexagone";
+                shapeTriangleText = "Triangle";
+                shapeDotText = "Point";
                 break;
             case Language::German:
                 title = "Image2Pixel";
@@ -518,6 +1114,39 @@ private:
                 themeSystemText = "Systemstandard";
                 themeLightText = "Hell";
                 themeDarkText = "Dunkel";
+                jpegText = "JPEG-Export";
+                alignMcuText = "Pixelraster an 8×8-Blöcken ausrichten";
+                gridPhaseText = "Rasterphase...";
+                traceText = "Leistungs-Trace";
+                recordTraceText = "Trace aufzeichnen";
+                exportTraceText = "Trace exportieren...";
+                hudText = "Leistungs-HUD anzeigen";
+                adaptiveText = "Adaptiv";
+                toleranceText = "Toleranz:";
+                adaptiveTip = "Kleine Blöcke in Details, große Blöcke in flachen Bereichen; die Pixelgröße ist der kleinste Block";
+                gridText = "Festes Raster";
+                gridTip = QString::fromUtf8("Genau Spalten × Zeilen Blöcke, auch mit gebrochener Pixelgröße; ersetzt die Pixelgröße");
+                angleText = "Winkel:";
+                angleTip = QString::fromUtf8("Dreht das Blockraster im Uhrzeigersinn; gedrehte Blöcke nehmen immer den Mittelwert");
+                colorsText = "Farben:";
+                colorsOffText = "Aus";
+                paletteText = "Palette";
+                paletteNoneText = "Keine feste Palette";
+                paletteLoadText = "Palettendatei laden...";
+                paletteWeightedText = "Gewichteter Farbabstand";
+                ditherText = "Dithering";
+                ditherNoneText = "Keines";
+                samplingText = "Blockfarbe";
+                samplingMeanText = "Mittelwert (sRGB)";
+                samplingOklabText = QString::fromUtf8("Wahrnehmungsgerechter Mittelwert (Oklab)");
+                samplingDominantText = "Vorherrschende Farbe";
+                samplingMedianText = "Median";
+                samplingTrimmedText = "Getrimmter Mittelwert";
+                shapeText = "Blockform";
+                shapeSquareText = "Quadrat";
+                shapeHexagonText = "Sechseck";
+                shapeTriangleText = "Dreieck";
+                shapeDotText = "Punkt";
                 break;
             case Language::Japanese:
                 title = QString::fromUtf8("Image2Pixel");
@@ -535,6 +1164,39 @@ private:
                 themeSystemText = QString::fromUtf8("システムのデフォルト");
                 themeLightText = QString::fromUtf8("ライト");
                 themeDarkText = QString::fromUtf8("ダーク");
+                jpegText = QString::fromUtf8("JPEG 書き出し");
+                alignMcuText = QString::fromUtf8("ピクセルグリッドを 8×8 ブロックに揃える");
+                gridPhaseText = QString::fromUtf8("グリッド位相...");
+                traceText = QString::fromUtf8("パフォーマンストレース");
+                recordTraceText = QString::fromUtf8("トレースを記録");
+                exportTraceText = QString::fromUtf8("トレースを書き出す...");
+                hudText = QString::fromUtf8("パフォーマンス HUD を表示");
+                adaptiveText = QString::fromUtf8("アダプティブ");
+                toleranceText = QString::fromUtf8("許容差:");
+                adaptiveTip = QString::fromUtf8("細部は小さなブロック、平坦な部分は大きなブロックにまとめます。ピクセルサイズが最小ブロックです");
+                gridText = QString::fromUtf8("固定グリッド");
+                gridTip = QString::fromUtf8("出力をちょうど 列×行 のブロックにします（小数ピクセルのサイズも可）。ピクセルサイズの代わりに使います");
+                angleText = QString::fromUtf8("角度:");
+                angleTip = QString::fromUtf8("ブロックの格子を時計回りに回転します。回転したブロックは常に平均色になります");
+                colorsText = QString::fromUtf8("色数:");
+                colorsOffText = QString::fromUtf8("オフ");
+                paletteText = QString::fromUtf8("パレット");
+                paletteNoneText = QString::fromUtf8("固定パレットなし");
+                paletteLoadText = QString::fromUtf8("パレットファイルを読み込む...");
+                paletteWeightedText = QString::fromUtf8("重み付き色距離");
+                ditherText = QString::fromUtf8("ディザリング");
+                ditherNoneText = QString::fromUtf8("なし");
+                samplingText = QString::fromUtf8("ブロックの色");
+                samplingMeanText = QString::fromUtf8("平均 (sRGB)");
+                samplingOklabText = QString::fromUtf8("知覚的平均 (Oklab)");
+                samplingDominantText = QString::fromUtf8("最頻色");
+                samplingMedianText = QString::fromUtf8("中央値");
+                samplingTrimmedText = QString::fromUtf8("トリム平均");
+                shapeText = QString::fromUtf8("ブロックの形");
+                shapeSquareText = QString::fromUtf8("正方形");
+                shapeHexagonText = QString::fromUtf8("六角形");
+                shapeTriangleText = QString::fromUtf8("三角形");
+                shapeDotText = QString::fromUtf8("ドット");
                 break;
             default: // English
                 title = "Image2Pixel";
@@ -552,6 +1214,39 @@ private:
                 themeSystemText = "System Default";
                 themeLightText = "Light";
                 themeDarkText = "Dark";
+                jpegText = "JPEG Export";
+                alignMcuText = "Align Pixel Grid to 8×8 Blocks";
+                gridPhaseText = "Grid Phase...";
+                traceText = "Performance Trace";
+                recordTraceText = "Record Trace";
+                exportTraceText = "Export Trace...";
+                hudText = "Show Performance HUD";
+                adaptiveText = "Adaptive";
+                toleranceText = "Tolerance:";
+                adaptiveTip = "Small blocks where there is detail, large blocks in flat areas; the pixel size is the smallest block";
+                gridText = "Fixed Grid";
+                gridTip = QString::fromUtf8("Exactly columns × rows blocks, fractional pixels wide if need be; replaces the pixel size");
+                angleText = "Angle:";
+                angleTip = "Turns the block grid clockwise; turned blocks always take the average";
+                colorsText = "Colors:";
+                colorsOffText = "Off";
+                paletteText = "Palette";
+                paletteNoneText = "No Fixed Palette";
+                paletteLoadText = "Load Palette File...";
+                paletteWeightedText = "Weighted Color Distance";
+                ditherText = "Dithering";
+                ditherNoneText = "None";
+                samplingText = "Block Color";
+                samplingMeanText = "Average (sRGB)";
+                samplingOklabText = "Perceptual Average (Oklab)";
+                samplingDominantText = "Dominant Color";
+                samplingMedianText = "Median";
+                samplingTrimmedText = "Trimmed Mean";
+                shapeText = "Block Shape";
+                shapeSquareText = "Square";
+                shapeHexagonText = "Hexagon";
+                shapeTriangleText = "Triangle";
+                shapeDotText = "Dot";
                 break;
         }
 
@@ -560,11 +1255,45 @@ private:
         btnSave->setText(btnSaveText);
         zoomLabel->setText(zoomText);
         lblBlockSize->setText(pixelSizeText);
+        lblAngle->setText(angleText);
+        spinAngle->setToolTip(angleTip);
+        chkAdaptive->setText(adaptiveText);
+        chkAdaptive->setToolTip(adaptiveTip);
+        lblTolerance->setText(toleranceText);
+        chkGrid->setText(gridText);
+        chkGrid->setToolTip(gridTip);
+        lblColors->setText(colorsText);
+        spinColors->setSpecialValueText(colorsOffText);
+        samplingMenu->setTitle(samplingText);
+        samplingMeanAction->setText(samplingMeanText);
+        samplingOklabAction->setText(samplingOklabText);
+        samplingDominantAction->setText(samplingDominantText);
+        samplingMedianAction->setText(samplingMedianText);
+        samplingTrimmedAction->setText(samplingTrimmedText);
+        shapeMenu->setTitle(shapeText);
+        shapeSquareAction->setText(shapeSquareText);
+        shapeHexagonAction->setText(shapeHexagonText);
+        shapeTriangleAction->setText(shapeTriangleText);
+        shapeDotAction->setText(shapeDotText);
+        paletteMenu->setTitle(paletteText);
+        paletteNoneAction->setText(paletteNoneText);
+        paletteLoadAction->setText(paletteLoadText);
+        paletteWeightedAction->setText(paletteWeightedText);
+        ditherMenu->setTitle(ditherText);
+        ditherNoneAction->setText(ditherNoneText);
         helpMenu->setTitle(helpText);
         settingsMenu->setTitle(settingsText);
         langMenu->setTitle(langText);
         themeMenu->setTitle(themeText);
         aboutAction->setText(aboutText);
+        jpegMenu->setTitle(jpegText);
+        traceMenu->setTitle(traceText);
+        recordTraceAction->setText(recordTraceText);
+        exportTraceAction->setText(exportTraceText);
+        hudAction->setText(hudText);
+        updateHud();
+        alignMcuAction->setText(alignMcuText);
+        gridPhaseAction->setText(gridPhaseText);
 
         if (originalImage.isNull()) {
             scrollArea->setWidgetResizable(true);
@@ -593,7 +1322,18 @@ private:
     
     QSpinBox *spinBlockSize;
     QLabel *lblBlockSize;
-    QLabel *imageLabel;
+    QLabel *lblAngle;
+    QSpinBox *spinAngle;
+    QLabel *lblColors;
+    QSpinBox *spinColors;
+    QCheckBox *chkAdaptive;
+    QLabel *lblTolerance;
+    QSpinBox *spinTolerance;
+    QCheckBox *chkGrid;
+    QSpinBox *spinGridColumns;
+    QLabel *lblGridBy;
+    QSpinBox *spinGridRows;
+    ImageLabel *imageLabel;
     QScrollArea *scrollArea;
     QLabel *statusLabel;
     QLabel *zoomLabel;
@@ -602,19 +1342,165 @@ private:
     QMenu *settingsMenu;
     QMenu *langMenu;
     QMenu *themeMenu;
+    QMenu *jpegMenu;
+    QMenu *traceMenu;
+    QMenu *samplingMenu;
+    QMenu *shapeMenu;
+    QMenu *paletteMenu;
+    QMenu *ditherMenu;
     QAction *aboutAction;
+    QAction *alignMcuAction;
+    QAction *gridPhaseAction;
+    QAction *samplingMeanAction;
+    QAction *samplingOklabAction;
+    QAction *samplingDominantAction;
+    QAction *samplingMedianAction;
+    QAction *samplingTrimmedAction;
+    QAction *shapeSquareAction;
+    QAction *shapeHexagonAction;
+    QAction *shapeTriangleAction;
+    QAction *shapeDotAction;
+    QAction *paletteNoneAction;
+    QAction *paletteLoadAction;
+    QAction *paletteWeightedAction;
+    QAction *ditherNoneAction;
+    QAction *recordTraceAction;
+    QAction *exportTraceAction;
+    QAction *hudAction;
+    QLabel *hudLabel;
 
     QImage originalImage;
     QImage processedImage;
     QString currentFilePath;
     double scaleFactor = 1.0;
+    int gridPhase = 0;
+    i2p::PaletteLut paletteLut;
+    i2p::DitherMethod ditherMethod = i2p::DitherMethod::None;
+    i2p::BlockSampling blockSampling = i2p::BlockSampling::Mean;
+    i2p::BlockShape blockShape = i2p::BlockShape::Square;
+    uint64_t renderGeneration = 0;
+
+    // Timings of the last render, shown by the performance HUD.
+    struct HudStats {
+        double kernelMs = 0.0;
+        double uploadMs = 0.0;
+        double paintMs = 0.0;
+        double pixels = 0.0;
+    } hudStats;
+    uint64_t hudPaintGeneration = 0;
+    bool alignToMcu = false;
     Language currentLanguage = Language::Chinese;
     Theme currentTheme = Theme::System;
 };
 
 #include "main.moc"
 
+#ifndef IMAGE2PIXEL_VERSION
+#define IMAGE2PIXEL_VERSION "unknown"
+#endif
+
+// Headless mode: `image2pixel -i in.png -o out.png ...`. Shares its flags with
+// image2pixel-core-cli; JPEG output goes through the same encoder, so both
+// front ends write identical files from PNG or BMP inputs. JPEG inputs are
+// decoded by Qt here and by stb there, and their pixels may differ.
+static int runHeadless(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+
+    i2p::CliOptions options;
+    std::string error;
+    if (!i2p::parseCliOptions(argc, argv, options, error)) {
+        std::fprintf(stderr, "error: %s\n\n%s", error.c_str(), i2p::cliUsage(argv[0]).c_str());
+        return 2;
+    }
+    i2p::trace::setThreadName("main");
+    i2p::trace::ScopedTraceFile traceFile(options.traceFile);
+    if (options.showHelp) {
+        std::printf("%s", i2p::cliUsage(argv[0]).c_str());
+        return 0;
+    }
+    if (options.showVersion) {
+        std::printf("image2pixel %s\n", IMAGE2PIXEL_VERSION);
+        return 0;
+    }
+
+    i2p::PaletteLut paletteLut;
+    i2p::RenderParams params;
+    if (!i2p::toRenderParams(options, paletteLut, params, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Generated images headed for a streamable format never exist in full.
+    if (options.generate && i2p::NetpbmWriter::supports(options.output) && i2p::isStreamable(params)) {
+        if (!i2p::streamSynthetic(options.output, options.synth, params.pixelate, error)) {
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    QImage source;
+    if (options.generate) {
+        source = QImage(options.synth.width, options.synth.height, QImage::Format_ARGB32);
+        if (source.isNull()) {
+            std::fprintf(stderr, "error: out of memory\n");
+            return 1;
+        }
+        i2p::synthesizeRows(options.synth, 0, mutableView(source));
+    } else {
+        I2P_TRACE_SPAN("load");
+        if (!source.load(QString::fromLocal8Bit(options.input.c_str()))) {
+            std::fprintf(stderr, "error: cannot load %s\n", options.input.c_str());
+            return 1;
+        }
+    }
+    {
+        I2P_TRACE_SPAN("convert");
+        source = source.convertToFormat(QImage::Format_ARGB32);
+    }
+
+    // The kernel runs in place, so no second full-size image is needed.
+    QImage &result = source;
+    i2p::ImageView target = mutableView(result);
+    if (!i2p::render(target, target, params)) {
+        std::fprintf(stderr, "error: pixelation failed\n");
+        return 1;
+    }
+
+    I2P_TRACE_SPAN("save");
+    QString outputPath = QString::fromLocal8Bit(options.output.c_str());
+    bool saved = false;
+    if (i2p::isJpegPath(options.output)) {
+        i2p::JpegOptions jpeg;
+        jpeg.quality = options.quality;
+        if (options.alignMcu && i2p::usesUprightGrid(options)) jpeg.grid = params.pixelate.grid;
+
+        std::vector<uint8_t> encoded;
+        QFile file(outputPath);
+        saved = i2p::encodeJpeg(constView(result), jpeg, encoded) &&
+                file.open(QIODevice::WriteOnly) &&
+                file.write(reinterpret_cast<const char *>(encoded.data()), encoded.size()) ==
+                    static_cast<qint64>(encoded.size());
+    } else if (i2p::NetpbmWriter::supports(options.output)) {
+        i2p::NetpbmWriter writer;
+        saved = writer.open(options.output, result.width(), result.height(), i2p::PixelFormat::Argb32) &&
+                writer.writeRows(constView(result)) && writer.close();
+    } else {
+        saved = result.save(outputPath);
+    }
+
+    if (!saved) {
+        std::fprintf(stderr, "error: cannot save %s\n", options.output.c_str());
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
+    if (i2p::isHeadlessInvocation(argc, argv)) {
+        return runHeadless(argc, argv);
+    }
+
     // Enable High DPI scaling
 #if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
     QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
@@ -622,6 +1508,7 @@ int main(int argc, char *argv[]) {
     QApplication::setStyle("Fusion"); // Fusion style looks uniform across platforms
 
     QApplication app(argc, argv);
+    i2p::trace::setThreadName("GUI");
     
     PixelatorWindow window;
     window.show();
@@ -0,0 +1,148 @@
+// Qt-free command-line front end: stb for decoding/encoding, the shared core
+// for everything else. Accepts the same flags as `image2pixel --input ...`
+// and produces the same pixels for PNG and BMP inputs; JPEG inputs are
+// decoded by stb here and by Qt's libjpeg there, which round differently.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_BMP
+#include "stb_image.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "cli_options.h"
+#include "jpeg_writer.h"
+#include "netpbm_writer.h"
+#include "render.h"
+#include "synth.h"
+#include "trace.h"
+
+#ifndef IMAGE2PIXEL_VERSION
+#define IMAGE2PIXEL_VERSION "unknown"
+#endif
+
+namespace {
+
+bool writeFile(const std::string &path, const std::vector<uint8_t> &bytes) {
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+bool saveImage(const std::string &path, const i2p::ConstImageView &image, const i2p::CliOptions &options) {
+    if (i2p::isJpegPath(path)) {
+        i2p::JpegOptions jpeg;
+        jpeg.quality = options.quality;
+        // DC-only blocks need the uniform grid of squares; adaptive,
+        // target-grid, mosaic and turned output is encoded normally.
+        if (options.alignMcu && i2p::usesUprightGrid(options)) jpeg.grid = i2p::toPixelateParams(options).grid;
+        std::vector<uint8_t> encoded;
+        return i2p::encodeJpeg(image, jpeg, encoded) && writeFile(path, encoded);
+    }
+    if (i2p::NetpbmWriter::supports(path)) {
+        i2p::NetpbmWriter writer;
+        return writer.open(path, image.width, image.height, image.format) && writer.writeRows(image) &&
+               writer.close();
+    }
+    if (i2p::hasExtension(path, "png")) {
+        return stbi_write_png(path.c_str(), image.width, image.height, 4, image.data,
+                              static_cast<int>(image.stride)) != 0;
+    }
+    if (i2p::hasExtension(path, "bmp")) {
+        return stbi_write_bmp(path.c_str(), image.width, image.height, 4, image.data) != 0;
+    }
+    std::fprintf(stderr, "error: unsupported output format: %s\n", path.c_str());
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    i2p::CliOptions options;
+    std::string error;
+    if (!i2p::parseCliOptions(argc, argv, options, error)) {
+        std::fprintf(stderr, "error: %s\n\n%s", error.c_str(), i2p::cliUsage(argv[0]).c_str());
+        return 2;
+    }
+    if (options.showHelp) {
+        std::printf("%s", i2p::cliUsage(argv[0]).c_str());
+        return 0;
+    }
+    if (options.showVersion) {
+        std::printf("image2pixel-core-cli %s\n", IMAGE2PIXEL_VERSION);
+        return 0;
+    }
+
+    i2p::trace::setThreadName("main");
+    i2p::trace::ScopedTraceFile traceFile(options.traceFile);
+    i2p::PaletteLut paletteLut;
+    i2p::RenderParams params;
+    if (!i2p::toRenderParams(options, paletteLut, params, error)) {
+        std::fprintf(stderr, "error: %s\n", error.c_str());
+        return 1;
+    }
+
+    // Generated images headed for a streamable format never exist in full.
+    if (options.generate && i2p::NetpbmWriter::supports(options.output) && i2p::isStreamable(params)) {
+        if (!i2p::streamSynthetic(options.output, options.synth, params.pixelate, error)) {
+            std::fprintf(stderr, "error: %s\n", error.c_str());
+            return 1;
+        }
+        return 0;
+    }
+
+    int width = 0, height = 0, channels = 0;
+    stbi_uc *pixels = nullptr;
+    if (options.generate) {
+        width = options.synth.width;
+        height = options.synth.height;
+        pixels = static_cast<stbi_uc *>(STBI_MALLOC(static_cast<size_t>(width) * height * 4));
+        if (!pixels) {
+            std::fprintf(stderr, "error: out of memory\n");
+            return 1;
+        }
+    } else {
+        I2P_TRACE_SPAN("load");
+        // stb's JPEG decoder is not bit-exact with libjpeg, so JPEG inputs
+        // can differ slightly from the GUI build's.
+        pixels = stbi_load(options.input.c_str(), &width, &height, &channels, 4);
+        if (!pixels) {
+            std::fprintf(stderr, "error: cannot load %s: %s\n", options.input.c_str(), stbi_failure_reason());
+            return 1;
+        }
+    }
+
+    // Pixelate in place: the core reads each block before overwriting it.
+    i2p::ImageView image;
+    image.data = pixels;
+    image.width = width;
+    image.height = height;
+    image.stride = static_cast<ptrdiff_t>(width) * 4;
+    image.format = i2p::PixelFormat::Rgba8888;
+
+    if (options.generate) i2p::synthesizeRows(options.synth, 0, image);
+    if (!i2p::render(image, image, params)) {
+        std::fprintf(stderr, "error: pixelation failed\n");
+        stbi_image_free(pixels);
+        return 1;
+    }
+
+    bool saved;
+    {
+        I2P_TRACE_SPAN("save");
+        saved = saveImage(options.output, image, options);
+    }
+    stbi_image_free(pixels);
+    if (!saved) {
+        std::fprintf(stderr, "error: cannot save %s\n", options.output.c_str());
+        return 1;
+    }
+    return 0;
+}